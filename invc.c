@@ -1,15 +1,153 @@
+#define _GNU_SOURCE
+// Declares the session extension, which records changes for offline sync
+#define SQLITE_ENABLE_SESSION
+#define SQLITE_ENABLE_PREUPDATE_HOOK
 #include <sqlite3.h>
+#include <zlib.h>
 #include <ncurses.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define ARRLEN(rr) (sizeof(rr)/sizeof(rr[0]))
 
 #define BY_NAME  0
 #define BY_ABOUT 1
+#define BY_FUZZY 2
+#define BY_ATTR  3
+#define BY_SITES 4
+
+/* Panel sort orders: a key field, optionally descending. Ties are broken
+   by id, so every row has a unique place to page from. */
+#define SORT_ID    0
+#define SORT_NAME  1
+#define SORT_COUNT 2
+#define SORT_DESC  4
+#define SORT_MODES 8
+#define SORT_FIELD(sort) ((sort) & ~SORT_DESC)
+
+// How a page of children is found: by offset, or next to a known row
+#define SEEK_OFFSET 0
+#define SEEK_AFTER  1
+#define SEEK_BEFORE 2
+#define SEEK_KINDS  3
+
+// Fuzzy queries need one trigram; they allow an edit per four characters
+#define FUZZY_MIN 3
+
+// Predicates in one attribute search, and the width of a panel's attribute column
+#define ATTR_TERMS 8
+#define ATTR_WIDTH 10
+
+// Attachments are hashed, stored and saved this many bytes at a time
+#define ATTACH_CHUNK 65536
+
+/* Descriptions from this many bytes on are stored deflated; dictionaries
+   trained with --compress hold up to ABOUT_DICTIONARY bytes, learned from
+   up to ABOUT_SAMPLE descriptions. */
+#define ABOUT_COMPRESS_MIN 256
+#define ABOUT_HEADER 8
+#define ABOUT_DICTIONARY 16384
+#define ABOUT_SAMPLE 2000
+#define ABOUT_DICTIONARY_TABLE "CREATE TABLE IF NOT EXISTS about_dictionary(" \
+    "id INTEGER PRIMARY KEY, trained INT, data BLOB NOT NULL);"
+
+/* Offline sync. Each copy of a database is a replica with a number of
+   its own, and hands out new item ids only from its own block of ids, so
+   copies edited apart never give two items the same id. */
+#define SYNC_BLOCK 16777216
+#define SYNC_REPLICAS 128
+#define SYNC_MAGIC "INVCSYNC"
+#define SYNC_VERSION 1
+#define SYNC_TABLES "CREATE TABLE IF NOT EXISTS sync_state(replica INT NOT NULL);" \
+    "CREATE TABLE IF NOT EXISTS sync_log(id INTEGER PRIMARY KEY, stamp INT NOT NULL, origin INT, changes BLOB NOT NULL);" \
+    "CREATE TABLE IF NOT EXISTS sync_peer(replica INTEGER PRIMARY KEY, sent INT NOT NULL, received INT NOT NULL);"
+
+/* Trigram index upkeep. The triggers in the file only note which items
+   changed in item_text_pending, with the name and description the index
+   still holds for them (old is 0 if it holds none), so any tool can write
+   the item table. SQL_TRIGRAM_TRIGGER, which is TEMP, indexes each noted
+   item at once on invc's own connection, inflating its description; items
+   other tools changed are indexed when invc next opens the file or sits
+   idle. */
+#define SQL_TRIGRAM_TABLES \
+    "CREATE TABLE IF NOT EXISTS item_text_pending(id INTEGER PRIMARY KEY, old INT NOT NULL, name TEXT, about);" \
+    "CREATE VIRTUAL TABLE IF NOT EXISTS item_trigram USING fts5(name, about, content='', tokenize='trigram');" \
+    "CREATE TRIGGER IF NOT EXISTS item_trigram_insert AFTER INSERT ON item BEGIN " \
+    "INSERT OR IGNORE INTO item_text_pending(id, old) VALUES (new.id, 0);" \
+    "END;" \
+    "CREATE TRIGGER IF NOT EXISTS item_trigram_delete AFTER DELETE ON item BEGIN " \
+    "INSERT OR IGNORE INTO item_text_pending(id, old, name, about) VALUES (old.id, 1, old.name, old.about);" \
+    "END;" \
+    "CREATE TRIGGER IF NOT EXISTS item_trigram_update AFTER UPDATE OF name, about ON item BEGIN " \
+    "INSERT OR IGNORE INTO item_text_pending(id, old, name, about) VALUES (old.id, 1, old.name, old.about);" \
+    "END;"
+#define SQL_TRIGRAM_TRIGGER \
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_text_index AFTER INSERT ON main.item_text_pending BEGIN " \
+    "INSERT INTO item_trigram(item_trigram, rowid, name, about) SELECT 'delete', new.id, new.name, invc_about(new.about) WHERE new.old;" \
+    "INSERT INTO item_trigram(rowid, name, about) SELECT id, name, invc_about(about) FROM item WHERE id=new.id;" \
+    "DELETE FROM item_text_pending WHERE id=new.id;" \
+    "END;"
+
+/* Stock ledger triggers. They are TEMP so that they may call invc_user();
+   other tools opening the file never see them. */
+#define SQL_LEDGER_TRIGGERS \
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_count_ledger AFTER UPDATE OF count ON main.item " \
+    "WHEN new.count IS NOT old.count BEGIN " \
+    "INSERT INTO item_ledger(item, delta, stamp, user) " \
+    "VALUES (new.id, new.count - old.count, CAST(strftime('%s','now') AS INT), invc_user());" \
+    "INSERT INTO item_daily(item, day, low, high, last, changes) " \
+    "VALUES (new.id, CAST(strftime('%s','now') AS INT) / 86400, min(old.count, new.count), max(old.count, new.count), new.count, 1) " \
+    "ON CONFLICT(item, day) DO UPDATE SET low=min(low, excluded.low), high=max(high, excluded.high), last=excluded.last, changes=changes + 1;" \
+    "END;" \
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_insert_ledger AFTER INSERT ON main.item BEGIN " \
+    "INSERT INTO item_ledger(item, delta, stamp, user) " \
+    "VALUES (new.id, new.count, CAST(strftime('%s','now') AS INT), invc_user());" \
+    "INSERT INTO item_daily(item, day, low, high, last, changes) " \
+    "VALUES (new.id, CAST(strftime('%s','now') AS INT) / 86400, new.count, new.count, new.count, 1) " \
+    "ON CONFLICT(item, day) DO UPDATE SET low=min(low, excluded.low), high=max(high, excluded.high), last=excluded.last, changes=changes + 1;" \
+    "END;"
+
+// Bytes of description shown for a search match, and how many precede it
+#define SNIPPET_WIDTH 60
+#define SNIPPET_LEAD  16
+
+// Attribute giving a container's place along the walk through its siblings
+#define PICK_POSITION "position"
+// Items typed into the pick list form, which scrolls past its width
+#define PICK_ITEMS_SIZE 1024
+
+#define PANEL_TREE 0
+#define PANEL_LOW  1
+#define PANEL_QUERIES 2
+#define PANEL_QUERY 3
 
 #define BUFF_SIZE 64
 
+#define ARENA_BLOCK 4096
+
+#define SEARCH_SLICE 65536
+#define SEARCH_THREADS 16
+
+#define SNAPSHOT_MAGIC "INVCSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NONE UINT32_MAX
+
+// Databases that panels can show at once, the open one included
+#define SITE_MAX 8
+
 struct win_properties_t {
     int view_limit;
     int main_height;
@@ -27,8 +165,286 @@ struct entry_t {
     int id;
     int parent;
     const char* name;
+    const char* snippet;    // Description around a search match; lists leave it NULL
+    int count;
+    int site;               // Index into sites; only searches of all sites give other than 0
+};
+
+/* Page-lifetime string storage. Blocks are kept across resets, so a page
+   of names costs no allocations once the arena has grown to fit it. */
+struct arena_block_t {
+    struct arena_block_t* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena_t {
+    struct arena_block_t* first;
+    struct arena_block_t* current;
+};
+
+struct path_t;
+
+/* Statements every reader prepares; the primary connection prepares them
+   too, for use when a reader could not be opened. Name and description
+   searches take the LIKE pattern and the trigram expression it implies:
+   the index narrows the rows and the pattern is checked on those left, so
+   only their descriptions are inflated. Without an expression every row
+   is checked. */
+#define SQL_TRIGRAM_IDS "select rowid from item_trigram where ?2 is not null and item_trigram match ?2 " \
+    "union all select id from item where ?2 is null"
+#define SQL_COUNT_CHILDREN "select count(*) from item where parent is ?"
+#define SQL_BY_NAME "select id,name,count,parent from item where id in (" SQL_TRIGRAM_IDS ") and name like ?1 order by id limit ?4 offset ?5"
+#define SQL_BY_ABOUT "select id,name,count,parent,invc_snippet(invc_about(about), ?1) from item " \
+    "where id in (" SQL_TRIGRAM_IDS ") and invc_about(about) like ?1 order by id limit ?4 offset ?5"
+#define SQL_COUNT_BY_NAME "select count(*) from item where id in (" SQL_TRIGRAM_IDS ") and name like ?1"
+#define SQL_COUNT_BY_ABOUT "select count(*) from item where id in (" SQL_TRIGRAM_IDS ") and invc_about(about) like ?1"
+#define SQL_FUZZY "select id,name,count,parent from (select *, invc_fuzzy(?1, name) as distance from item " \
+    "where id in (" SQL_TRIGRAM_IDS ")) where distance <= ?3 order by distance, id limit ?4 offset ?5"
+#define SQL_COUNT_FUZZY "select count(*) from item where id in (" SQL_TRIGRAM_IDS ") and invc_fuzzy(?1, name) <= ?3"
+
+/* Child refs of one container sorted on a field other than id, kept per
+   reader by the memory and snapshot stores, which hold children in id
+   order. Refs are ids for the memory store and item indexes for snapshots. */
+struct sorted_t {
+    int parent;
+    int field;
+    long long epoch;
+    int* refs;
+    int count;
+};
+
+/* Read-only connection of one panel or of the search view. Panels load
+   through their own reader, so both can load at once, and each load runs
+   in one read transaction: with the database in WAL mode it sees a single
+   snapshot while writes continue on the primary connection. */
+struct reader_t {
+    sqlite3* db;
+    sqlite3_stmt* children[SORT_MODES][SEEK_KINDS];
+    sqlite3_stmt* count;
+    sqlite3_stmt* by_name;
+    sqlite3_stmt* by_about;
+    sqlite3_stmt* count_by_name;
+    sqlite3_stmt* count_by_about;
+    sqlite3_stmt* fuzzy;
+    sqlite3_stmt* count_fuzzy;
+    struct sorted_t sorted;
+};
+
+/* Start of a page of children. The offset always holds; after or before,
+   when set, is a row of the neighbouring page in the same order, and lets
+   the store seek to the page on the sort key instead of counting rows. */
+struct seek_t {
+    int offset;
+    const struct entry_t* after;
+    const struct entry_t* before;
+};
+
+/* Storage engine behind the panels and searches. parent 0 is the root.
+   children() and search() fill at most limit entries and return how many
+   they filled; strings either point into the store or are copied into the
+   arena handed in. children() lists in a SORT_ order from a seek_t, and
+   locate() gives the ordinal in that order of the first name with a
+   prefix. path() returns a freshly allocated root-first chain. Read-only
+   stores leave the write functions NULL; insert() returns the new id and
+   the other writes return 0 on success. */
+struct store_t {
+    const char* name;
+    int (*count_children)(struct reader_t* reader, int parent);
+    int (*children)(struct reader_t* reader, int parent, int sort, const struct seek_t* seek, int limit, struct entry_t* entries, struct arena_t* arena);
+    int (*locate)(struct reader_t* reader, int parent, int sort, const char* prefix);
+    int (*get)(int id, struct entry_t* entry, struct arena_t* arena);
+    int (*search_count)(struct reader_t* reader, int type, const char* query);
+    int (*search)(struct reader_t* reader, int type, const char* query, int offset, int limit, struct entry_t* entries, struct arena_t* arena);
+    struct path_t* (*path)(int id);
+    char* (*description)(int id);
+    int (*insert)(int parent, const char* name, const char* about, int count);
+    int (*reparent)(const int* ids, int count, int parent);
+    int (*copy)(const int* ids, int count, int parent);
+    int (*remove)(int id);
+    int (*rename)(int id, const char* name);
+    int (*set_count)(int id, int count);
+    int (*describe)(int id, const char* about);
+};
+
+/* A capacity of zero with ids set means the list borrows a slice of the
+   shared adjacency array built at load; it is copied out on first growth. */
+struct id_list_t {
+    int* ids;
+    int count;
+    int capacity;
+};
+
+// Open addressing set of strings, the text itself lives in the arena
+struct intern_t {
+    const char** slots;
+    int count;
+    int capacity;
+    struct arena_t text;
+};
+
+/* In-memory engine: items sorted by id, each with the ids of its children
+   kept sorted as well. Removed items stay behind as tombstones so lookups
+   remain a binary search. */
+struct memory_item_t {
+    int id;
+    int parent;
+    int count;
+    int removed;
+    const char* name;
+    const char* about;
+    struct id_list_t children;
+};
+
+/* Lowercased copy of one text field of every item, each followed by a NUL,
+   so a search scans one contiguous buffer. starts has one offset per item
+   plus the end. */
+struct memory_column_t {
+    char* text;
+    size_t* starts;
+    int generation;
+};
+
+// Item indexes matching the last search, in id order, for paging
+struct memory_hits_t {
+    int type;
+    char* query;
+    int generation;
+    int* items;
+    int count;
+};
+
+struct memory_t {
+    struct memory_item_t* items;
+    int count;
+    int capacity;
+    int live;
+    struct id_list_t roots;
+    int* adjacency;
+    struct intern_t strings;
+    double load_ms;
+    int generation;
+    struct memory_column_t columns[2];
+    struct memory_hits_t hits;
+    int search_threads;
+    double search_ms;
+};
+
+/* Changes made to a memory session backed by a database, written back in
+   one transaction per batch. Strings point into the intern pool. */
+#define WRITE_INSERT 0
+#define WRITE_REPARENT 1
+#define WRITE_REMOVE 2
+#define WRITE_RENAME 3
+#define WRITE_COUNT 4
+#define WRITE_DESCRIBE 5
+#define WRITE_BATCH 512
+#define WRITE_IDLE_MS 1000
+
+struct write_op_t {
+    int type;
+    int id;
+    int parent;
+    int count;
+    const char* name;
     const char* about;
+};
+
+struct write_queue_t {
+    struct write_op_t* ops;
     int count;
+    int capacity;
+    long flushed;
+    int batches;
+    double last_batch_ms;
+};
+
+/* Upkeep done while nobody types. A backup copies BACKUP_PAGES pages per
+   step with the online backup API, and keys are waited for only
+   BACKUP_STEP_MS between steps. After MAINTENANCE_CHANGES row changes, idle
+   time releases free pages MAINTENANCE_PAGES at a time and refreshes the
+   planner statistics. */
+#define BACKUP_PAGES 256
+#define BACKUP_STEP_MS 10
+#define MAINTENANCE_CHANGES 2048
+#define MAINTENANCE_PAGES 256
+
+struct maintenance_t {
+    sqlite3_backup* backup;
+    sqlite3* target;
+    char file[256];
+    int pages;                // Pages of the backup running or last run
+    int remaining;
+    int failed;
+    int blocked;              // The last step found a database locked
+    double started_ms;
+    double backup_ms;
+    sqlite3_int64 changes;    // sqlite3_total_changes64() at the last upkeep
+    int runs;
+    long released;            // Free pages given back to the file system
+    double last_ms;
+};
+
+/* Read-only snapshot file, written by 'invc --snapshot' and mapped as is.
+   Items are sorted by id; each one owns a run of the children array, which
+   holds item indexes grouped by parent and sorted by id. Strings are NUL
+   terminated inside the string table. */
+struct snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t items;
+    uint32_t root_first;
+    uint32_t root_count;
+    uint64_t items_offset;
+    uint64_t children_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+/* A sync file: the header, the description dictionaries of the sending
+   copy, each as its id, its size and its bytes, then one changeset. */
+struct sync_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t replica;        // The copy that wrote the file
+    int64_t after;           // Its sync_log entries after this one and up to last are in the file
+    int64_t last;
+    uint32_t dictionaries;
+    uint32_t reserved;
+    uint64_t changes_size;
+};
+
+struct sync_report_t {
+    int added;
+    int changed;
+    int deleted;
+    int attributes;
+    int counts;       // Counts both copies changed, which get both changes
+    int settled;      // Other values both copies changed, settled for the lower replica
+    int refused;      // Moves that would have put an item inside itself
+    int skipped;      // Changes to items this copy has deleted
+};
+
+struct snapshot_item_t {
+    int32_t id;
+    int32_t parent;
+    int32_t count;
+    uint32_t name;
+    uint32_t about;
+    uint32_t first_child;
+    uint32_t children;
+    uint32_t reserved;
+};
+
+struct snapshot_t {
+    void* map;
+    size_t size;
+    const struct snapshot_header_t* header;
+    const struct snapshot_item_t* items;
+    const uint32_t* children;
+    uint32_t slots;
+    const char* strings;
 };
 
 struct path_t {
@@ -38,6 +454,19 @@ struct path_t {
     const char* name;
 };
 
+/* Path nodes come from path_push() and go back through path_free(), which
+   frees their names and keeps the nodes for reuse. The counts of nodes,
+   name copies and entry pages in use show in the 'i' view; they should
+   come back to the same values whenever the panels are back where they
+   were. */
+struct allocations_t {
+    struct path_t* pooled_paths;
+    int pooled;
+    int paths;
+    int path_names;
+    int entry_pages;
+};
+
 struct panel_t {
     const char* title;
     struct path_t* path;
@@ -47,6 +476,42 @@ struct panel_t {
     int count;
     int parent;
     bool loaded;
+    int mode;
+    int tree_offset;
+    int query;
+    struct arena_t arena;
+    int first;
+    int cached;
+    int capacity;
+    struct reader_t reader;
+    struct id_list_t marks;
+    int marks_parent;
+    char* column;
+    int sort;
+    int page_parent;
+    int page_sort;
+    int site;
+};
+
+// One attribute predicate; op is NULL when the key only has to be present
+struct attr_term_t {
+    char key[64];
+    const char* op;
+    char value[128];
+    int numeric;
+};
+
+struct query_cache_t {
+    struct query_cache_t* next;
+    int query;
+    long long generation;
+    int limit;
+    int count;
+    int* keys;     // keys[p] is the last id shown before page p
+    int pages;     // number of known entries in keys
+    int capacity;
+    sqlite3_stmt* page_stmt;
+    sqlite3_stmt* count_stmt;
 };
 
 struct search_panel_t {
@@ -58,11 +523,24 @@ struct search_panel_t {
     int count;
     int type;
     int is_closing;
+    int capacity;   // Entries in the page, besides its zeroed spare
+    struct arena_t arena;
+    struct reader_t reader;
+};
+
+/* A database a panel can browse besides the open one. Site 0 is the open
+   database; the others are attached to the federation connection under
+   their alias, which searches across sites and moves between them use. */
+struct site_t {
+    char alias[16];
+    char* file;
+    const char* name;   // File name without its directories, for headers
 };
 
 struct action_source_t {
     struct entry_t* entry;
     WINDOW* window;
+    int key;
 };
 
 struct action_t {
@@ -83,21 +561,83 @@ WINDOW *bar;
 WINDOW *current_window;
 sqlite3 *db;
 sqlite3_stmt *insert_stmt;
-sqlite3_stmt *select_stmt;
+sqlite3_stmt *children_stmts[SORT_MODES][SEEK_KINDS];
 sqlite3_stmt *count_stmt;
-sqlite3_stmt *item_count_stmt;
-sqlite3_stmt *item_parent_stmt;
+sqlite3_stmt *item_stmt;
+sqlite3_stmt *path_stmt;
 sqlite3_stmt *update_count_stmt;
 sqlite3_stmt *rename_stmt;
 sqlite3_stmt *redescribe_stmt;
 sqlite3_stmt *description_stmt;
 sqlite3_stmt *move_stmt;
 sqlite3_stmt *delete_stmt;
+sqlite3_stmt *move_many_stmt;
+sqlite3_stmt *copy_clear_stmt;
+sqlite3_stmt *copy_map_stmt;
+sqlite3_stmt *copy_items_stmt;
+sqlite3_stmt *copy_attrs_stmt;
+sqlite3_stmt *attr_get_stmt;
+sqlite3_stmt *attr_list_stmt;
+sqlite3_stmt *attr_set_stmt;
+sqlite3_stmt *attr_delete_stmt;
+sqlite3_stmt *attr_copy_stmt;
+sqlite3_stmt *attach_find_stmt;
+sqlite3_stmt *attach_blob_stmt;
+sqlite3_stmt *attach_link_stmt;
+sqlite3_stmt *attach_unlink_stmt;
+sqlite3_stmt *attach_get_stmt;
+sqlite3_stmt *attach_list_stmt;
+sqlite3_stmt *attach_copy_stmt;
+sqlite3_stmt *copy_attachments_stmt;
 sqlite3_stmt *by_about_stmt;
 sqlite3_stmt *by_name_stmt;
 sqlite3_stmt *count_by_about_stmt;
 sqlite3_stmt *count_by_name_stmt;
+sqlite3_stmt *fuzzy_stmt;
+sqlite3_stmt *count_fuzzy_stmt;
+sqlite3_stmt *history_stmt;
+sqlite3_stmt *history_carry_stmt;
+sqlite3_stmt *pick_path_stmt;
+sqlite3_stmt *pick_take_stmt;
+sqlite3_stmt *low_stmt;
+sqlite3_stmt *count_low_stmt;
+sqlite3_stmt *threshold_stmt;
+sqlite3_stmt *item_threshold_stmt;
+sqlite3_stmt *data_version_stmt;
+sqlite3_stmt *saved_query_stmt;
+sqlite3_stmt *queries_stmt;
+sqlite3_stmt *count_queries_stmt;
+sqlite3_stmt *insert_query_stmt;
+sqlite3_stmt *delete_query_stmt;
+/* Statements prepared on the primary connection, besides the children
+   statements. Closing finalizes only these: the trigram table prepares
+   statements of its own, which it finalizes itself as it disconnects. */
+sqlite3_stmt** database_statements[] = {
+    &insert_stmt, &count_stmt, &item_stmt, &path_stmt, &update_count_stmt, &rename_stmt, &redescribe_stmt,
+    &description_stmt, &move_stmt, &delete_stmt, &move_many_stmt, &copy_clear_stmt, &copy_map_stmt,
+    &copy_items_stmt, &copy_attrs_stmt, &attr_get_stmt, &attr_list_stmt, &attr_set_stmt, &attr_delete_stmt,
+    &attr_copy_stmt, &attach_find_stmt, &attach_blob_stmt, &attach_link_stmt, &attach_unlink_stmt,
+    &attach_get_stmt, &attach_list_stmt, &attach_copy_stmt, &copy_attachments_stmt, &by_about_stmt,
+    &by_name_stmt, &count_by_about_stmt, &count_by_name_stmt, &fuzzy_stmt, &count_fuzzy_stmt, &history_stmt,
+    &history_carry_stmt, &pick_path_stmt, &pick_take_stmt, &low_stmt, &count_low_stmt, &threshold_stmt, &item_threshold_stmt,
+    &data_version_stmt, &saved_query_stmt, &queries_stmt, &count_queries_stmt, &insert_query_stmt,
+    &delete_query_stmt
+};
+struct query_cache_t *query_caches;
+struct store_t *store;
+struct snapshot_t snapshot;
+struct memory_t memory;
+struct write_queue_t write_queue;
+struct maintenance_t maintenance;
+struct allocations_t allocations;
+int memory_session;
 int panel;
+int sync_base;
+sqlite3_session *sync_session;
+sqlite3_session *federation_session;
+struct site_t sites[SITE_MAX];
+int site_count;
+sqlite3 *federation;
 
 int show_modal_help();
 int show_modal_open();
@@ -106,7 +646,21 @@ int show_modal_add();
 int show_modal_rename();
 int show_modal_editor();
 int show_modal_search();
+int show_modal_history();
+int show_modal_pick();
+int show_modal_threshold();
+int toggle_low_stock();
+int toggle_saved_queries();
+int show_modal_save_query();
+int show_modal_stats();
+int show_modal_attributes();
+int show_modal_attachments();
+int show_modal_column();
+int show_modal_site();
+int show_modal_backup();
 int show_modal_error(char* error);
+int input_key();
+int input_string(WINDOW* win, int y, int x, char* buf, int length);
 int editor_save();
 int panel_descend();
 int panel_ascend();
@@ -114,6 +668,24 @@ int open_database();
 int switch_panels();
 int draw_panel(struct panel_t* p);
 int update_dataview(struct panel_t* panel, int reload);
+int draw_dataview(struct panel_t* panel);
+int panels_refresh();
+int panel_mark();
+int panel_sort();
+int panel_find();
+int panel_home();
+int panel_end();
+int panel_percent(struct action_source_t source);
+int copy_item();
+int select_window(WINDOW *win);
+struct id_list_t* panel_marks(struct panel_t* p);
+int id_list_contains(struct id_list_t* list, int id);
+void id_list_insert(struct id_list_t* list, int id);
+void id_list_remove(struct id_list_t* list, int id);
+void path_free(struct path_t* path);
+struct path_t* path_push(struct path_t* next, int id, const char* name);
+void panel_set_path(struct panel_t* p, struct path_t* path);
+void reader_close(struct reader_t* reader);
 int panel_offset_inc();
 int panel_offset_pgdn();
 int panel_offset_dec();
@@ -122,12 +694,24 @@ int move_item();
 int delete_item();
 int item_search_by_name(char* name);
 int item_search_by_about(char* about);
+int item_search_fuzzy(char* name);
+int item_search_attr(char* query);
+int item_search_sites(char* name);
 int search_offset_dec();
 int search_offset_inc();
 int search_offset_pgup();
 int search_offset_pgdn();
 int search_goto();
 int search_goto_parent();
+struct path_t* search_build_path(int item);
+struct path_t* site_path(int site, int id);
+int panel_set_site(struct panel_t* p, int site);
+int federation_open();
+int site_reparent(int site, const int* ids, int count, int parent);
+int site_transfer(int from, int to, const int* ids, int count, int parent);
+struct query_cache_t* query_cache(int id);
+void query_cache_drop(int id);
+extern struct store_t sqlite_store;
 
 struct panel_t panels[] = {
     {"Left", NULL, NULL, 0, 0, 0, FALSE},
@@ -148,6 +732,34 @@ struct action_t actions[] = {
     {KEY_F(8), TRUE, "F8", "Count", "Set the number of this item", show_modal_count},
     {KEY_F(9), TRUE, "F9", "Search", "Search for an item by name or description", show_modal_search},
     {KEY_F(10), TRUE, "F10", "Quit", "Quit the program", NULL},
+    {'h', FALSE, "h", "History", "Show the stock history of this item", show_modal_history},
+    {'t', FALSE, "t", "Threshold", "Set the reorder threshold of this item", show_modal_threshold},
+    {'l', FALSE, "l", "LowStock", "Toggle listing of items below their threshold", toggle_low_stock},
+    {'v', FALSE, "v", "Virtual", "Toggle listing of saved queries as virtual containers", toggle_saved_queries},
+    {'s', FALSE, "s", "SaveQuery", "Save a search as a virtual container", show_modal_save_query},
+    {'i', FALSE, "i", "Stats", "Show storage engine statistics", show_modal_stats},
+    {KEY_IC, FALSE, "Ins", "Mark", "Mark or unmark this item; F6 moves all marked items", panel_mark},
+    {' ', FALSE, "Space", "Mark", "Mark or unmark this item", panel_mark},
+    {'a', FALSE, "a", "Attrs", "Show and set the typed attributes of this item", show_modal_attributes},
+    {'f', FALSE, "f", "Files", "Attach files to this item, or save or remove its attachments", show_modal_attachments},
+    {'o', FALSE, "o", "Column", "Show an attribute as a column of this panel", show_modal_column},
+    {'d', FALSE, "d", "Site", "Show another site's database in this panel", show_modal_site},
+    {'b', FALSE, "b", "Backup", "Copy the open database to a file while it stays in use", show_modal_backup},
+    {'p', FALSE, "p", "PickList", "List items to pick in walking order, then take them from stock", show_modal_pick},
+    {'r', FALSE, "r", "Sort", "Sort this panel by id, name or quantity, up or down", panel_sort},
+    {'c', FALSE, "c", "Copy", "Copy this item, or the marked items, with their contents to the other panel", copy_item},
+    {'/', FALSE, "/", "Find", "Jump to the first name starting with the typed text", panel_find},
+    {KEY_HOME, FALSE, "Home", "First", "Jump to the first item of the listing", panel_home},
+    {KEY_END, FALSE, "End", "Last", "Jump to the last item of the listing", panel_end},
+    {'1', FALSE, "1", "10%", "Jump 10% of the way down the listing", panel_percent},
+    {'2', FALSE, "2", "20%", "Jump 20% of the way down the listing", panel_percent},
+    {'3', FALSE, "3", "30%", "Jump 30% of the way down the listing", panel_percent},
+    {'4', FALSE, "4", "40%", "Jump 40% of the way down the listing", panel_percent},
+    {'5', FALSE, "5", "50%", "Jump 50% of the way down the listing", panel_percent},
+    {'6', FALSE, "6", "60%", "Jump 60% of the way down the listing", panel_percent},
+    {'7', FALSE, "7", "70%", "Jump 70% of the way down the listing", panel_percent},
+    {'8', FALSE, "8", "80%", "Jump 80% of the way down the listing", panel_percent},
+    {'9', FALSE, "9", "90%", "Jump 90% of the way down the listing", panel_percent},
     {'\t', FALSE, "Tab", "Switch", "Switch between panels", switch_panels},
     {KEY_UP, FALSE, "Up", "GoUp", "Navigate listing up", panel_offset_dec},
     {KEY_DOWN, FALSE, "Down", "GoDown", "Navigate listing down", panel_offset_inc},
@@ -192,43 +804,257 @@ struct entry_t* current_entry() {
     return &panels[panel].entries[panels[panel].offset % win_props.view_limit];
 }
 
-int move_item() {
+// The current entry if it is an item, otherwise report why not and give NULL
+struct entry_t* current_item() {
     if(panels[panel].loaded == FALSE) {
         show_modal_error("No database loaded.");
+        return NULL;
+    }
+    if(panels[panel].mode == PANEL_QUERIES) {
+        show_modal_error("Saved queries are not items.");
+        return NULL;
+    }
+    struct entry_t* entry = current_entry();
+    if(entry->id == 0) {
+        show_modal_error("No item selected.");
+        return NULL;
+    }
+    return entry;
+}
+
+// A panel on another site only browses it; F6 moves items in and out
+int require_home_site() {
+    if(panels[panel].site != 0) {
+        show_modal_error("Only browsing and moving work on another site.");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Thresholds, history and saved queries live only in the SQLite store
+int require_sqlite() {
+    if(!require_home_site()) return FALSE;
+    if(store != NULL && store != &sqlite_store) {
+        char message[64];
+        snprintf(message, sizeof(message), "Not available with the %s store.", store->name);
+        show_modal_error(message);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Attributes and attachments live in the database file, also behind a memory session
+int require_database(const char* feature) {
+    if(!require_home_site()) return FALSE;
+    if(db == NULL) {
+        char message[64];
+        snprintf(message, sizeof(message), "%s need a database file.", feature);
+        show_modal_error(message);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int require_writable() {
+    if(!require_home_site()) return FALSE;
+    if(store != NULL && store->insert == NULL) {
+        char message[64];
+        snprintf(message, sizeof(message), "The %s store is read only.", store->name);
+        show_modal_error(message);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Steps the current panel through the orders a container can be listed in
+int panel_sort() {
+    static const int orders[] = {SORT_ID, SORT_NAME, SORT_NAME | SORT_DESC, SORT_COUNT, SORT_COUNT | SORT_DESC, SORT_ID | SORT_DESC};
+    struct panel_t* p = &panels[panel];
+    if(p->loaded == FALSE) return 1;
+    if(p->mode != PANEL_TREE) {
+        show_modal_error("Only container listings can be sorted.");
         return 1;
     }
+    int next = 0;
+    for(int i = 0; i < ARRLEN(orders); i++) {
+        if(orders[i] == p->sort) next = (i + 1) % ARRLEN(orders);
+    }
+    p->sort = orders[next];
+    p->offset = 0;
+    update_dataview(p, TRUE);
+}
+
+int panel_parent(struct panel_t* p) {
+    return p->path == NULL ? 0 : p->parent;
+}
+
+// Marks belong to the container they were made in and lapse on leaving it
+struct id_list_t* panel_marks(struct panel_t* p) {
+    if(p->marks.count > 0 && (p->mode != PANEL_TREE || p->marks_parent != panel_parent(p))) {
+        p->marks.count = 0;
+    }
+    return &p->marks;
+}
 
-    struct path_t* path;
-    struct entry_t* entry = current_entry();
-    int new_parent;
-    if(panel == win_props.panel_left) {
-        path = panels[win_props.panel_right].path;
-        new_parent = panels[win_props.panel_right].parent;
-    } else if(panel == win_props.panel_right) {
-        path = panels[win_props.panel_left].path;
-        new_parent = panels[win_props.panel_left].parent;
+int panel_mark() {
+    struct panel_t* p = &panels[panel];
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+    if(p->mode != PANEL_TREE) {
+        show_modal_error("Only items listed in a container can be marked.");
+        return 1;
     }
-    int allow_move = TRUE;
-    while (path != NULL) {
-        if(path->id == entry->id) allow_move = FALSE;
-        path = path->next;
+    struct id_list_t* marks = panel_marks(p);
+    if(id_list_contains(marks, entry->id)) {
+        id_list_remove(marks, entry->id);
+    } else {
+        id_list_insert(marks, entry->id);
     }
-    if(allow_move) {
-        //gmvwprintw(panels[panel].win, 23, 10, "ID: %d PAR: %d", entry->id, new_parent);
-        wrefresh(panels[panel].win);
+    p->marks_parent = panel_parent(p);
+    if(p->offset < p->count - 1) p->offset++;
+    update_dataview(p, FALSE);
+}
 
-        if(new_parent == 0) {
-            sqlite3_bind_null(move_stmt, 1);
-        } else {
-            sqlite3_bind_int(move_stmt, 1, new_parent);
+/* Takes moved rows out of a tree panel's page and reads only the rows that
+   slide up into the gap. Falls back to a reload when a moved row was not
+   on the page, since then the whole page shifts. */
+void panel_rows_removed(struct panel_t* p, const int* ids, int count) {
+    int kept = 0;
+    for(int i = 0; i < p->cached; i++) {
+        int moved = FALSE;
+        for(int j = 0; j < count && !moved; j++) moved = p->entries[i].id == ids[j];
+        if(!moved) p->entries[kept++] = p->entries[i];
+    }
+    int parent = panel_parent(p);
+    p->count = store->count_children(&p->reader, parent);
+    if(p->offset >= p->count && p->offset > 0) p->offset = p->count > 0 ? p->count - 1 : 0;
+    if(p->mode != PANEL_TREE || p->cached - kept != count || p->offset < p->first) {
+        update_dataview(p, TRUE);
+        return;
+    }
+    struct seek_t seek = {p->first + kept, kept > 0 ? &p->entries[kept - 1] : NULL, NULL};
+    kept += store->children(&p->reader, parent, p->sort, &seek, win_props.view_limit - kept, p->entries + kept, &p->arena);
+    p->cached = kept;
+    for(; kept < win_props.view_limit; kept++) {
+        p->entries[kept].id = 0;
+        p->entries[kept].name = NULL;
+    }
+    select_window(p->win);
+    draw_dataview(p);
+}
+
+/* In id order a full page stays as it is when every arriving id sorts
+   after its last row; otherwise the page is reread. */
+void panel_rows_added(struct panel_t* p, const int* ids, int count) {
+    int after = p->cached == win_props.view_limit && p->sort == SORT_ID;
+    for(int j = 0; j < count && after; j++) after = ids[j] > p->entries[p->cached - 1].id;
+    if(!after) {
+        update_dataview(p, TRUE);
+        return;
+    }
+    p->count = store->count_children(&p->reader, panel_parent(p));
+    select_window(p->win);
+    draw_dataview(p);
+}
+
+/* Moves the marked items of this panel, or the current one, into the
+   container shown by the other panel. The target's real ancestry is read
+   from the store, so nothing can be moved into itself or its own subtree
+   however the panels were navigated. */
+int move_item() {
+    struct panel_t* source = &panels[panel];
+    struct panel_t* target = &panels[(panel + 1) % ARRLEN(panels)];
+    // Other sites are only ever shown over the SQLite store, which writes
+    if(source->site == 0 && !require_writable()) return 1;
+    if(target->mode != PANEL_TREE) {
+        show_modal_error("Items can only be moved into a container.");
+        return 1;
+    }
+    struct id_list_t* marks = panel_marks(source);
+    const int* ids;
+    int count;
+    if(marks->count > 0) {
+        ids = marks->ids;
+        count = marks->count;
+    } else {
+        struct entry_t* entry = current_item();
+        if(entry == NULL) return 1;
+        ids = &entry->id;
+        count = 1;
+    }
+    int new_parent = panel_parent(target);
+    int transfer = source->site != target->site;
+    if(source->mode == PANEL_TREE && panel_parent(source) == new_parent && !transfer) return 0;
+
+    // An item moved to another site cannot end up inside itself
+    struct path_t* ancestry = transfer ? NULL : site_path(target->site, new_parent);
+    int allow_move = TRUE;
+    for(struct path_t* path = ancestry; path != NULL && allow_move; path = path->next) {
+        for(int i = 0; i < count && allow_move; i++) {
+            if(path->id == ids[i]) allow_move = FALSE;
         }
-        sqlite3_bind_int(move_stmt, 2, entry->id);
-        int s;
-        while ((s = sqlite3_step(move_stmt)) != SQLITE_DONE) { }
-        sqlite3_reset(move_stmt);
-        update_dataview(&panels[win_props.panel_left], TRUE);
-        update_dataview(&panels[win_props.panel_right], TRUE);
     }
+    path_free(ancestry);
+    if(!allow_move) {
+        show_modal_error("Cannot move an item into itself or its own contents.");
+        return 1;
+    }
+
+    // Keep the ids; the page the current entry lives in is about to change
+    int* moved = malloc(sizeof(int) * count);
+    memcpy(moved, ids, sizeof(int) * count);
+    int failed;
+    if(transfer) {
+        failed = site_transfer(source->site, target->site, moved, count, new_parent);
+    } else if(source->site != 0) {
+        failed = site_reparent(source->site, moved, count, new_parent);
+    } else {
+        failed = store->reparent(moved, count, new_parent);
+    }
+    if(failed) {
+        free(moved);
+        show_modal_error("Could not move item.");
+        return 1;
+    }
+    marks->count = 0;
+    panel_rows_removed(source, moved, count);
+    // Items arrive at another site under new ids
+    if(transfer) {
+        update_dataview(target, TRUE);
+    } else {
+        panel_rows_added(target, moved, count);
+    }
+    free(moved);
+    select_window(source->win);
+}
+
+/* Copies the marked items of this panel, or the current one, with all of
+   their contents into the container shown by the other panel. Copying
+   into the same container duplicates them. */
+int copy_item() {
+    if(!require_writable()) return 1;
+    struct panel_t* source = &panels[panel];
+    struct panel_t* target = &panels[(panel + 1) % ARRLEN(panels)];
+    if(target->mode != PANEL_TREE) {
+        show_modal_error("Items can only be copied into a container.");
+        return 1;
+    }
+    if(source->site != target->site) {
+        show_modal_error("Items are copied within a site; F6 moves them between sites.");
+        return 1;
+    }
+    struct id_list_t* marks = panel_marks(source);
+    struct entry_t* entry = current_item();
+    if(marks->count == 0 && entry == NULL) return 1;
+    int failed = marks->count > 0
+        ? store->copy(marks->ids, marks->count, panel_parent(target))
+        : store->copy(&entry->id, 1, panel_parent(target));
+    if(failed) {
+        show_modal_error("Could not copy item.");
+        return 1;
+    }
+    marks->count = 0;
+    panels_refresh();
 }
 
 int delete_item() {
@@ -236,19 +1062,31 @@ int delete_item() {
         show_modal_error("No database loaded.");
         return 1;
     }
-
     struct entry_t* entry = current_entry();
-    sqlite3_bind_int(delete_stmt, 1, entry->id);
-    int s;
-    while ((s = sqlite3_step(delete_stmt)) != SQLITE_DONE) { }
-    if(panels[panel].offset == panels[panel].count - 1) {
+    if(panels[panel].mode == PANEL_QUERIES) {
+        // Deleting a virtual container only forgets the saved query
+        if(entry->id == 0) return 1;
+        query_cache_drop(entry->id);
+        sqlite3_bind_int(delete_query_stmt, 1, entry->id);
+        sqlite3_step(delete_query_stmt);
+        sqlite3_reset(delete_query_stmt);
+        if(panels[panel].offset > 0 && panels[panel].offset == panels[panel].count - 1) {
+            panels[panel].offset--;
+        }
+        update_dataview(&panels[panel], TRUE);
+        return 0;
+    }
+    if(!require_writable()) return 1;
+    if(entry->id == 0) return 1;
+    if(store->remove(entry->id) != 0) {
+        show_modal_error("Could not delete item.");
+        return 1;
+    }
+    if(panels[panel].offset > 0 && panels[panel].offset == panels[panel].count - 1) {
         panels[panel].offset--;
     }
-    sqlite3_reset(delete_stmt);
     if(panels[win_props.panel_left].parent == panels[win_props.panel_right].parent) {
-        for(int i = 0; i < ARRLEN(panels); i++) {
-            update_dataview(&panels[i], TRUE);
-        }
+        panels_refresh();
     } else {
         update_dataview(&panels[panel], TRUE);
     }
@@ -282,42 +1120,113 @@ int panel_offset_pgup() {
     }
 }
 
+// Puts the cursor on row ordinal, reading a page only if it is another one
+void panel_jump(struct panel_t* p, int ordinal) {
+    if(ordinal >= p->count) ordinal = p->count - 1;
+    if(ordinal < 0) ordinal = 0;
+    int first = (ordinal / win_props.view_limit) * win_props.view_limit;
+    p->offset = ordinal;
+    update_dataview(p, first != p->first || p->cached == 0);
+}
+
+int panel_home() {
+    panel_jump(&panels[panel], 0);
+}
+
+int panel_end() {
+    panel_jump(&panels[panel], panels[panel].count - 1);
+}
+
+// Digits 1 to 9 jump a tenth of the listing per step
+int panel_percent(struct action_source_t source) {
+    int ch = source.key;
+    panel_jump(&panels[panel], (int)((long long)panels[panel].count * (ch - '0') / 10));
+}
+
+/* Jumps to the first name starting with what is typed, as it is typed;
+   Enter or Escape ends the prompt. */
+int panel_find() {
+    struct panel_t* p = &panels[panel];
+    char prefix[BUFF_SIZE] = "";
+    int length = 0, ch;
+    if(p->loaded == FALSE || p->mode != PANEL_TREE) return 1;
+    do {
+        wattron(p->win, WA_STANDOUT);
+        mvwhline(p->win, win_props.main_height - 2, 1, ' ', win_props.data_width);
+        mvwprintw(p->win, win_props.main_height - 2, 2, "/%s", prefix);
+        wattroff(p->win, WA_STANDOUT);
+        wrefresh(p->win);
+        ch = input_key();
+        if((ch == KEY_BACKSPACE || ch == 127 || ch == 8) && length > 0) {
+            prefix[--length] = 0;
+        } else if(ch >= ' ' && ch < 127 && length < BUFF_SIZE - 1) {
+            prefix[length++] = ch;
+            prefix[length] = 0;
+        } else {
+            continue;
+        }
+        int ordinal = store->locate(&p->reader, panel_parent(p), p->sort, prefix);
+        if(ordinal >= 0) {
+            panel_jump(p, ordinal);
+        } else {
+            beep();
+        }
+    } while(ch != '\n' && ch != 27);
+    draw_panel(p);
+    draw_dataview(p);
+}
+
 int panel_descend() {
+    if(panels[panel].mode == PANEL_LOW) {
+        // Leave the low stock listing at the container holding the entry
+        if(panels[panel].count > 0) {
+            int parent = current_entry()->parent;
+            panels[panel].mode = PANEL_TREE;
+            panels[panel].parent = parent;
+            panel_set_path(&panels[panel], search_build_path(parent));
+            panels[panel].offset = 0;
+            draw_panel(&panels[panel]);
+            update_dataview(&panels[panel], TRUE);
+        }
+        return 0;
+    }
+    if(panels[panel].mode == PANEL_QUERIES) {
+        // Open the saved query as if it were a container
+        if(panels[panel].count > 0) {
+            panels[panel].mode = PANEL_QUERY;
+            panels[panel].query = current_entry()->id;
+            panels[panel].offset = 0;
+            draw_panel(&panels[panel]);
+            update_dataview(&panels[panel], TRUE);
+        }
+        return 0;
+    }
+    if(panels[panel].mode == PANEL_QUERY) {
+        // Results live anywhere in the tree, so go into the real container
+        if(panels[panel].count > 0) {
+            int id = current_entry()->id;
+            panels[panel].mode = PANEL_TREE;
+            panels[panel].parent = id;
+            panel_set_path(&panels[panel], search_build_path(id));
+            panels[panel].offset = 0;
+            draw_panel(&panels[panel]);
+            update_dataview(&panels[panel], TRUE);
+        }
+        return 0;
+    }
     if(panels[panel].count > 0) {
         struct entry_t* entry = current_entry();
         int id = entry->id;
         panels[panel].parent = id;
+        // The path runs root first, so the container goes at its end
+        struct path_t* step = path_push(NULL, id, entry->name);
+        step->offset = panels[panel].offset;
         if(panels[panel].path == NULL) {
-            panels[panel].path = malloc(sizeof(struct path_t));
-            panels[panel].path->id = id;
-            if(entry->name != NULL) {
-                char* buf = malloc(strlen(entry->name) + 1);
-                strcpy(buf, entry->name);
-                panels[panel].path->name = buf;
-            } else {
-                panels[panel].path->name = NULL;
-            }
-            panels[panel].path->offset = panels[panel].offset;
-            panels[panel].path->next = NULL;
+            panels[panel].path = step;
         } else {
             struct path_t* p = panels[panel].path;
-            while(p != NULL) {
-                if(p->next == NULL) {
-                    p->next = malloc(sizeof(struct path_t));
-                    p->next->id = id;
-                    if(entry->name != NULL) {
-                        char* buf = malloc(strlen(entry->name) + 1);
-                        strcpy(buf, entry->name);
-                        p->next->name = buf;
-                    } else {
-                        p->next->name = NULL;
-                    }
-                    p->next->offset = panels[panel].offset;
-                    p->next->next = NULL;
-                    break;
-                }
-                p = p->next;
-            }
+            while(p->next != NULL) p = p->next;
+            p->next = step;
         }
         panels[panel].offset = 0;
         draw_panel(&panels[panel]);
@@ -326,20 +1235,33 @@ int panel_descend() {
 }
 
 int panel_ascend() {
+    if(panels[panel].mode == PANEL_LOW) {
+        return toggle_low_stock();
+    }
+    if(panels[panel].mode == PANEL_QUERIES) {
+        return toggle_saved_queries();
+    }
+    if(panels[panel].mode == PANEL_QUERY) {
+        panels[panel].mode = PANEL_QUERIES;
+        panels[panel].offset = 0;
+        draw_panel(&panels[panel]);
+        update_dataview(&panels[panel], TRUE);
+        return 0;
+    }
     int id = panels[panel].parent;
     struct path_t* p = panels[panel].path;
     panels[panel].offset = 0;
     if(p != NULL) {
         if(p->next == NULL) {
             panels[panel].offset = p->offset;
-            free(p);
+            path_free(p);
             panels[panel].path = NULL;
             panels[panel].parent = 0;
         } else {
             while(p != NULL) {
                  if(p->next != NULL && p->next->next == NULL) {
                       panels[panel].offset = p->next->offset;
-                      free(p->next);
+                      path_free(p->next);
                       p->next = NULL;
                       break;
                  }
@@ -353,6 +1275,44 @@ int panel_ascend() {
     }
 }
 
+int toggle_low_stock() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_sqlite()) return 1;
+
+    if(panels[panel].mode == PANEL_LOW) {
+        panels[panel].mode = PANEL_TREE;
+        panels[panel].offset = panels[panel].tree_offset;
+    } else {
+        if(panels[panel].mode == PANEL_TREE) panels[panel].tree_offset = panels[panel].offset;
+        panels[panel].mode = PANEL_LOW;
+        panels[panel].offset = 0;
+    }
+    draw_panel(&panels[panel]);
+    update_dataview(&panels[panel], TRUE);
+}
+
+int toggle_saved_queries() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_sqlite()) return 1;
+
+    if(panels[panel].mode == PANEL_QUERIES || panels[panel].mode == PANEL_QUERY) {
+        panels[panel].mode = PANEL_TREE;
+        panels[panel].offset = panels[panel].tree_offset;
+    } else {
+        if(panels[panel].mode == PANEL_TREE) panels[panel].tree_offset = panels[panel].offset;
+        panels[panel].mode = PANEL_QUERIES;
+        panels[panel].offset = 0;
+    }
+    draw_panel(&panels[panel]);
+    update_dataview(&panels[panel], TRUE);
+}
+
 struct button_t file_open_buttons[] = {
     {"Open Database", open_database},
     {"Cancel", NULL},
@@ -362,6 +1322,9 @@ struct button_t file_open_buttons[] = {
 struct button_t item_search_buttons[] = {
     {"By Name", item_search_by_name},
     {"By Description", item_search_by_about},
+    {"Fuzzy Name", item_search_fuzzy},
+    {"Attributes", item_search_attr},
+    {"Sites", item_search_sites},
     {"Cancel", NULL},
     {NULL, NULL}
 };
@@ -390,1013 +1353,6081 @@ static int database_callback(void *NotUsed, int argc, char **argv, char **azColN
    return 0;
 }
 
-int update_dataview(struct panel_t* panel, int reload) {
-    //reload = TRUE;
-    select_window(panel->win);
-    if(panel->loaded == FALSE) return 1;
-    if(panel->path == NULL) {
-        sqlite3_bind_null(count_stmt, 1);
-        sqlite3_bind_null(select_stmt, 1);
+static void database_user(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    const char* user = getenv("USER");
+    if(user == NULL) user = getenv("LOGNAME");
+    if(user == NULL) {
+        sqlite3_result_null(context);
     } else {
-        sqlite3_bind_int(count_stmt, 1, panel->parent);
-        sqlite3_bind_int(select_stmt, 1, panel->parent);
+        sqlite3_result_text(context, user, -1, SQLITE_TRANSIENT);
     }
-    sqlite3_bind_int(select_stmt, 2, win_props.view_limit);
-    sqlite3_bind_int(select_stmt, 3, (panel->offset / win_props.view_limit) * win_props.view_limit);
-    int s, cnt;
-    while ((s = sqlite3_step(count_stmt)) != SQLITE_DONE) {
-        if(s == SQLITE_ROW) {
-            cnt = sqlite3_column_int(count_stmt, 0);
-        }
-    }
-    panel->count = cnt;
-    int i = 0;
-    int name_length = (win_props.main_width / 2) - 4 - win_props.int_length * 2;
-    mvwaddch(panel->win, 1, 1 + win_props.int_length, ACS_VLINE);
-    mvwaddch(panel->win, 0, 2 + win_props.int_length + name_length, ACS_TTEE);
-    mvwaddch(panel->win, 1, 2 + win_props.int_length + name_length, ACS_VLINE);
-    mvwaddch(panel->win, win_props.main_height - 2, 2 + win_props.int_length + name_length, ACS_BTEE);
-    wattron(panel->win, WA_BOLD);
-    wattron(panel->win, COLOR_PAIR(6));
-    mvwprintw(panel->win, 1, 1, "Id");
-    wattroff(panel->win, COLOR_PAIR(6));
-    wattron(panel->win, COLOR_PAIR(6));
-    mvwprintw(panel->win, 1, 2 + win_props.int_length, "Name");
-    wattroff(panel->win, COLOR_PAIR(6));
-    wattron(panel->win, COLOR_PAIR(6));
-    mvwprintw(panel->win, 1, 3 + win_props.int_length + name_length, "Qty");
-    wattroff(panel->win, COLOR_PAIR(6));
-    wattroff(panel->win, WA_BOLD);
-    if((panel->offset % win_props.view_limit) == 0 || (panel->offset % win_props.view_limit) == win_props.view_limit - 1 || reload == TRUE) {
-        while ((s = sqlite3_step(select_stmt)) != SQLITE_DONE) {
-            if(s == SQLITE_ROW) {
-                panel->entries[i].id = sqlite3_column_int(select_stmt, 0);
-                if(panel->entries[i].name != NULL) { free((void*)(panel->entries[i].name)); panel->entries[i].name = NULL; }
-                int bytes = sqlite3_column_bytes(select_stmt, 1);
-                if(bytes > 0) {
-                    char* buf = malloc(bytes + 1);
-                    panel->entries[i].name = strcpy(buf, sqlite3_column_text(select_stmt, 1));
-                } else {
-                    panel->entries[i].name = NULL;
-                }
-                panel->entries[i].about = NULL;
-                panel->entries[i].count = sqlite3_column_int(select_stmt, 3);
-                i++;
-            }
-        }
-        for(; i < win_props.view_limit; i++) {
-            panel->entries[i].id = 0;
-            panel->entries[i].name = NULL;
+}
+
+/* Fewest edits turning pattern into some substring of text, ignoring ASCII
+   case (Sellers' variant of Levenshtein: a match may start anywhere). */
+int fuzzy_distance(const char* pattern, const char* text) {
+    int column[256 + 1];
+    int length = strlen(pattern);
+    if(length > 256) length = 256;
+    for(int i = 0; i <= length; i++) column[i] = i;
+    int best = length;
+    for(; text != NULL && *text != 0; text++) {
+        int diagonal = 0;
+        for(int i = 1; i <= length; i++) {
+            int above = column[i];
+            int value = diagonal + (tolower((unsigned char)pattern[i - 1]) != tolower((unsigned char)*text));
+            if(above + 1 < value) value = above + 1;
+            if(column[i - 1] + 1 < value) value = column[i - 1] + 1;
+            diagonal = above;
+            column[i] = value;
         }
+        if(column[length] < best) best = column[length];
     }
-    for(i = 0; i < win_props.view_limit; i++) {
-        if(panel->entries[i].id != 0) {
-            if(i == ((panel->offset)% win_props.view_limit)) {
-                wattron(panel->win, WA_STANDOUT);
-            }
-            mvwhline(panel->win, 2+i, 1, ' ', win_props.data_width);
-            mvwaddch(panel->win, 2 + i, 1 + win_props.int_length, ACS_VLINE);
-            mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_length, ACS_VLINE);
-            //mvwhline(panel->win, 2 + i, 1, ' ', win_props.data_width);
-            //mvwhline(panel->win, 2+i, 1, ' ', win_props.int_length);
-            //mvwhline(panel->win, 2+i, 1, ' ', win_props.int_length);
-            mvwprintw(panel->win, 2 + i, 1, "%d", panel->entries[i].id);
-            //mvwaddch(panel->win, 2 + i, win_props.data_width_tab * 1, ACS_VLINE);
-            if(panel->entries[i].name != NULL) {
-                mvwprintw(panel->win, 2 + i, 2 + win_props.int_length * 1, "%.*s", name_length, panel->entries[i].name);
-            }
-            //mvwaddch(panel->win, 2 + i, win_props.data_width_tab * 2, ACS_VLINE);
-            mvwprintw(panel->win, 2 + i, 3 + win_props.int_length * 1 + name_length, "%d", panel->entries[i].count);
-            wattroff(panel->win, WA_STANDOUT);
-        } else {
-            mvwhline(panel->win, 2+i, 1, ' ', win_props.data_width);
-            mvwaddch(panel->win, 2 + i, 1 + win_props.int_length, ACS_VLINE);
-            mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_length, ACS_VLINE);
-        }
-    }
-    sqlite3_reset(select_stmt);
-    sqlite3_reset(count_stmt);
-    //int id = current_entry()->id;
-    //mvwprintw(panel->win, 23, 1, "ID: %d OFF: %d PAR: %d", id, panel->offset % win_props.view_limit, panel->parent);
-    wrefresh(panel->win);
+    return best;
 }
 
-int switch_panels() {
-    panel = (panel + 1) % ARRLEN(panels);
-    select_window(panels[panel].win);
+int fuzzy_limit(const char* query) {
+    int limit = strlen(query) / 4;
+    return limit < 1 ? 1 : limit;
 }
 
-int draw_command_bar(WINDOW *command, struct action_t* bar) {
-    int n = 0;
-    for(int i = 0; bar[i].key != 0; i++) {
-        if(bar[i].show_on_bar) {
-            wattron(command, COLOR_PAIR(1));
-            mvwprintw(command, 0, n * win_props.action_length, "%s", bar[i].keyname);
-            wattron(command, COLOR_PAIR(2));
-            waddstr(command, bar[i].name);
-            int len = win_props.action_length - strlen(bar[i].name);
-            for(int j = 0; j < len; j++) {
-                waddch(command, ' ');
-            }
-            n++;
-        }
+struct fuzzy_hit_t {
+    int distance;
+    int index;
+};
+
+// Closest first, ties in id order
+int fuzzy_compare(const void* a, const void* b) {
+    const struct fuzzy_hit_t* left = a;
+    const struct fuzzy_hit_t* right = b;
+    if(left->distance != right->distance) return left->distance - right->distance;
+    return left->index - right->index;
+}
+
+static void database_fuzzy(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    sqlite3_result_int(context, fuzzy_distance(sqlite3_value_text(argv[0]), sqlite3_value_text(argv[1])));
+}
+
+int description_snippet(const char* text, const char* pattern, char* out);
+
+// invc_snippet(about, pattern): the part of a description a search matched
+static void database_snippet(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    const char* text = (const char*)sqlite3_value_text(argv[0]);
+    const char* pattern = (const char*)sqlite3_value_text(argv[1]);
+    if(text == NULL || pattern == NULL) return;
+    char out[SNIPPET_WIDTH + 1];
+    int written = description_snippet(text, pattern, out);
+    sqlite3_result_text(context, out, written, SQLITE_TRANSIENT);
+}
+
+/* Long descriptions are stored deflated, as a BLOB of an eight byte header
+   (text length and dictionary id, little endian) and a raw deflate stream
+   primed with that dictionary. Short ones stay TEXT. invc_about() gives
+   the text back either way; the trigram index is fed through it, so
+   searches only inflate the rows whose trigrams already matched. */
+struct about_dictionary_t {
+    uint32_t id;
+    unsigned char* data;
+    int size;
+};
+
+struct about_dictionary_t* about_dictionaries;
+int about_dictionary_count;
+int about_current = -1;
+
+void about_dictionaries_free() {
+    for(int i = 0; i < about_dictionary_count; i++) free(about_dictionaries[i].data);
+    free(about_dictionaries);
+    about_dictionaries = NULL;
+    about_dictionary_count = 0;
+    about_current = -1;
+}
+
+const struct about_dictionary_t* about_dictionary(uint32_t id);
+
+void about_dictionaries_add(sqlite3* conn, const char* schema) {
+    sqlite3_stmt* stmt;
+    char* sql = sqlite3_mprintf("select id, data from \"%w\".about_dictionary order by trained, id", schema);
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, 0);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK) return;
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        if(about_dictionary(sqlite3_column_int64(stmt, 0)) != NULL) continue;
+        about_dictionaries = realloc(about_dictionaries, sizeof(struct about_dictionary_t) * (about_dictionary_count + 1));
+        struct about_dictionary_t* dictionary = &about_dictionaries[about_dictionary_count++];
+        dictionary->id = sqlite3_column_int64(stmt, 0);
+        dictionary->size = sqlite3_column_bytes(stmt, 1);
+        dictionary->data = malloc(dictionary->size + 1);
+        memcpy(dictionary->data, sqlite3_column_blob(stmt, 1), dictionary->size);
     }
-    wrefresh(command);
+    sqlite3_finalize(stmt);
 }
 
-int draw_panel(struct panel_t* p) {
-    WINDOW* win = p->win;
-    wbkgd(win, COLOR_PAIR(3));
-    box(win, 0, 0);
-    if(p->loaded == FALSE) {
-        wattron(win, WA_STANDOUT);
-        mvwaddstr(win, 0, 2, "No Database Loaded");
-        wattroff(win, WA_STANDOUT);
-    } else {
-        mvwaddch(p->win, win_props.main_height - 2, 1 + win_props.int_length, ACS_BTEE);
-        wattron(win, WA_STANDOUT);
-        if(p->path == NULL) {
-            mvwaddstr(win, 0, 2, "/ (root)");
-        } else {
-            const char* name;
-            struct path_t* path = p->path;
-            mvwaddstr(win, 0, 2, "/");
-            while(path != NULL) {
-                wprintw(p->win, "%d/", path->id);
-                name = path->name;
-                path = path->next;
-            }
-            if(name != NULL) {
-                int name_length = (win_props.main_width / 2) - 4 - win_props.int_length * 2;
-                mvwprintw(p->win, win_props.main_height - 2, 2, "%s", name);
-            }
-        }
-	wattroff(win, WA_STANDOUT);
+/* Reads the dictionaries of every database on conn. A dictionary's id is
+   the Adler-32 of its bytes, so a description copied between files finds
+   its dictionary wherever both were loaded. The newest one of the main
+   file compresses. */
+void about_dictionaries_load(sqlite3* conn) {
+    sqlite3_stmt* stmt;
+    about_dictionaries_free();
+    about_dictionaries_add(conn, "main");
+    about_current = about_dictionary_count - 1;
+    if(sqlite3_prepare_v2(conn, "select name from pragma_database_list where name not in ('main', 'temp')", -1, &stmt, 0) == SQLITE_OK) {
+        while(sqlite3_step(stmt) == SQLITE_ROW) about_dictionaries_add(conn, (const char*)sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
     }
-    wrefresh(win);
 }
 
-int redraw() {
-    current_window = NULL;
-    draw_command_bar(bar, actions);
-    for(int i = 0; i < ARRLEN(panels); i++) {
-      draw_panel(&panels[i]);
+const struct about_dictionary_t* about_dictionary(uint32_t id) {
+    for(int i = 0; i < about_dictionary_count; i++) {
+        if(about_dictionaries[i].id == id) return &about_dictionaries[i];
     }
-    for(int i = 0; i < ARRLEN(panels); i++) {
-        update_dataview(&panels[i], TRUE);
+    return NULL;
+}
+
+/* Deflated form of text, or NULL when it is short or would not shrink.
+   The header records the dictionary, so retraining never orphans rows. */
+unsigned char* about_compress(const char* text, int length, int* size) {
+    if(length < ABOUT_COMPRESS_MIN) return NULL;
+    const struct about_dictionary_t* dictionary = about_current >= 0 ? &about_dictionaries[about_current] : NULL;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if(deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+    if(dictionary != NULL) deflateSetDictionary(&z, dictionary->data, dictionary->size);
+    uLong bound = deflateBound(&z, length);
+    unsigned char* blob = malloc(ABOUT_HEADER + bound);
+    uint32_t header[2] = { length, dictionary != NULL ? dictionary->id : 0 };
+    for(int i = 0; i < ABOUT_HEADER; i++) blob[i] = header[i / 4] >> (i % 4 * 8);
+    z.next_in = (Bytef*)text;
+    z.avail_in = length;
+    z.next_out = blob + ABOUT_HEADER;
+    z.avail_out = bound;
+    int rc = deflate(&z, Z_FINISH);
+    *size = ABOUT_HEADER + z.total_out;
+    deflateEnd(&z);
+    if(rc != Z_STREAM_END || *size >= length) {
+        free(blob);
+        return NULL;
     }
+    return blob;
 }
 
-int show_modal_help() {
-    int ch;
-    int width = win_props.main_width - 6;
-    WINDOW *modal = current_window = newwin(win_props.main_height - 4, width, 2, 3);
-    const char* title = "Using Inventory Commander";
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    for(int i = 0; actions[i].key != 0; i++) {
-        wattron(modal, COLOR_PAIR(1));
-        mvwaddstr(modal, i + 1, 1, actions[i].keyname);
-        waddstr(modal, " (");
-        wattron(modal, COLOR_PAIR(4) | WA_BOLD);
-        waddstr(modal, actions[i].name);
-        wattroff(modal, WA_BOLD);
-        wattron(modal, COLOR_PAIR(1));
-        waddstr(modal, ") ");
-        waddstr(modal, actions[i].description);
-    }
-    mvwaddstr(modal, 18, 1, "NOTE: Any changes made will be committed immediately.");
-    mvwaddstr(modal, 19, 1, "Hit 'F1' to close this help message");
-    wrefresh(modal);
-    while ((ch = getch()) != KEY_F(1)) { }
-    delwin(modal);
-    redraw();
+// Text of a deflated description, NULL if it is damaged or its dictionary is gone
+char* about_inflate(const unsigned char* blob, int size) {
+    if(size < ABOUT_HEADER) return NULL;
+    uint32_t header[2] = { 0, 0 };
+    for(int i = 0; i < ABOUT_HEADER; i++) header[i / 4] |= (uint32_t)blob[i] << (i % 4 * 8);
+    const struct about_dictionary_t* dictionary = header[1] != 0 ? about_dictionary(header[1]) : NULL;
+    if(header[1] != 0 && dictionary == NULL) return NULL;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if(inflateInit2(&z, -15) != Z_OK) return NULL;
+    if(dictionary != NULL) inflateSetDictionary(&z, dictionary->data, dictionary->size);
+    char* text = malloc(header[0] + 1);
+    z.next_in = (Bytef*)blob + ABOUT_HEADER;
+    z.avail_in = size - ABOUT_HEADER;
+    z.next_out = (Bytef*)text;
+    z.avail_out = header[0];
+    int rc = inflate(&z, Z_FINISH);
+    inflateEnd(&z);
+    if(rc != Z_STREAM_END || z.total_out != header[0]) {
+        free(text);
+        return NULL;
+    }
+    text[header[0]] = 0;
+    return text;
 }
 
-int show_modal_error(char* message) {
-    int ch;
-    int width = win_props.main_width - 6;
-    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
-    const char* title = "An Error Has Occurred";
-    box(modal, 0, 0);
-    wbkgd(modal, ' ' | COLOR_PAIR(5));
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    wattron(modal, COLOR_PAIR(5));
-    mvwaddstr(modal, 2, 2, message);
-    mvwaddstr(modal, 6, 2, "Hit 'x' to close this error message");
-    wattroff(modal, COLOR_PAIR(5));
-    wrefresh(modal);
-    while ((ch = getch()) != 'x') { }
-    delwin(modal);
-    if(current_window == NULL) {
-        redraw();
+// Binds a description in its stored form
+void sqlite_bind_about(sqlite3_stmt* stmt, int index, const char* about) {
+    int size;
+    unsigned char* blob = about != NULL ? about_compress(about, strlen(about), &size) : NULL;
+    if(about == NULL) {
+        sqlite3_bind_null(stmt, index);
+    } else if(blob != NULL) {
+        sqlite3_bind_blob(stmt, index, blob, size, free);
     } else {
-        redrawwin(current_window);
+        sqlite3_bind_text(stmt, index, about, -1, SQLITE_STATIC);
     }
 }
 
-int chomp(char* buffer) {
-    int len = strlen(buffer);
-    for(int j = len - 1; j >= 0; j--) {
-        if(buffer[j-1] != ' ' || j == 0) {
-            buffer[j] = 0;
-            break;
-        }
+// invc_about(about): the text of a stored description
+static void database_about(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    if(sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+        sqlite3_result_value(context, argv[0]);
+        return;
+    }
+    char* text = about_inflate(sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]));
+    if(text == NULL) {
+        sqlite3_result_error(context, "undecodable description", -1);
+        return;
     }
-    len = strlen(buffer);
-    return len;
+    sqlite3_result_text(context, text, -1, free);
 }
 
-int editor_save(struct action_source_t source) {
-    int len = 0;
-    int y, x;
-    int max;
-    getyx(source.window, y, x);
-    char* blob = malloc(win_props.main_width * (win_props.view_limit + 1));
-    blob[0] = 0;
-    int width = win_props.main_width;
-    char* buffer = malloc(sizeof(char) * width);
-    for(int i = win_props.view_limit + 1; i >= 1; i--) {
-        mvwinnstr(source.window, i, 1, buffer, width - 2);
-        len = chomp(buffer);
-        if(len > 0) {
-            max = i;
-            break;
+struct about_word_t {
+    size_t start;
+    int length;
+    int count;
+};
+
+// Most bytes saved first
+int about_word_compare(const void* a, const void* b) {
+    const struct about_word_t* left = a;
+    const struct about_word_t* right = b;
+    return right->count * right->length - left->count * left->length;
+}
+
+/* Builds a dictionary from a sample of the long descriptions: every word
+   of three or more characters, with the character after it, is counted,
+   and the words saving the most are kept. They are laid out with the best
+   last, where deflate reaches them with the shortest distances. Returns
+   the dictionary size, 0 when there is nothing to learn from. */
+int about_train(sqlite3* conn, unsigned char* dictionary) {
+    sqlite3_stmt* stmt;
+    if(sqlite3_prepare_v2(conn, "select invc_about(about) from item where length(about) >= ? order by random() limit ?", -1, &stmt, 0) != SQLITE_OK) return 0;
+    sqlite3_bind_int(stmt, 1, ABOUT_COMPRESS_MIN);
+    sqlite3_bind_int(stmt, 2, ABOUT_SAMPLE);
+    size_t size = 0, capacity = 65536;
+    char* sample = malloc(capacity);
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        size_t length = sqlite3_column_bytes(stmt, 0);
+        if(size + length + 1 > capacity) {
+            while(size + length + 1 > capacity) capacity *= 2;
+            sample = realloc(sample, capacity);
         }
+        memcpy(sample + size, sqlite3_column_text(stmt, 0), length);
+        size += length;
+        sample[size++] = 0;
     }
-    for(int i = 1; i <= max; i++) {
-        mvwinnstr(source.window, i, 1, buffer, width - 2);
-        len = strlen(buffer);
-        for(int j = len - 1; j >= 0; j--) {
-            if(buffer[j-1] != ' ' || j == 0) {
-                buffer[j] = 0;
-                break;
+    sqlite3_finalize(stmt);
+
+    int slots = 1 << 16, used = 0;
+    struct about_word_t* words = calloc(slots, sizeof(struct about_word_t));
+    for(size_t i = 0; i < size; ) {
+        size_t length = 0;
+        while(i + length < size && isalnum((unsigned char)sample[i + length])) length++;
+        if(length >= 3 && length < 32 && i + length < size && sample[i + length] != 0) {
+            length++;
+            uint32_t hash = 2166136261u;
+            for(size_t j = 0; j < length; j++) hash = (hash ^ (unsigned char)sample[i + j]) * 16777619u;
+            for(int slot = hash & (slots - 1); ; slot = (slot + 1) & (slots - 1)) {
+                struct about_word_t* word = &words[slot];
+                if(word->count == 0 && used < slots / 2) {
+                    word->start = i;
+                    word->length = length;
+                    word->count = 1;
+                    used++;
+                    break;
+                }
+                if(word->count == 0) break;
+                if(word->length == length && memcmp(sample + word->start, sample + i, length) == 0) {
+                    word->count++;
+                    break;
+                }
             }
         }
-        strcat(blob, buffer);
-        strcat(blob, "\n");
+        i += length > 0 ? length : 1;
+    }
+    qsort(words, slots, sizeof(struct about_word_t), about_word_compare);
+    int kept = 0, filled = 0;
+    while(kept < slots && words[kept].count > 1 && filled + words[kept].length <= ABOUT_DICTIONARY) {
+        filled += words[kept++].length;
+    }
+    int at = filled;
+    for(int i = 0; i < kept; i++) {
+        at -= words[i].length;
+        memcpy(dictionary + at, sample + words[i].start, words[i].length);
     }
-    free(buffer);
-    len = strlen(blob);
-    blob[len - 1] = 0;
-    wmove(source.window, y, x);
-    wrefresh(source.window);
+    free(words);
+    free(sample);
+    return filled;
+}
 
-    sqlite3_bind_text(redescribe_stmt, 1, blob, strlen(blob), SQLITE_STATIC);
-    sqlite3_bind_int(redescribe_stmt, 2, source.entry->id);
-    if (sqlite3_step(redescribe_stmt) != SQLITE_DONE) {
-        show_modal_error("Error in saving data to database.");
+/* invc --compress: trains a dictionary on the file and stores every long
+   description again with it, all in one transaction. */
+int about_recompress(const char* filename) {
+    sqlite3* conn;
+    sqlite3_stmt* select;
+    sqlite3_stmt* update;
+    if(sqlite3_open_v2(filename, &conn, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return 1;
+    }
+    sqlite3_create_function(conn, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+    int created = sqlite3_exec(conn, ABOUT_DICTIONARY_TABLE, 0, 0, 0) == SQLITE_OK;
+    sqlite3_exec(conn, "ALTER TABLE about_dictionary ADD COLUMN trained INT;", 0, 0, NULL);
+    if(!created || sqlite3_exec(conn, "BEGIN IMMEDIATE", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Can't write %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
         return 1;
     }
-    sqlite3_reset(redescribe_stmt);
+    about_dictionaries_load(conn);
 
-    free(blob);
-}
+    unsigned char* dictionary = malloc(ABOUT_DICTIONARY);
+    int size = about_train(conn, dictionary);
+    int failed = FALSE;
+    if(size > 0) {
+        // Training on unchanged descriptions gives a known dictionary again
+        sqlite3_stmt* insert;
+        failed = sqlite3_prepare_v2(conn, "insert into about_dictionary(id, trained, data) values(?1, strftime('%s','now'), ?2) " \
+                                          "on conflict(id) do update set trained=excluded.trained", -1, &insert, 0) != SQLITE_OK;
+        if(!failed) {
+            sqlite3_bind_int64(insert, 1, adler32(adler32(0, NULL, 0), dictionary, size));
+            sqlite3_bind_blob(insert, 2, dictionary, size, SQLITE_STATIC);
+            failed = sqlite3_step(insert) != SQLITE_DONE;
+            sqlite3_finalize(insert);
+        }
+        about_dictionaries_load(conn);
+    }
+    free(dictionary);
 
-int show_modal_editor() {
-    if(panels[panel].loaded == FALSE) {
-        show_modal_error("No database loaded.");
+    long long before = 0, after = 0;
+    int rows = 0;
+    if(!failed && sqlite3_prepare_v2(conn, "select id, invc_about(about), length(about) from item where typeof(about)='blob' or length(about) >= ?", -1, &select, 0) == SQLITE_OK) {
+        sqlite3_bind_int(select, 1, ABOUT_COMPRESS_MIN);
+        failed = sqlite3_prepare_v2(conn, "update item set about=? where id=?", -1, &update, 0) != SQLITE_OK;
+        while(!failed && sqlite3_step(select) == SQLITE_ROW) {
+            const char* text = (const char*)sqlite3_column_text(select, 1);
+            int stored;
+            unsigned char* blob = about_compress(text, sqlite3_column_bytes(select, 1), &stored);
+            before += sqlite3_column_int(select, 2);
+            after += blob != NULL ? stored : sqlite3_column_bytes(select, 1);
+            if(blob != NULL) {
+                sqlite3_bind_blob(update, 1, blob, stored, free);
+            } else {
+                sqlite3_bind_text(update, 1, text, -1, SQLITE_TRANSIENT);
+            }
+            sqlite3_bind_int(update, 2, sqlite3_column_int(select, 0));
+            failed = sqlite3_step(update) != SQLITE_DONE;
+            sqlite3_reset(update);
+            rows++;
+        }
+        sqlite3_finalize(update);
+        sqlite3_finalize(select);
+    }
+    if(failed || sqlite3_exec(conn, "COMMIT", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Can't compress %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_exec(conn, "ROLLBACK", 0, 0, 0);
+        sqlite3_close(conn);
         return 1;
     }
+    printf("%d descriptions, %d byte dictionary, %lld bytes stored as %lld\n", rows, size, before, after);
+    sqlite3_close(conn);
+    return 0;
+}
 
-    int y, x;
-    int ch;
-    struct entry_t* entry = current_entry();
-    WINDOW *modal = current_window = newwin(win_props.main_height - 1, win_props.main_width, 0, 0);
-    const char* title = "Edit Item Description";
-    WINDOW *bar = newwin(1, win_props.main_width, win_props.main_height - 1, 0);
-    wbkgd(modal, COLOR_PAIR(3));
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (win_props.main_width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    draw_command_bar(bar, editor_actions);
-    wrefresh(bar);
-
-    sqlite3_bind_int(description_stmt, 1, entry->id);
-    if (sqlite3_step(description_stmt) == SQLITE_ROW) {
-        const char* txt = sqlite3_column_text(description_stmt, 0);
-        wmove(modal, 1, 1);
-        if(txt != NULL) {
-            for(int i = 0; i < strlen(txt); i++) {
-                if(txt[i] == '\n') {
-                    getyx(modal, y, x);
-                    if(y <= win_props.view_limit) {
-                        y++; x = 1;
-                        wmove(modal, y, x);
-                    }
-                } else {
-                    waddch(modal, txt[i]);
-                }
-            }
+/* FTS5 query for items sharing a trigram with the query. Each trigram is a
+   quoted phrase; quotes inside it are doubled. An edit can take out three
+   trigrams, so when the edit limit could take out all of them there is no
+   expression and every name is checked. */
+char* fuzzy_match_expression(const char* query) {
+    int length = strlen(query);
+    if(length - 2 - 3 * fuzzy_limit(query) < 1) return NULL;
+    char* expression = malloc(16 + length * 16);
+    char* out = expression + sprintf(expression, "name : (");
+    for(int i = 0; i + FUZZY_MIN <= length; i++) {
+        if(i > 0) out += sprintf(out, " OR ");
+        *out++ = '"';
+        for(int j = i; j < i + FUZZY_MIN; j++) {
+            if(query[j] == '"') *out++ = '"';
+            *out++ = tolower((unsigned char)query[j]);
         }
+        *out++ = '"';
     }
-    sqlite3_reset(description_stmt);
+    strcpy(out, ")");
+    return expression;
+}
 
-    wmove(modal, 1, 1);
-    wrefresh(modal);
-    struct action_source_t source = { .window = modal, .entry = entry };
-    while ((ch = getch()) != KEY_F(3)) {
-        if(ch != ERR) {
-            for(int i = 0; i < ARRLEN(editor_actions); i++) {
-                if(ch == editor_actions[i].key && editor_actions[i].function != NULL) {
-                    editor_actions[i].function(source);
-                }
-            }
-            if(ch >= 32 && ch <= 126) {
-                getyx(modal, y, x);
-                if(x < win_props.main_width - 2) {
-                    winsch(modal, ch);
-                    mvwaddch(modal, y, win_props.main_width - 1, ACS_VLINE);
-                    wmove(modal, y, x + 1);
-                } else {
-                    if(y < win_props.main_height - 3) {
-                        wmove(modal, y + 1, x);
-                        winsertln(modal);
-                        mvwaddch(modal, y + 1, win_props.main_width - 1, ACS_VLINE);
-                        mvwaddch(modal, y + 1, 0, ACS_VLINE);
-                        mvwaddch(modal, win_props.main_height - 2, 0, ACS_LLCORNER);
-                        mvwaddch(modal, win_props.main_height - 2, win_props.main_width - 1, ACS_LRCORNER);
-                        mvwhline(modal, win_props.main_height - 2, 1, ACS_HLINE, win_props.main_width - 2);
-                        char* buffer = malloc(win_props.main_width);
-                        mvwinnstr(modal, y, x, buffer, win_props.main_width - x - 1);
-                        mvwhline(modal, y, x, ' ', win_props.main_width - x - 1);
-                        mvwaddstr(modal, y + 1, 1, buffer);
-                        free(buffer);
-                        wmove(modal, y + 1, 1);
-                        winsch(modal, ch);
-                        mvwaddch(modal, y + 1, win_props.main_width - 1, ACS_VLINE);
-                        wmove(modal, y + 1, 2);
-                    }
-                }
-            }
-            if(ch == '\n') {
-                getyx(modal, y, x);
-                if(y < win_props.main_height - 3) {
-                    wmove(modal, y + 1, x);
-                    winsertln(modal);
-                    mvwaddch(modal, y + 1, win_props.main_width - 1, ACS_VLINE);
-                    mvwaddch(modal, y + 1, 0, ACS_VLINE);
-                    mvwaddch(modal, win_props.main_height - 2, 0, ACS_LLCORNER);
-                    mvwaddch(modal, win_props.main_height - 2, win_props.main_width - 1, ACS_LRCORNER);
-                    mvwhline(modal, win_props.main_height - 2, 1, ACS_HLINE, win_props.main_width - 2);
-                    char* buffer = malloc(win_props.main_width);
-                    mvwinnstr(modal, y, x, buffer, win_props.main_width - x - 1);
-                    mvwhline(modal, y, x, ' ', win_props.main_width - x - 1);
-                    mvwaddstr(modal, y + 1, 1, buffer);
-                    free(buffer);
-                    wmove(modal, y + 1, 1);
-                }
-            }
-            if(ch == KEY_UP) {
-                getyx(modal, y, x);
-                if(y > 1) {
-                    y--;
-                    wmove(modal, y, x);
-                }
-            }
-            if(ch == KEY_DOWN) {
-                getyx(modal, y, x);
-                if(y <= win_props.view_limit) {
-                    y++;
-                    wmove(modal, y, x);
-                }
-            }
-            if(ch == KEY_LEFT) {
-                getyx(modal, y, x);
-                if(x > 1) {
-                    x--;
-                    wmove(modal, y, x);
-                }
-            }
-            if(ch == KEY_RIGHT) {
-                getyx(modal, y, x);
-                if(x < win_props.main_width - 2) {
-                    x++;
-                    wmove(modal, y, x);
-                }
-            }
-            if(ch == KEY_HOME) {
-                x = 1;
-                wmove(modal, y, x);
-            }
-            if(ch == KEY_END) {
-                x = win_props.main_width - 2;
-                while((mvwinch(modal, y, x) & A_CHARTEXT) == ' ') {
-                    x--;
-                }
-                if(x < win_props.main_width - 2) {
-                    x++;
-                    wmove(modal, y, x);
-                }
-            }
-            if(ch == KEY_BACKSPACE) {
-                getyx(modal, y, x);
-                if(x > 1) {
-                    mvwdelch(modal, y, x - 1);
-                    mvwinsch(modal, y, win_props.main_width - 2, ' ');
-                    wmove(modal, y, x - 1);
-                } else if(y > 1) {
-                    char* buffer1 = malloc(win_props.main_width);
-                    char* buffer2 = malloc(win_props.main_width);
-                    mvwinnstr(modal, y, x, buffer1, win_props.main_width - x - 1);
-                    mvwinnstr(modal, y - 1, x, buffer2, win_props.main_width - x - 1);
-                    int len1 = chomp(buffer1);
-                    int len2 = chomp(buffer2);
-                    if(len1 + len2 < win_props.main_width - 2) {
-                        wmove(modal, y - 1, x - 1);
-                        wdeleteln(modal);
-                        mvwinsstr(modal, y - 1, 1, buffer2);
-                        mvwaddch(modal, y - 1, win_props.main_width - 1, ACS_VLINE);
-                        mvwaddch(modal, win_props.main_height - 3, 0, ACS_VLINE);
-                        mvwaddch(modal, win_props.main_height - 3, win_props.main_width - 1, ACS_VLINE);
-                        mvwhline(modal, win_props.main_height - 3, 1, ' ', win_props.main_width - 2);
-                        mvwaddch(modal, win_props.main_height - 2, 0, ACS_LLCORNER);
-                        mvwaddch(modal, win_props.main_height - 2, win_props.main_width - 1, ACS_LRCORNER);
-                        mvwhline(modal, win_props.main_height - 2, 1, ACS_HLINE, win_props.main_width - 2);
-                        wmove(modal, y - 1, strlen(buffer2) + 1);
-                    }
-                    free(buffer1);
-                    free(buffer2);
-                }
-            }
-            if(ch == KEY_DC) {
-                getyx(modal, y, x);
-                if(x < win_props.main_width - 1) {
-                    mvwdelch(modal, y, x);
-                    mvwinsch(modal, y, win_props.main_width - 2, ' ');
-                    wmove(modal, y, x);
-                }
+/* The trigram expression a LIKE pattern implies: each literal run of at
+   least three characters as a phrase in column. NULL if there is none. */
+char* like_match_expression(const char* column, const char* query) {
+    size_t length = strlen(query);
+    char* expression = malloc(strlen(column) + 16 + length * 4);
+    char* out = expression + sprintf(expression, "%s : (", column);
+    int phrases = 0;
+    for(const char* run = query; *run != 0; ) {
+        size_t span = strcspn(run, "%_");
+        int characters = 0;
+        for(size_t i = 0; i < span; i++) {
+            if((run[i] & 0xc0) != 0x80) characters++;
+        }
+        if(characters >= 3) {
+            if(phrases++ > 0) out += sprintf(out, " AND ");
+            *out++ = '"';
+            for(size_t i = 0; i < span; i++) {
+                if(run[i] == '"') *out++ = '"';
+                *out++ = run[i];
             }
-            wrefresh(modal);
+            *out++ = '"';
         }
+        run += span;
+        if(*run != 0) run++;
     }
-    delwin(modal);
-    delwin(bar);
-    redraw();
+    strcpy(out, ")");
+    if(phrases == 0) {
+        free(expression);
+        return NULL;
+    }
+    return expression;
 }
 
-int show_modal_add() {
-    if(panels[panel].loaded == FALSE) {
-        show_modal_error("No database loaded.");
-        return 1;
+// Moves whenever this connection or any other one changes the database
+long long database_generation() {
+    long long version = 0;
+    if(sqlite3_step(data_version_stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int64(data_version_stmt, 0);
     }
+    sqlite3_reset(data_version_stmt);
+    return (version << 32) | (sqlite3_total_changes(db) & 0xffffffff);
+}
 
-    int ch;
-    int width = win_props.main_width - 6;
-    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
-    const char* title = "Add New Item";
-    char buf[BUFF_SIZE];
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    mvwaddstr(modal, 1, 1, "ITEM NAME: ");
-    mvwaddstr(modal, 7, 1, "NOTE: Any changes made will be committed immediately.");
-    wrefresh(modal);
-    echo();
-    mvwgetnstr(modal, 1, 12, buf, BUFF_SIZE);
-    noecho();
-    if(panels[panel].path == NULL) {
-        sqlite3_bind_null(insert_stmt, 1);
-    } else {
-        sqlite3_bind_int(insert_stmt, 1, panels[panel].parent);
+void bind_named_value(sqlite3_stmt* stmt, const char* name, sqlite3_value* value) {
+    int index = sqlite3_bind_parameter_index(stmt, name);
+    if(index > 0) sqlite3_bind_value(stmt, index, value);
+}
+
+void bind_named_int(sqlite3_stmt* stmt, const char* name, int value) {
+    int index = sqlite3_bind_parameter_index(stmt, name);
+    if(index > 0) sqlite3_bind_int(stmt, index, value);
+}
+
+/* Compiles a saved query into a page statement and a count statement that
+   only carry the predicates the query actually sets, so the planner can
+   use the matching indexes. */
+struct query_cache_t* query_cache_compile(int id) {
+    char where[256] = "";
+    char sql[768];
+    const char* scope = "";
+    sqlite3_bind_int(saved_query_stmt, 1, id);
+    if(sqlite3_step(saved_query_stmt) != SQLITE_ROW) {
+        sqlite3_reset(saved_query_stmt);
+        return NULL;
     }
-    sqlite3_bind_text(insert_stmt, 2, buf, strlen(buf), SQLITE_STATIC);
-    sqlite3_bind_null(insert_stmt, 3);
-    sqlite3_bind_int(insert_stmt, 4, 1);
-    if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
-        show_modal_error("Could not add item to database.");
-        return 1;
+    if(sqlite3_column_type(saved_query_stmt, 0) != SQLITE_NULL) strcat(where, " and name like :name");
+    if(sqlite3_column_type(saved_query_stmt, 1) != SQLITE_NULL) strcat(where, " and invc_about(about) like :about");
+    if(sqlite3_column_type(saved_query_stmt, 2) != SQLITE_NULL) strcat(where, " and count >= :min");
+    if(sqlite3_column_type(saved_query_stmt, 3) != SQLITE_NULL) strcat(where, " and count <= :max");
+    if(sqlite3_column_type(saved_query_stmt, 4) != SQLITE_NULL) {
+        strcat(where, " and id in scope");
+        scope = "with recursive scope(id) as (select id from item where parent=:scope " \
+                "union select item.id from item join scope on item.parent=scope.id) ";
     }
-    sqlite3_reset(insert_stmt);
-    delwin(modal);
-    redraw();
-}
 
-int show_modal_rename() {
-    if(panels[panel].loaded == FALSE) {
-        show_modal_error("No database loaded.");
-        return 1;
+    struct query_cache_t* cache = malloc(sizeof(struct query_cache_t));
+    memset(cache, 0, sizeof(struct query_cache_t));
+    cache->query = id;
+    cache->capacity = 16;
+    cache->keys = malloc(sizeof(int) * cache->capacity);
+    snprintf(sql, sizeof(sql), "%sselect id,name,count,parent from item where id > :after%s order by id limit :limit", scope, where);
+    if(sqlite3_prepare_v2(db, sql, -1, &cache->page_stmt, 0) != SQLITE_OK) {
+        sqlite3_reset(saved_query_stmt);
+        free(cache->keys);
+        free(cache);
+        return NULL;
     }
+    snprintf(sql, sizeof(sql), "%sselect count(*) from item where 1%s", scope, where);
+    if(sqlite3_prepare_v2(db, sql, -1, &cache->count_stmt, 0) != SQLITE_OK) {
+        sqlite3_reset(saved_query_stmt);
+        sqlite3_finalize(cache->page_stmt);
+        free(cache->keys);
+        free(cache);
+        return NULL;
+    }
+    const char* names[] = {":name", ":about", ":min", ":max", ":scope"};
+    for(int i = 0; i < ARRLEN(names); i++) {
+        bind_named_value(cache->page_stmt, names[i], sqlite3_column_value(saved_query_stmt, i));
+        bind_named_value(cache->count_stmt, names[i], sqlite3_column_value(saved_query_stmt, i));
+    }
+    sqlite3_reset(saved_query_stmt);
+    cache->generation = -1;
+    cache->next = query_caches;
+    query_caches = cache;
+    return cache;
+}
 
-    struct entry_t* entry = current_entry();
-    int ch;
-    int width = win_props.main_width - 6;
-    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
-    const char* title = "Rename Existing Item";
-    char* buf = malloc(BUFF_SIZE);
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    mvwaddstr(modal, 1, 1, "ITEM NAME: ");
-    mvwaddstr(modal, 7, 1, "NOTE: Any changes made will be committed immediately.");
-    wrefresh(modal);
-    echo();
-    mvwgetnstr(modal, 1, 12, buf, BUFF_SIZE);
-    noecho();
-    sqlite3_bind_text(rename_stmt, 1, buf, strlen(buf), SQLITE_STATIC);
-    sqlite3_bind_int(rename_stmt, 2, entry->id);
-    if (sqlite3_step(rename_stmt) != SQLITE_DONE) {
-        show_modal_error("Could not rename item.");
-        return 1;
+// Finds the cached query, recounting and forgetting page keys if stale
+struct query_cache_t* query_cache(int id) {
+    struct query_cache_t* cache = query_caches;
+    while(cache != NULL && cache->query != id) cache = cache->next;
+    if(cache == NULL) {
+        cache = query_cache_compile(id);
+        if(cache == NULL) return NULL;
     }
-    sqlite3_reset(rename_stmt);
-    entry->name = buf;
-    delwin(modal);
-    redraw();
+    long long generation = database_generation();
+    if(cache->generation != generation || cache->limit != win_props.view_limit) {
+        cache->count = 0;
+        if(sqlite3_step(cache->count_stmt) == SQLITE_ROW) {
+            cache->count = sqlite3_column_int(cache->count_stmt, 0);
+        }
+        sqlite3_reset(cache->count_stmt);
+        cache->keys[0] = 0;
+        cache->pages = 1;
+        cache->limit = win_props.view_limit;
+        cache->generation = generation;
+    }
+    return cache;
 }
 
-int show_modal_count() {
-    if(panels[panel].loaded == FALSE) {
-        show_modal_error("No database loaded.");
-        return 1;
+void query_cache_note(struct query_cache_t* cache, int page, int last) {
+    if(page + 1 != cache->pages) return;
+    if(cache->pages == cache->capacity) {
+        cache->capacity *= 2;
+        cache->keys = realloc(cache->keys, sizeof(int) * cache->capacity);
     }
+    cache->keys[cache->pages++] = last;
+}
 
-    int ch;
-    int width = win_props.main_width - 6;
-    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
-    const char* title = "Update Item Count";
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    mvwaddstr(modal, 6, 1, "NOTE: Any changes made will be committed immediately.");
-    mvwaddstr(modal, 7, 1, "Hit 'Enter' to close this window");
-    wrefresh(modal);
-    int s, cnt = 0;
-    if(item_count_stmt != NULL) {
-        struct entry_t *entry = current_entry();
-        sqlite3_bind_int(item_count_stmt, 1, entry->id);
-        while ((s = sqlite3_step(item_count_stmt)) != SQLITE_DONE) {
-            if(s == SQLITE_ROW) {
-                cnt = sqlite3_column_int(item_count_stmt, 0);
-            }
-        }
-        sqlite3_reset(item_count_stmt);
-        mvwprintw(modal, 1, 1, "ITEM COUNT: %d", cnt);
-        mvwprintw(modal, 3, 1, "Hit '+' to increment, '-' to decrement");
-        mvwprintw(modal, 4, 1, "Hit 'Tab' to enter a new value");
-        wrefresh(modal);
-        int newvalue = cnt;
-        char buf[256];
-        while ((ch = getch()) != '\n') {
-            if(ch == '+' || ch == '-' || ch == '\t') {
-                if(ch == '+') newvalue = newvalue + 1;
-                if(ch == '-' && newvalue > 0) newvalue = newvalue - 1;
-                if(ch == '\t') {
-                    mvwhline(modal, 1, 13, ' ', 10);
-                    echo();
-                    mvwgetnstr(modal, 1, 13, buf, sizeof(buf));
-                    noecho();
-                    newvalue = atoi(buf);
-                }
-                entry->count = newvalue;
-                mvwhline(modal, 1, 13, ' ', 10);
-                mvwprintw(modal, 1, 13, "%d", newvalue);
-                wrefresh(modal);
-            }
-        }
-        sqlite3_bind_int(update_count_stmt, 1, newvalue);
-        sqlite3_bind_int(update_count_stmt, 2, entry->id);
-        while ((s = sqlite3_step(update_count_stmt)) != SQLITE_DONE) {
+// Binds the page statement to continue after the last id of the page before
+void query_cache_seek(struct query_cache_t* cache, int page) {
+    while(cache->pages <= page) {
+        int last = 0, rows = 0;
+        sqlite3_bind_int(cache->page_stmt, sqlite3_bind_parameter_index(cache->page_stmt, ":after"), cache->keys[cache->pages - 1]);
+        bind_named_int(cache->page_stmt, ":limit", cache->limit);
+        while(sqlite3_step(cache->page_stmt) == SQLITE_ROW) {
+            last = sqlite3_column_int(cache->page_stmt, 0);
+            rows++;
         }
-        sqlite3_reset(update_count_stmt);
-    } else {
-        mvwprintw(modal, 1, 1, "NO DATABASE LOADED", cnt);
-        wrefresh(modal);
-        while ((ch = getch()) != '\n') { }
+        sqlite3_reset(cache->page_stmt);
+        if(rows < cache->limit) break;
+        query_cache_note(cache, cache->pages - 1, last);
     }
-    delwin(modal);
-    redraw();
+    if(page >= cache->pages) page = cache->pages - 1;
+    bind_named_int(cache->page_stmt, ":after", cache->keys[page]);
+    bind_named_int(cache->page_stmt, ":limit", cache->limit);
 }
 
-int draw_button_bar(WINDOW* win, int y, int x, struct button_t* buttons, int selected) {
-    wmove(win, y, x);
-    for(int i = 0; buttons[i].name != NULL; i++) {
-        if(i == selected) {
-            wattron(win, WA_STANDOUT);
+void query_cache_drop(int id) {
+    struct query_cache_t** link = &query_caches;
+    while(*link != NULL) {
+        struct query_cache_t* cache = *link;
+        if(cache->query == id || id == 0) {
+            *link = cache->next;
+            sqlite3_finalize(cache->page_stmt);
+            sqlite3_finalize(cache->count_stmt);
+            free(cache->keys);
+            free(cache);
         } else {
-            wattroff(win, WA_STANDOUT);
+            link = &cache->next;
         }
-        waddch(win, '[');
-        wprintw(win, buttons[i].name);
-        waddch(win, ']');
-        wattroff(win, WA_STANDOUT);
-        waddch(win, ' ');
     }
-    wrefresh(win);
 }
 
-int show_modal_open() {
-    int ch, button = 0;
-    int width_diff = 6;
-    int height_diff = 20;
-    int width = win_props.main_width - width_diff;
-    int height = win_props.main_height - height_diff;
-    WINDOW *modal = newwin(height, width, height_diff / 2, width_diff / 2);
-    const char* title = "Open Database File";
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    mvwaddch(modal, 1, 3, '[');
-    mvwaddch(modal, 1, width - 4, ']');
-    wrefresh(modal);
-    char buf[256];
-    draw_button_bar(modal, 3, 3, file_open_buttons, button);
-    echo();
-    mvwgetnstr(modal, 1, 4, buf, sizeof(buf));
-    noecho();
-    wmove(modal, 3, 3);
-    wrefresh(modal);
-    while ((ch = getch()) != '\n') {
-        if(ch == '\t') {
-            button = (button + 1) % (ARRLEN(file_open_buttons) - 1);
-            draw_button_bar(modal, 3, 3, file_open_buttons, button);
-        }
+void arena_reset(struct arena_t* arena) {
+    for(struct arena_block_t* block = arena->first; block != NULL; block = block->next) {
+        block->used = 0;
     }
-    if(file_open_buttons[button].function != NULL) {
-        file_open_buttons[button].function(buf);
-    }
-    delwin(modal);
-    redraw();
+    arena->current = arena->first;
 }
 
-int update_searchview() {
-    sqlite3_stmt* stmt;
-    int i = 0;
-    int reload = (search_panel.offset % win_props.view_limit) == 0 || (search_panel.offset % win_props.view_limit) == win_props.view_limit - 1;
-    if(reload == TRUE) {
-        if(search_panel.type == BY_NAME) {
-            stmt = by_name_stmt;
-        } else if(search_panel.type == BY_ABOUT) {
-            stmt = by_about_stmt;
-        }
-        sqlite3_bind_text(stmt, 1, search_panel.query, strlen(search_panel.query), SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 2, win_props.view_limit);
-        sqlite3_bind_int(stmt, 3, (search_panel.offset / win_props.view_limit) * win_props.view_limit);
-        // main width, minus border, minus 3 int fields, minus 3 field separators
-        int s;
-        while((s = sqlite3_step(stmt)) != SQLITE_DONE) {
-            search_panel.entries[i].id = sqlite3_column_int(stmt, 0);
-            search_panel.entries[i].parent = sqlite3_column_int(stmt, 1);
-            if(search_panel.entries[i].name != NULL) free((void*)(search_panel.entries[i].name));
-            if(search_panel.entries[i].about != NULL) free((void*)(search_panel.entries[i].about));
-            int bytes;
-            char* buf;
-            bytes = sqlite3_column_bytes(stmt, 2);
-            if(bytes > 0) {
-                buf = malloc(bytes + 1);
-                strcpy(buf, sqlite3_column_text(stmt, 2));
-                search_panel.entries[i].name = buf;
-            } else {
-                search_panel.entries[i].name = NULL;
-            }
-            bytes = sqlite3_column_bytes(stmt, 3);
-            if(bytes > 0) {
-                buf = malloc(bytes + 1);
-                strcpy(buf, sqlite3_column_text(stmt, 3));
-                search_panel.entries[i].about = buf;
-            } else {
-                search_panel.entries[i].about = NULL;
-            }
-            search_panel.entries[i].count = sqlite3_column_int(stmt, 4);
-            i++;
-        }
-        while ( i < win_props.view_limit ) {
-            search_panel.entries[i].id = 0;
-            search_panel.entries[i].name = NULL;
-            i++;
+const char* arena_copy(struct arena_t* arena, const char* text, size_t length) {
+    struct arena_block_t* block = arena->current;
+    // Reuse later blocks from earlier pages before allocating a new one
+    while(block != NULL && block->size - block->used < length + 1) {
+        block = block->next;
+    }
+    if(block == NULL) {
+        size_t size = length + 1 > ARENA_BLOCK ? length + 1 : ARENA_BLOCK;
+        block = malloc(sizeof(struct arena_block_t) + size);
+        block->size = size;
+        block->used = 0;
+        if(arena->current == NULL) {
+            block->next = NULL;
+            arena->first = block;
+        } else {
+            block->next = arena->current->next;
+            arena->current->next = block;
         }
-        sqlite3_reset(stmt);
     }
+    arena->current = block;
+    char* copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = 0;
+    block->used += length + 1;
+    return copy;
+}
 
-    i = 0;
-    int name_width = win_props.main_width - 2 - (win_props.int_length * 3) - 3;
-    mvwaddch(search_panel.win, 0, 1 + win_props.int_length, ACS_TTEE);
-    mvwaddch(search_panel.win, 0, 2 + win_props.int_length * 2, ACS_TTEE);
-    mvwaddch(search_panel.win, 0, 3 + win_props.int_length * 2 + name_width, ACS_TTEE);
-    mvwaddch(search_panel.win, win_props.main_height - 2, 1 + win_props.int_length, ACS_BTEE);
-    mvwaddch(search_panel.win, win_props.main_height - 2, 2 + win_props.int_length * 2, ACS_BTEE);
-    mvwaddch(search_panel.win, win_props.main_height - 2, 3 + win_props.int_length * 2 + name_width, ACS_BTEE);
-
-    wattron(search_panel.win, WA_BOLD);
-    wattron(search_panel.win, COLOR_PAIR(6));
-    mvwprintw(search_panel.win, 1, 1, "%s", "ID");
-    wattroff(search_panel.win, COLOR_PAIR(6));
-    mvwaddch(search_panel.win, 1, 1 + win_props.int_length, ACS_VLINE);
-    wattron(search_panel.win, COLOR_PAIR(6));
-    mvwprintw(search_panel.win, 1, 2 + win_props.int_length, "%s", "PID");
-    wattroff(search_panel.win, COLOR_PAIR(6));
-    mvwaddch(search_panel.win, 1, 2 + win_props.int_length * 2, ACS_VLINE);
-    wattron(search_panel.win, COLOR_PAIR(6));
-    mvwprintw(search_panel.win, 1, 3 + win_props.int_length * 2, "%s", "Item Name");
-    wattroff(search_panel.win, COLOR_PAIR(6));
-    mvwaddch(search_panel.win, 1, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
-    wattron(search_panel.win, COLOR_PAIR(6));
-    mvwprintw(search_panel.win, 1, 4 + win_props.int_length * 2 + name_width, "%s", "Qty");
-    wattroff(search_panel.win, COLOR_PAIR(6));
-    wattroff(search_panel.win, WA_BOLD);
-    while ( search_panel.entries[i].id > 0 ) {
-        if(i == ((search_panel.offset)% win_props.view_limit)) {
-            search_panel.current = &(search_panel.entries[i]);
-            wattron(search_panel.win, WA_STANDOUT);
-        }
-        //mvwprintw(search_panel.win, i + 2, 1, "%d %d %s %d", id, parent, name, count);
-        mvwhline(search_panel.win, i + 2, 1, ' ', win_props.main_width - 2);
-        mvwprintw(search_panel.win, i + 2, 1, "%d", search_panel.entries[i].id);
-        mvwaddch(search_panel.win, i + 2, 1 + win_props.int_length, ACS_VLINE);
-        mvwprintw(search_panel.win, i + 2, 2 + win_props.int_length, "%d", search_panel.entries[i].parent);
-        mvwaddch(search_panel.win, i + 2, 2 + win_props.int_length * 2, ACS_VLINE);
-        if(search_panel.entries[i].name != NULL) {
-            mvwprintw(search_panel.win, i + 2, 3 + win_props.int_length * 2, "%s", search_panel.entries[i].name);
-        }
-        mvwaddch(search_panel.win, i + 2, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
-        mvwprintw(search_panel.win, i + 2, 4 + win_props.int_length * 2 + name_width, "%d", search_panel.entries[i].count);
-        wattroff(search_panel.win, WA_STANDOUT);
-        i++;
+void arena_free(struct arena_t* arena) {
+    struct arena_block_t* block = arena->first;
+    while(block != NULL) {
+        struct arena_block_t* next = block->next;
+        free(block);
+        block = next;
     }
-    while ( i < win_props.view_limit ) {
-        mvwhline(search_panel.win, i + 2, 1, ' ', win_props.main_width - 2);
-        mvwaddch(search_panel.win, i + 2, 1 + win_props.int_length, ACS_VLINE);
-        mvwaddch(search_panel.win, i + 2, 2 + win_props.int_length * 2, ACS_VLINE);
-        mvwaddch(search_panel.win, i + 2, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
-        i++;
+    arena->first = arena->current = NULL;
+}
+
+void path_free(struct path_t* path) {
+    while(path != NULL) {
+        struct path_t* next = path->next;
+        if(path->name != NULL) allocations.path_names--;
+        free((char*)path->name);
+        path->name = NULL;
+        path->next = allocations.pooled_paths;
+        allocations.pooled_paths = path;
+        allocations.pooled++;
+        allocations.paths--;
+        path = next;
     }
-    //mvwprintw(search_panel.win, 0, 0, "%d", search_panel.offset);
-    wrefresh(search_panel.win);
 }
 
-int search_offset_dec() {
-    if(search_panel.offset > 0) {
-        search_panel.offset--;
-        update_searchview();
+struct path_t* path_push(struct path_t* next, int id, const char* name) {
+    struct path_t* path = allocations.pooled_paths;
+    if(path != NULL) {
+        allocations.pooled_paths = path->next;
+        allocations.pooled--;
+    } else {
+        path = malloc(sizeof(struct path_t));
     }
+    allocations.paths++;
+    path->next = next;
+    path->id = id;
+    path->offset = 0;
+    path->name = name != NULL ? strdup(name) : NULL;
+    if(path->name != NULL) allocations.path_names++;
+    return path;
 }
 
-int search_offset_inc() {
-    if(search_panel.offset < search_panel.count - 1) {
-        search_panel.offset++;
-        update_searchview();
+// Gives a panel a new path, freeing the one it had
+void panel_set_path(struct panel_t* p, struct path_t* path) {
+    if(p->path != path) path_free(p->path);
+    p->path = path;
+}
+
+// Entry pages of the search view, the only ones not owned by a panel
+struct entry_t* entry_page(int count) {
+    allocations.entry_pages++;
+    struct entry_t* entries = malloc(sizeof(struct entry_t) * count);
+    memset(entries, 0, sizeof(struct entry_t) * count);
+    return entries;
+}
+
+void entry_page_free(struct entry_t* entries) {
+    if(entries == NULL) return;
+    allocations.entry_pages--;
+    free(entries);
+}
+
+// Same matching rules as SQLite's LIKE: '%', '_' and ASCII case folding
+int like_match(const char* pattern, const char* text) {
+    const char* star = NULL;
+    const char* resume = NULL;
+    if(text == NULL) return FALSE;
+    while(*text != 0) {
+        if(*pattern == '%') {
+            while(*pattern == '%') pattern++;
+            star = pattern;
+            resume = text;
+        } else if(*pattern == '_' || (*pattern != 0 && tolower((unsigned char)*pattern) == tolower((unsigned char)*text))) {
+            pattern++;
+            text++;
+        } else if(star != NULL) {
+            pattern = star;
+            text = ++resume;
+        } else {
+            return FALSE;
+        }
     }
+    while(*pattern == '%') pattern++;
+    return *pattern == 0;
 }
 
-int search_offset_pgdn() {
-    if((search_panel.offset / win_props.view_limit) * win_props.view_limit + win_props.view_limit < search_panel.count) {
-        search_panel.offset = (search_panel.offset / win_props.view_limit) * win_props.view_limit + win_props.view_limit;
-        update_searchview();
+// Gives an entry found by its description the snippet a SQL search would
+void entry_snippet(struct entry_t* entry, const char* about, const char* pattern, struct arena_t* arena) {
+    char out[SNIPPET_WIDTH + 1];
+    int written = about != NULL ? description_snippet(about, pattern, out) : 0;
+    entry->snippet = written > 0 ? arena_copy(arena, out, written) : NULL;
+}
+
+// Longest run of a LIKE pattern without wildcards; returns its length
+size_t like_needle(const char* pattern, size_t* start) {
+    size_t length = strlen(pattern), best = 0, best_length = 0;
+    for(size_t i = 0; i < length; ) {
+        size_t run = 0;
+        while(i + run < length && pattern[i + run] != '%' && pattern[i + run] != '_') run++;
+        if(run > best_length) {
+            best = i;
+            best_length = run;
+        }
+        i += run + 1;
     }
+    *start = best;
+    return best_length;
 }
 
-int search_offset_pgup() {
-    if(search_panel.offset >= win_props.view_limit) {
-        search_panel.offset = (search_panel.offset / win_props.view_limit) * win_props.view_limit - win_props.view_limit;
-        update_searchview();
+/* At most SNIPPET_WIDTH bytes of text from a little before the first match
+   of the pattern's longest literal run, cut on UTF-8 boundaries and with
+   line breaks flattened. out needs SNIPPET_WIDTH + 1 bytes. */
+int description_snippet(const char* text, const char* pattern, char* out) {
+    size_t start, needle = like_needle(pattern, &start);
+    size_t length = strlen(text), at = 0;
+    for(size_t i = 0; needle > 0 && i + needle <= length; i++) {
+        if(strncasecmp(text + i, pattern + start, needle) == 0) {
+            at = i;
+            break;
+        }
     }
+    size_t first = at > SNIPPET_LEAD ? at - SNIPPET_LEAD : 0;
+    while(first > 0 && ((unsigned char)text[first] & 0xC0) == 0x80) first--;
+    size_t last = first + SNIPPET_WIDTH < length ? first + SNIPPET_WIDTH : length;
+    while(last < length && last > first && ((unsigned char)text[last] & 0xC0) == 0x80) last--;
+    int written = 0;
+    for(size_t i = first; i < last; i++) {
+        out[written++] = text[i] == '\n' || text[i] == '\r' || text[i] == '\t' ? ' ' : text[i];
+    }
+    out[written] = 0;
+    return written;
 }
 
-struct path_t* search_build_path(int item) {
-    struct path_t* path = malloc(sizeof(struct path_t));
-    struct path_t* p = path;
-    if(item == 0) return NULL; // item == 0 => root directory
-    path->id = item;
-    path->name = NULL;
-    path->next = NULL;
-    path->offset = 0;
-    int s;
-    while(item != 0) {
-        sqlite3_bind_int(item_parent_stmt, 1, item);
-        while ((s = sqlite3_step(item_parent_stmt)) != SQLITE_DONE) {
-            if(s == SQLITE_ROW) {
-                item = sqlite3_column_int(item_parent_stmt, 0);
+int attr_numeric(const char* text) {
+    char* end;
+    if(*text == 0) return FALSE;
+    strtod(text, &end);
+    return *end == 0;
+}
+
+/* Reads predicates such as "voltage>=12 colour=red", separated by spaces
+   or commas. A bare key matches items that have the attribute; quoting a
+   value keeps it text. Returns the number read, or -1. */
+int attr_parse(const char* query, struct attr_term_t* terms) {
+    static const char* ops[] = {">=", "<=", "!=", "<>", "=", "<", ">"};
+    int count = 0;
+    while(*query != 0) {
+        while(*query == ' ' || *query == ',') query++;
+        if(*query == 0) break;
+        if(count == ATTR_TERMS) return -1;
+        struct attr_term_t* term = &terms[count++];
+        int n = 0;
+        while(isalnum((unsigned char)*query) || *query == '_' || *query == '.' || *query == '-') {
+            if(n == sizeof(term->key) - 1) return -1;
+            term->key[n++] = *query++;
+        }
+        term->key[n] = 0;
+        if(n == 0) return -1;
+        while(*query == ' ') query++;
+        term->op = NULL;
+        term->value[0] = 0;
+        term->numeric = FALSE;
+        for(int i = 0; i < ARRLEN(ops) && term->op == NULL; i++) {
+            if(strncmp(query, ops[i], strlen(ops[i])) == 0) {
+                term->op = ops[i];
+                query += strlen(ops[i]);
             }
         }
-        sqlite3_reset(item_parent_stmt);
-        if(item != 0) {
-            p = malloc(sizeof(struct path_t));
-            p->next = path;
-            p->id = item;
-            p->name = NULL;
-            p->offset = 0;
-            path = p;
+        if(term->op == NULL) continue;
+        while(*query == ' ') query++;
+        char quote = *query == '"' || *query == '\'' ? *query++ : 0;
+        n = 0;
+        while(*query != 0 && (quote ? *query != quote : *query != ' ' && *query != ',')) {
+            if(n == sizeof(term->value) - 1) return -1;
+            term->value[n++] = *query++;
+        }
+        term->value[n] = 0;
+        if(quote) {
+            if(*query != quote) return -1;
+            query++;
+        } else {
+            if(n == 0) return -1;
+            term->numeric = attr_numeric(term->value);
         }
     }
-    return p;
+    return count;
 }
 
-int search_goto_parent() {
-    panels[panel].parent = search_panel.current->parent;
-    panels[panel].offset = 0;
-    panels[panel].path = search_build_path(search_panel.current->parent);
-    //fprintf(stderr, "%d\n", panels[panel].parent);
-    update_dataview(&panels[panel], TRUE);
+// Binds text as an integer or real when all of it reads as one
+void attr_bind_value(sqlite3_stmt* stmt, int index, const char* text, int numeric) {
+    char* end;
+    if(numeric) {
+        long long number = strtoll(text, &end, 10);
+        if(*end == 0) {
+            sqlite3_bind_int64(stmt, index, number);
+        } else {
+            sqlite3_bind_double(stmt, index, strtod(text, NULL));
+        }
+    } else {
+        sqlite3_bind_text(stmt, index, text, -1, SQLITE_TRANSIENT);
+    }
 }
 
-int search_goto() {
-    if(search_panel.current != NULL) {
-        panels[panel].parent = search_panel.current->id;
-        panels[panel].offset = 0;
-        panels[panel].path = search_build_path(search_panel.current->id);
-        //fprintf(stderr, "%d\n", panels[panel].parent);
-        update_dataview(&panels[panel], TRUE);
+/* Each predicate becomes a range scan of the item_attr(key, value) index
+   and the scans are intersected. Numbers sort before any text in SQLite,
+   so bounding the value by '' also keeps the scan to the right type. */
+char* attr_sql(const struct attr_term_t* terms, int count) {
+    char* sql = malloc(count * 112 + 1);
+    char* out = sql;
+    *out = 0;
+    for(int i = 0; i < count; i++) {
+        if(i > 0) out += sprintf(out, " intersect ");
+        if(terms[i].op == NULL) {
+            out += sprintf(out, "select item from item_attr where key=?%d", i * 2 + 1);
+        } else {
+            out += sprintf(out, "select item from item_attr where key=?%d and value%s?%d and value%s''",
+                           i * 2 + 1, terms[i].op, i * 2 + 2, terms[i].numeric ? "<" : ">=");
+        }
     }
+    return sql;
 }
 
-int item_search(int type, char* name) {
-    int ch;
-    sqlite3_stmt* stmt;
-    struct entry_t* entries = malloc(sizeof(struct entry_t) * win_props.view_limit + 1);
-    memset(entries, 0, sizeof(struct entry_t) * win_props.view_limit + 1);
-
-    if(type == BY_NAME) {
-        stmt = count_by_name_stmt;
-    } else if(type == BY_ABOUT) {
-        stmt = count_by_about_stmt;
+/* Prepares format, with the compiled predicates in place of its %s, on
+   conn. Returns NULL when the query does not parse. */
+sqlite3_stmt* attr_prepare(sqlite3* conn, const char* format, const char* query) {
+    struct attr_term_t terms[ATTR_TERMS];
+    int count = attr_parse(query, terms);
+    if(count <= 0 || conn == NULL) return NULL;
+    char* ids = attr_sql(terms, count);
+    char* sql = sqlite3_mprintf(format, ids);
+    sqlite3_stmt* stmt = NULL;
+    if(sqlite3_prepare_v2(conn, sql, -1, &stmt, 0) == SQLITE_OK) {
+        for(int i = 0; i < count; i++) {
+            sqlite3_bind_text(stmt, i * 2 + 1, terms[i].key, -1, SQLITE_TRANSIENT);
+            if(terms[i].op != NULL) attr_bind_value(stmt, i * 2 + 2, terms[i].value, terms[i].numeric);
+        }
     }
+    sqlite3_free(sql);
+    free(ids);
+    return stmt;
+}
 
-    search_panel.win = newwin(win_props.main_height - 1, win_props.main_width, 0, 0);
-    search_panel.offset = 0;
-    sqlite3_bind_text(stmt, 1, name, strlen(name), SQLITE_STATIC);
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        search_panel.count = sqlite3_column_int(stmt, 0);
+/* Rows are id, name, count, parent and, for description searches, the
+   snippet around the match. Descriptions themselves are never listed; the
+   editor loads one through description() when it is opened. */
+int sqlite_fill_entries(sqlite3_stmt* stmt, struct entry_t* entries, int limit, struct arena_t* arena) {
+    int i = 0;
+    int snippets = sqlite3_column_count(stmt) > 4;
+    int sites = sqlite3_column_count(stmt) > 5;
+    while (i < limit && sqlite3_step(stmt) == SQLITE_ROW) {
+        entries[i].id = sqlite3_column_int(stmt, 0);
+        int bytes = sqlite3_column_bytes(stmt, 1);
+        if(bytes > 0) {
+            entries[i].name = arena_copy(arena, sqlite3_column_text(stmt, 1), bytes);
+        } else {
+            entries[i].name = NULL;
+        }
+        entries[i].count = sqlite3_column_int(stmt, 2);
+        entries[i].parent = sqlite3_column_int(stmt, 3);
+        bytes = snippets ? sqlite3_column_bytes(stmt, 4) : 0;
+        if(bytes > 0) {
+            entries[i].snippet = arena_copy(arena, sqlite3_column_text(stmt, 4), bytes);
+        } else {
+            entries[i].snippet = NULL;
+        }
+        entries[i].site = sites ? sqlite3_column_int(stmt, 5) : 0;
+        i++;
     }
-    sqlite3_reset(stmt);
-    search_panel.type = type;
-    search_panel.query = name;
-    search_panel.entries = entries;
+    return i;
+}
 
-    const char* title = "Item Search Results";
-    WINDOW *bar = newwin(1, win_props.main_width, win_props.main_height - 1, 0);
-    wbkgd(search_panel.win, COLOR_PAIR(3));
-    box(search_panel.win, 0, 0);
-    wattron(search_panel.win, WA_STANDOUT);
-    mvwprintw(search_panel.win, 0, (win_props.main_width - strlen(title))/2, title);
-    wattroff(search_panel.win, WA_STANDOUT);
-    draw_command_bar(bar, search_actions);
-    wrefresh(search_panel.win);
-    wrefresh(bar);
+// Whether reads can go through reader rather than the primary connection
+int reader_ready(struct reader_t* reader) {
+    return reader != NULL && reader->db != NULL;
+}
 
-    update_searchview();
-    struct action_source_t source = { .window = search_panel.win };
-    while ((ch = getch()) != KEY_F(3) && ch != KEY_F(1) && ch != KEY_F(2)) {
-        if(ch != ERR) {
-            for(int i = 0; i < ARRLEN(search_actions); i++) {
-                if(ch == search_actions[i].key && search_actions[i].function != NULL) {
-                    search_actions[i].function(source);
-                }
-            }
-        }
+int sqlite_count_children(struct reader_t* reader, int parent) {
+    int cnt = 0;
+    sqlite3_stmt* stmt = reader_ready(reader) ? reader->count : count_stmt;
+    if(parent == 0) {
+        sqlite3_bind_null(stmt, 1);
+    } else {
+        sqlite3_bind_int(stmt, 1, parent);
     }
-    if(ch != ERR) {
-        for(int i = 0; i < ARRLEN(search_actions); i++) {
-            if(ch == search_actions[i].key && search_actions[i].function != NULL) {
-                search_actions[i].function(source);
-            }
-        }
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        cnt = sqlite3_column_int(stmt, 0);
     }
+    sqlite3_reset(stmt);
+    return cnt;
+}
 
+void sqlite_bind_parent(sqlite3_stmt* stmt, int index, int parent) {
+    if(parent == 0) {
+        sqlite3_bind_null(stmt, index);
+    } else {
+        sqlite3_bind_int(stmt, index, parent);
+    }
+}
 
-    delwin(search_panel.win);
-    delwin(bar);
-    //redraw();
+/* Children in sort order. The ordering comes straight from the
+   item_parent_by_id, item_parent_by_name and item_parent_by_count indexes,
+   which also hold every column selected here, and a seek compares the
+   (key, id) row value, so a page costs one index seek however deep it is. */
+void sqlite_sort_terms(int sort, int descending, char* order, char* after) {
+    static const char* columns[] = {"id", "name", "count"};
+    const char* column = columns[SORT_FIELD(sort)];
+    const char* direction = descending ? " desc" : "";
+    if(SORT_FIELD(sort) == SORT_ID) {
+        sprintf(order, "id%s", direction);
+        sprintf(after, " and id %s ?5", descending ? "<" : ">");
+    } else {
+        sprintf(order, "%s%s, id%s", column, direction, direction);
+        sprintf(after, " and (%s, id) %s (?4, ?5)", column, descending ? "<" : ">");
+    }
 }
 
-int item_search_by_name(char* name) {
-    item_search(BY_NAME, name);
+void sqlite_children_sql(char* sql, int sort, int kind) {
+    // Pages before an anchor are read backwards from it
+    int descending = ((sort & SORT_DESC) != 0) != (kind == SEEK_BEFORE);
+    char order[64], after[64];
+    sqlite_sort_terms(sort, descending, order, after);
+    sprintf(sql, "select id,name,count,parent from item where parent is ?1%s order by %s limit ?2%s",
+            kind == SEEK_OFFSET ? "" : after, order, kind == SEEK_OFFSET ? " offset ?3" : "");
+}
+
+// Binds the sort key and id of row to ?4 and ?5
+void sqlite_bind_key(sqlite3_stmt* stmt, int sort, const struct entry_t* row) {
+    if(SORT_FIELD(sort) == SORT_NAME) {
+        sqlite3_bind_text(stmt, 4, row->name != NULL ? row->name : "", -1, SQLITE_TRANSIENT);
+    } else {
+        sqlite3_bind_int(stmt, 4, row->count);
+    }
+    sqlite3_bind_int(stmt, 5, row->id);
+}
+
+// Statements for each order and seek are prepared on first use
+sqlite3_stmt* sqlite_children_stmt(struct reader_t* reader, int sort, int kind) {
+    sqlite3_stmt** stmt = reader_ready(reader) ? &reader->children[sort][kind] : &children_stmts[sort][kind];
+    if(*stmt == NULL) {
+        char sql[256];
+        sqlite_children_sql(sql, sort, kind);
+        if(sqlite3_prepare_v2(reader_ready(reader) ? reader->db : db, sql, -1, stmt, 0) != SQLITE_OK) *stmt = NULL;
+    }
+    return *stmt;
+}
+
+int sqlite_children(struct reader_t* reader, int parent, int sort, const struct seek_t* seek, int limit, struct entry_t* entries, struct arena_t* arena) {
+    const struct entry_t* anchor = seek->after != NULL ? seek->after : seek->before;
+    int kind = seek->after != NULL ? SEEK_AFTER : seek->before != NULL ? SEEK_BEFORE : SEEK_OFFSET;
+    sqlite3_stmt* stmt = sqlite_children_stmt(reader, sort, kind);
+    if(stmt == NULL) return 0;
+    sqlite_bind_parent(stmt, 1, parent);
+    sqlite3_bind_int(stmt, 2, limit);
+    if(anchor == NULL) {
+        sqlite3_bind_int(stmt, 3, seek->offset);
+    } else {
+        // The anchor may live in the page being overwritten, so its key is copied
+        sqlite_bind_key(stmt, sort, anchor);
+    }
+    int i = sqlite_fill_entries(stmt, entries, limit, arena);
+    sqlite3_reset(stmt);
+    for(int j = 0; kind == SEEK_BEFORE && j < i / 2; j++) {
+        struct entry_t swap = entries[j];
+        entries[j] = entries[i - 1 - j];
+        entries[i - 1 - j] = swap;
+    }
+    return i;
+}
+
+/* Ordinal of the first child, in sort order, whose name starts with prefix,
+   or -1. The prefix is a range on item_parent_by_name; the ordinal is then
+   a count of the index entries that sort before that row. */
+int sqlite_locate(struct reader_t* reader, int parent, int sort, const char* prefix) {
+    sqlite3* conn = reader_ready(reader) ? reader->db : db;
+    char sql[256], order[64], before[64];
+    size_t length = strlen(prefix);
+    if(length == 0) return 0;
+    // Every name with the prefix sorts below the prefix with its last byte raised
+    char* limit = strdup(prefix);
+    while(length > 0 && (unsigned char)limit[length - 1] == 0xFF) limit[--length] = 0;
+    if(length > 0) limit[length - 1]++;
+    sqlite_sort_terms(sort, (sort & SORT_DESC) != 0, order, before);
+    sprintf(sql, "select id,name,count,parent from item where parent is ?1 and name >= ?2%s order by %s limit 1",
+            length > 0 ? " and name < ?3" : "", order);
+    sqlite3_stmt* stmt;
+    struct entry_t row;
+    struct arena_t arena = {NULL, NULL};
+    int found = FALSE, ordinal = -1;
+    if(sqlite3_prepare_v2(conn, sql, -1, &stmt, 0) == SQLITE_OK) {
+        sqlite_bind_parent(stmt, 1, parent);
+        sqlite3_bind_text(stmt, 2, prefix, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, limit, -1, SQLITE_STATIC);
+        found = sqlite_fill_entries(stmt, &row, 1, &arena);
+        sqlite3_finalize(stmt);
+    }
+    // Rows before this one are those "after" it in the opposite direction
+    sqlite_sort_terms(sort, (sort & SORT_DESC) == 0, order, before);
+    sprintf(sql, "select count(*) from item where parent is ?1%s", before);
+    if(found && sqlite3_prepare_v2(conn, sql, -1, &stmt, 0) == SQLITE_OK) {
+        sqlite_bind_parent(stmt, 1, parent);
+        sqlite_bind_key(stmt, sort, &row);
+        if(sqlite3_step(stmt) == SQLITE_ROW) ordinal = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    arena_free(&arena);
+    free(limit);
+    return ordinal;
+}
+
+// LIKE statements take the pattern and the trigram expression for column
+void sqlite_bind_like(sqlite3_stmt* stmt, const char* column, const char* query) {
+    sqlite3_bind_text(stmt, 1, query, strlen(query), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, like_match_expression(column, query), -1, free);
+}
+
+// Fuzzy statements take the query, its trigram expression and the edit limit
+void sqlite_bind_fuzzy(sqlite3_stmt* stmt, const char* query) {
+    sqlite3_bind_text(stmt, 1, query, strlen(query), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, fuzzy_match_expression(query), -1, free);
+    sqlite3_bind_int(stmt, 3, fuzzy_limit(query));
+}
+
+/* Searches the names of every site in one statement on the federation
+   connection. Each site's own trigram index finds its rows, and the union
+   is merged into one name order so that pages run across the sites. */
+sqlite3_stmt* sites_search_prepare(int count) {
+    sqlite3_stmt* stmt;
+    if(federation == NULL) return NULL;
+    char* sql = sqlite3_mprintf("");
+    for(int i = 0; i < site_count; i++) {
+        if(count) {
+            sql = sqlite3_mprintf("%z%sselect count(*) as hits from \"%w\".item where id in (select rowid from \"%w\".item_trigram " \
+                                  "where ?2 is not null and item_trigram match ?2 union all select id from \"%w\".item where ?2 is null) " \
+                                  "and name like ?1", sql, i > 0 ? " union all " : "", sites[i].alias, sites[i].alias, sites[i].alias);
+        } else {
+            sql = sqlite3_mprintf("%z%sselect id,name,count,parent,null,%d as site from \"%w\".item where id in (select rowid " \
+                                  "from \"%w\".item_trigram where ?2 is not null and item_trigram match ?2 union all " \
+                                  "select id from \"%w\".item where ?2 is null) and name like ?1",
+                                  sql, i > 0 ? " union all " : "", i, sites[i].alias, sites[i].alias, sites[i].alias);
+        }
+    }
+    sql = count ? sqlite3_mprintf("select sum(hits) from (%z)", sql)
+                : sqlite3_mprintf("select * from (%z) order by name, site, id limit ?4 offset ?5", sql);
+    int rc = sqlite3_prepare_v2(federation, sql, -1, &stmt, 0);
+    sqlite3_free(sql);
+    return rc == SQLITE_OK ? stmt : NULL;
+}
+
+int sqlite_search_count(struct reader_t* reader, int type, const char* query) {
+    int cnt = 0;
+    sqlite3_stmt* stmt;
+    if(type == BY_SITES) {
+        stmt = sites_search_prepare(TRUE);
+        if(stmt == NULL) return 0;
+        sqlite_bind_like(stmt, "name", query);
+        if(sqlite3_step(stmt) == SQLITE_ROW) cnt = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        return cnt;
+    }
+    if(type == BY_ATTR) {
+        stmt = attr_prepare(reader_ready(reader) ? reader->db : db, "select count(*) from item where id in (%s)", query);
+        if(stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW) cnt = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        return cnt;
+    }
+    if(reader_ready(reader)) {
+        stmt = type == BY_ABOUT ? reader->count_by_about : type == BY_FUZZY ? reader->count_fuzzy : reader->count_by_name;
+    } else {
+        stmt = type == BY_ABOUT ? count_by_about_stmt : type == BY_FUZZY ? count_fuzzy_stmt : count_by_name_stmt;
+    }
+    if(type == BY_FUZZY) {
+        sqlite_bind_fuzzy(stmt, query);
+    } else {
+        sqlite_bind_like(stmt, type == BY_ABOUT ? "about" : "name", query);
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        cnt = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_reset(stmt);
+    return cnt;
+}
+
+int sqlite_search(struct reader_t* reader, int type, const char* query, int offset, int limit, struct entry_t* entries, struct arena_t* arena) {
+    sqlite3_stmt* stmt;
+    if(type == BY_SITES) {
+        stmt = sites_search_prepare(FALSE);
+        if(stmt == NULL) return 0;
+        sqlite_bind_like(stmt, "name", query);
+        sqlite3_bind_int(stmt, 4, limit);
+        sqlite3_bind_int(stmt, 5, offset);
+        int i = sqlite_fill_entries(stmt, entries, limit, arena);
+        sqlite3_finalize(stmt);
+        return i;
+    }
+    if(type == BY_ATTR) {
+        stmt = attr_prepare(reader_ready(reader) ? reader->db : db,
+                            "select id,name,count,parent from item where id in (%s) order by id limit :limit offset :offset", query);
+        if(stmt == NULL) return 0;
+        sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":limit"), limit);
+        sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":offset"), offset);
+        int i = sqlite_fill_entries(stmt, entries, limit, arena);
+        sqlite3_finalize(stmt);
+        return i;
+    }
+    if(reader_ready(reader)) {
+        stmt = type == BY_ABOUT ? reader->by_about : type == BY_FUZZY ? reader->fuzzy : reader->by_name;
+    } else {
+        stmt = type == BY_ABOUT ? by_about_stmt : type == BY_FUZZY ? fuzzy_stmt : by_name_stmt;
+    }
+    if(type == BY_FUZZY) {
+        sqlite_bind_fuzzy(stmt, query);
+    } else {
+        sqlite_bind_like(stmt, type == BY_ABOUT ? "about" : "name", query);
+    }
+    sqlite3_bind_int(stmt, 4, limit);
+    sqlite3_bind_int(stmt, 5, offset);
+    int i = sqlite_fill_entries(stmt, entries, limit, arena);
+    sqlite3_reset(stmt);
+    return i;
+}
+
+int sqlite_get(int id, struct entry_t* entry, struct arena_t* arena) {
+    sqlite3_bind_int(item_stmt, 1, id);
+    int found = sqlite_fill_entries(item_stmt, entry, 1, arena);
+    sqlite3_reset(item_stmt);
+    return found;
+}
+
+// One recursive query returns every ancestor, nearest first
+struct path_t* sqlite_path(int id) {
+    struct path_t* path = NULL;
+    sqlite3_bind_int(path_stmt, 1, id);
+    while(sqlite3_step(path_stmt) == SQLITE_ROW) {
+        path = path_push(path, sqlite3_column_int(path_stmt, 0), sqlite3_column_text(path_stmt, 1));
+    }
+    sqlite3_reset(path_stmt);
+    return path;
+}
+
+int sqlite_write(sqlite3_stmt* stmt) {
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE ? 0 : 1;
+}
+
+// An id of 0 takes the next free one of this replica's block
+int sqlite_insert_id(int id, int parent, const char* name, const char* about, int count) {
+    sqlite_bind_parent(insert_stmt, 1, id);
+    sqlite_bind_parent(insert_stmt, 2, parent);
+    sqlite3_bind_text(insert_stmt, 3, name, -1, SQLITE_STATIC);
+    sqlite_bind_about(insert_stmt, 4, about);
+    sqlite3_bind_int(insert_stmt, 5, count);
+    sqlite3_bind_int(insert_stmt, 6, sync_base);
+    if(sqlite_write(insert_stmt) != 0) return 0;
+    return sqlite3_last_insert_rowid(db);
+}
+
+int sqlite_insert(int parent, const char* name, const char* about, int count) {
+    return sqlite_insert_id(0, parent, name, about, count);
+}
+
+// Writes ids as a JSON array for json_each(); the caller frees it
+char* sqlite_id_array(const int* ids, int count) {
+    char* list = malloc(count * 12 + 2);
+    char* out = list;
+    *out++ = '[';
+    for(int i = 0; i < count; i++) {
+        out += sprintf(out, i > 0 ? ",%d" : "%d", ids[i]);
+    }
+    strcpy(out, "]");
+    return list;
+}
+
+// A selection moves in one statement, its ids passed as a JSON array
+int sqlite_move(const int* ids, int count, int parent) {
+    if(count == 1) {
+        sqlite_bind_parent(move_stmt, 1, parent);
+        sqlite3_bind_int(move_stmt, 2, ids[0]);
+        return sqlite_write(move_stmt);
+    }
+    sqlite_bind_parent(move_many_stmt, 1, parent);
+    sqlite3_bind_text(move_many_stmt, 2, sqlite_id_array(ids, count), -1, free);
+    return sqlite_write(move_many_stmt);
+}
+
+/* Copies whole subtrees in a few statements inside one transaction: the
+   subtree ids are numbered into copy_map above the highest id of this
+   replica's block, then every row, every attribute and every attachment
+   link is inserted at once with its new ids looked up there. Attachment
+   content is shared, not copied. */
+int sqlite_copy(const int* ids, int count, int parent) {
+    if(sqlite3_exec(db, "BEGIN", 0, 0, 0) != SQLITE_OK) return 1;
+    int failed = sqlite_write(copy_clear_stmt) != 0;
+    if(!failed) {
+        sqlite3_bind_text(copy_map_stmt, 1, sqlite_id_array(ids, count), -1, free);
+        sqlite3_bind_int(copy_map_stmt, 2, sync_base);
+        failed = sqlite_write(copy_map_stmt) != 0;
+    }
+    if(!failed) {
+        sqlite_bind_parent(copy_items_stmt, 1, parent);
+        failed = sqlite_write(copy_items_stmt) != 0;
+    }
+    if(!failed) failed = sqlite_write(copy_attrs_stmt) != 0;
+    if(!failed) failed = sqlite_write(copy_attachments_stmt) != 0;
+    if(!failed) failed = sqlite3_exec(db, "COMMIT", 0, 0, 0) != SQLITE_OK;
+    if(failed) sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+    return failed;
+}
+
+int sqlite_remove(int id) {
+    sqlite3_bind_int(delete_stmt, 1, id);
+    return sqlite_write(delete_stmt);
+}
+
+int sqlite_rename(int id, const char* name) {
+    sqlite3_bind_text(rename_stmt, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_int(rename_stmt, 2, id);
+    return sqlite_write(rename_stmt);
+}
+
+int sqlite_set_count(int id, int count) {
+    sqlite3_bind_int(update_count_stmt, 1, count);
+    sqlite3_bind_int(update_count_stmt, 2, id);
+    return sqlite_write(update_count_stmt);
+}
+
+int sqlite_describe(int id, const char* about) {
+    sqlite_bind_about(redescribe_stmt, 1, about);
+    sqlite3_bind_int(redescribe_stmt, 2, id);
+    return sqlite_write(redescribe_stmt);
+}
+
+char* sqlite_description(int id) {
+    char* text = NULL;
+    sqlite3_bind_int(description_stmt, 1, id);
+    if (sqlite3_step(description_stmt) == SQLITE_ROW && sqlite3_column_type(description_stmt, 0) != SQLITE_NULL) {
+        text = strdup(sqlite3_column_text(description_stmt, 0));
+    }
+    sqlite3_reset(description_stmt);
+    return text;
+}
+
+struct store_t sqlite_store = {
+    "SQLite",
+    sqlite_count_children,
+    sqlite_children,
+    sqlite_locate,
+    sqlite_get,
+    sqlite_search_count,
+    sqlite_search,
+    sqlite_path,
+    sqlite_description,
+    sqlite_insert,
+    sqlite_move,
+    sqlite_copy,
+    sqlite_remove,
+    sqlite_rename,
+    sqlite_set_count,
+    sqlite_describe
+};
+
+/* SHA-256 (FIPS 180-4) names attachment content; files are hashed while
+   they stream, so no file is ever held in memory whole. */
+struct sha256_t {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void sha256_init(struct sha256_t* sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+void sha256_block(struct sha256_t* sha, const unsigned char* block) {
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t v[8];
+    memcpy(v, sha->state, sizeof(v));
+    for(int i = 0; i < 64; i++) {
+        uint32_t s1 = SHA256_ROTR(v[4], 6) ^ SHA256_ROTR(v[4], 11) ^ SHA256_ROTR(v[4], 25);
+        uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + choice + sha256_k[i] + w[i];
+        uint32_t s0 = SHA256_ROTR(v[0], 2) ^ SHA256_ROTR(v[0], 13) ^ SHA256_ROTR(v[0], 22);
+        uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(v + 1, v, sizeof(uint32_t) * 7);
+        v[4] += t1;
+        v[0] = t1 + s0 + majority;
+    }
+    for(int i = 0; i < 8; i++) sha->state[i] += v[i];
+}
+
+void sha256_update(struct sha256_t* sha, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    sha->length += length;
+    while(length > 0) {
+        size_t take = 64 - sha->used < length ? 64 - sha->used : length;
+        memcpy(sha->block + sha->used, bytes, take);
+        sha->used += take;
+        bytes += take;
+        length -= take;
+        if(sha->used == 64) {
+            sha256_block(sha, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+// Writes the digest as 64 lowercase hex digits and a terminator
+void sha256_final(struct sha256_t* sha, char* hex) {
+    uint64_t bits = sha->length * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t pad_length = (sha->used < 56 ? 56 : 120) - sha->used;
+    for(int i = 0; i < 8; i++) pad[pad_length + i] = bits >> (56 - i * 8);
+    sha256_update(sha, pad, pad_length + 8);
+    for(int i = 0; i < 8; i++) sprintf(hex + i * 8, "%08x", sha->state[i]);
+}
+
+/* Attachments live beside the item table: one attachment row per distinct
+   content, named by its hash, and item_attachment rows linking items to
+   them by file name. The first pass over a file only hashes it; content
+   already stored is linked again instead of copied. New content is
+   written through an incremental blob handle a chunk at a time and hashed
+   once more on the way, so a file that changed in between is refused. */
+int attachment_add(int item, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return 1;
+    const char* name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    unsigned char* chunk = malloc(ATTACH_CHUNK);
+    struct sha256_t sha;
+    char hash[65], again[65];
+    size_t got;
+    sqlite3_int64 size = 0;
+    sha256_init(&sha);
+    while((got = fread(chunk, 1, ATTACH_CHUNK, file)) > 0) {
+        sha256_update(&sha, chunk, got);
+        size += got;
+    }
+    sha256_final(&sha, hash);
+    int failed = ferror(file) || size > INT32_MAX || sqlite3_exec(db, "BEGIN", 0, 0, 0) != SQLITE_OK;
+    if(failed) {
+        free(chunk);
+        fclose(file);
+        return 1;
+    }
+
+    sqlite3_int64 blob_id = 0;
+    sqlite3_bind_text(attach_find_stmt, 1, hash, -1, SQLITE_STATIC);
+    if(sqlite3_step(attach_find_stmt) == SQLITE_ROW) blob_id = sqlite3_column_int64(attach_find_stmt, 0);
+    sqlite3_reset(attach_find_stmt);
+    if(blob_id == 0) {
+        sqlite3_bind_text(attach_blob_stmt, 1, hash, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(attach_blob_stmt, 2, size);
+        failed = sqlite_write(attach_blob_stmt) != 0;
+        blob_id = sqlite3_last_insert_rowid(db);
+        sqlite3_blob* blob = NULL;
+        if(!failed) failed = sqlite3_blob_open(db, "main", "attachment", "data", blob_id, 1, &blob) != SQLITE_OK;
+        rewind(file);
+        sha256_init(&sha);
+        int offset = 0;
+        while(!failed && (got = fread(chunk, 1, ATTACH_CHUNK, file)) > 0) {
+            sha256_update(&sha, chunk, got);
+            failed = offset + got > size || sqlite3_blob_write(blob, chunk, got, offset) != SQLITE_OK;
+            offset += got;
+        }
+        sqlite3_blob_close(blob);
+        sha256_final(&sha, again);
+        if(!failed) failed = offset != size || strcmp(hash, again) != 0;
+    }
+    /* The same content under the same name is left linked as it is: the
+       unlink would drop the blob just found along with its last link. */
+    int linked = FALSE;
+    if(!failed) {
+        sqlite3_bind_int(attach_get_stmt, 1, item);
+        sqlite3_bind_text(attach_get_stmt, 2, name, -1, SQLITE_STATIC);
+        linked = sqlite3_step(attach_get_stmt) == SQLITE_ROW && sqlite3_column_int64(attach_get_stmt, 0) == blob_id;
+        sqlite3_reset(attach_get_stmt);
+    }
+    if(!failed && !linked) {
+        sqlite3_bind_int(attach_unlink_stmt, 1, item);
+        sqlite3_bind_text(attach_unlink_stmt, 2, name, -1, SQLITE_STATIC);
+        failed = sqlite_write(attach_unlink_stmt) != 0;
+    }
+    if(!failed && !linked) {
+        sqlite3_bind_int(attach_link_stmt, 1, item);
+        sqlite3_bind_text(attach_link_stmt, 2, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(attach_link_stmt, 3, blob_id);
+        failed = sqlite_write(attach_link_stmt) != 0;
+    }
+    if(!failed) failed = sqlite3_exec(db, "COMMIT", 0, 0, 0) != SQLITE_OK;
+    if(failed) sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+    free(chunk);
+    fclose(file);
+    return failed;
+}
+
+// Streams the content of an attachment out to a file a chunk at a time
+int attachment_save(int item, const char* name, const char* path) {
+    sqlite3_int64 blob_id = 0;
+    sqlite3_bind_int(attach_get_stmt, 1, item);
+    sqlite3_bind_text(attach_get_stmt, 2, name, -1, SQLITE_STATIC);
+    if(sqlite3_step(attach_get_stmt) == SQLITE_ROW) blob_id = sqlite3_column_int64(attach_get_stmt, 0);
+    sqlite3_reset(attach_get_stmt);
+    sqlite3_blob* blob = NULL;
+    if(blob_id == 0 || sqlite3_blob_open(db, "main", "attachment", "data", blob_id, 0, &blob) != SQLITE_OK) return 1;
+    FILE* file = fopen(path, "wb");
+    int failed = file == NULL;
+    unsigned char* chunk = malloc(ATTACH_CHUNK);
+    int size = sqlite3_blob_bytes(blob);
+    for(int offset = 0; !failed && offset < size; offset += ATTACH_CHUNK) {
+        int take = size - offset < ATTACH_CHUNK ? size - offset : ATTACH_CHUNK;
+        failed = sqlite3_blob_read(blob, chunk, take, offset) != SQLITE_OK || fwrite(chunk, 1, take, file) != take;
+    }
+    if(file != NULL && fclose(file) != 0) failed = TRUE;
+    sqlite3_blob_close(blob);
+    free(chunk);
+    return failed;
+}
+
+struct sort_key_t {
+    const char* name;
+    int count;
+    int id;
+    int ref;
+};
+
+int sort_by_name(const void* a, const void* b) {
+    const struct sort_key_t* x = a;
+    const struct sort_key_t* y = b;
+    int order = strcmp(x->name, y->name);
+    return order != 0 ? order : (x->id > y->id) - (x->id < y->id);
+}
+
+int sort_by_count(const void* a, const void* b) {
+    const struct sort_key_t* x = a;
+    const struct sort_key_t* y = b;
+    if(x->count != y->count) return x->count < y->count ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// Bumped whenever a memory tree or snapshot is dropped, so sorted lists go stale
+long long sort_epoch;
+
+/* Orders the refs of keys ascending on field into sorted. Descending
+   orders read the same list from the back. */
+void sorted_fill(struct sorted_t* sorted, struct sort_key_t* keys, int count, int parent, int field, long long epoch) {
+    qsort(keys, count, sizeof(struct sort_key_t), field == SORT_NAME ? sort_by_name : sort_by_count);
+    sorted->refs = realloc(sorted->refs, sizeof(int) * (count + 1));
+    for(int i = 0; i < count; i++) sorted->refs[i] = keys[i].ref;
+    sorted->count = count;
+    sorted->parent = parent;
+    sorted->field = field;
+    sorted->epoch = epoch;
+}
+
+int sorted_fresh(struct sorted_t* sorted, int parent, int field, long long epoch) {
+    return sorted->refs != NULL && sorted->parent == parent && sorted->field == field && sorted->epoch == epoch;
+}
+
+// Position of the row shown at offset, within a list of count kept ascending
+int sorted_position(int sort, int count, int offset) {
+    return sort & SORT_DESC ? count - 1 - offset : offset;
+}
+
+const struct snapshot_item_t* snapshot_find(int id) {
+    int low = 0, high = (int)snapshot.header->items - 1;
+    while(low <= high) {
+        int middle = low + (high - low) / 2;
+        if(snapshot.items[middle].id == id) return &snapshot.items[middle];
+        if(snapshot.items[middle].id < id) low = middle + 1; else high = middle - 1;
+    }
+    return NULL;
+}
+
+// Offsets are checked as they are read; bad ones read as empty
+const char* snapshot_string(uint32_t offset) {
+    return offset < snapshot.header->strings_size ? snapshot.strings + offset : "";
+}
+
+// A child slot that names no item reads as an empty one
+const struct snapshot_item_t* snapshot_slot(uint32_t index) {
+    static const struct snapshot_item_t missing = { 0, 0, 0, SNAPSHOT_NONE, SNAPSHOT_NONE, 0, 0, 0 };
+    return index < snapshot.header->items ? &snapshot.items[index] : &missing;
+}
+
+int snapshot_run(uint32_t first, uint32_t count) {
+    return (uint64_t)first + count <= snapshot.slots;
+}
+
+// Entries point straight into the mapping, so paging allocates nothing
+void snapshot_entry(const struct snapshot_item_t* item, struct entry_t* entry) {
+    entry->id = item->id;
+    entry->parent = item->parent;
+    entry->name = snapshot_string(item->name);
+    entry->snippet = NULL;
+    entry->site = 0;
+    entry->count = item->count;
+}
+
+int snapshot_count_children(struct reader_t* reader, int parent) {
+    if(parent == 0) return snapshot.header->root_count;
+    const struct snapshot_item_t* item = snapshot_find(parent);
+    return item != NULL && snapshot_run(item->first_child, item->children) ? item->children : 0;
+}
+
+/* Points children at the item indexes of parent's children in id order
+   and returns how many there are, or -1. For other orders the reader's
+   sorted list comes back too, ascending, else NULL. */
+int snapshot_order(struct reader_t* reader, int parent, int sort, const uint32_t** children, const int** sorted) {
+    uint32_t first = snapshot.header->root_first;
+    uint32_t count = snapshot.header->root_count;
+    if(parent != 0) {
+        const struct snapshot_item_t* item = snapshot_find(parent);
+        if(item == NULL) return -1;
+        first = item->first_child;
+        count = item->children;
+    }
+    if(!snapshot_run(first, count)) return -1;
+    *children = snapshot.children + first;
+    *sorted = NULL;
+    if(SORT_FIELD(sort) != SORT_ID && reader != NULL) {
+        if(!sorted_fresh(&reader->sorted, parent, SORT_FIELD(sort), sort_epoch)) {
+            struct sort_key_t* keys = malloc(sizeof(struct sort_key_t) * (count + 1));
+            for(uint32_t i = 0; i < count; i++) {
+                const struct snapshot_item_t* item = snapshot_slot((*children)[i]);
+                keys[i].name = snapshot_string(item->name);
+                keys[i].count = item->count;
+                keys[i].id = item->id;
+                keys[i].ref = (*children)[i];
+            }
+            sorted_fill(&reader->sorted, keys, count, parent, SORT_FIELD(sort), sort_epoch);
+            free(keys);
+        }
+        *sorted = reader->sorted.refs;
+    }
+    return count;
+}
+
+int snapshot_children(struct reader_t* reader, int parent, int sort, const struct seek_t* seek, int limit, struct entry_t* entries, struct arena_t* arena) {
+    const uint32_t* children;
+    const int* sorted;
+    int count = snapshot_order(reader, parent, sort, &children, &sorted);
+    int i;
+    for(i = 0; i < limit && seek->offset + i < count; i++) {
+        int position = sorted_position(sort, count, seek->offset + i);
+        snapshot_entry(snapshot_slot(sorted != NULL ? sorted[position] : children[position]), &entries[i]);
+    }
+    return i;
+}
+
+// Snapshots keep nothing ordered by name, so this is a walk of the listing
+int snapshot_locate(struct reader_t* reader, int parent, int sort, const char* prefix) {
+    const uint32_t* children;
+    const int* sorted;
+    int count = snapshot_order(reader, parent, sort, &children, &sorted);
+    size_t length = strlen(prefix);
+    for(int i = 0; i < count; i++) {
+        int position = sorted_position(sort, count, i);
+        const struct snapshot_item_t* item = snapshot_slot(sorted != NULL ? sorted[position] : children[position]);
+        if(strncmp(snapshot_string(item->name), prefix, length) == 0) return i;
+    }
+    return -1;
+}
+
+const char* snapshot_field(const struct snapshot_item_t* item, int type) {
+    if(type == BY_ABOUT) {
+        return item->about == SNAPSHOT_NONE ? NULL : snapshot_string(item->about);
+    }
+    return snapshot_string(item->name);
+}
+
+// Ranks every item by edit distance; the snapshot keeps no search state
+struct fuzzy_hit_t* snapshot_fuzzy(const char* query, int* count) {
+    struct fuzzy_hit_t* hits = malloc(sizeof(struct fuzzy_hit_t) * (snapshot.header->items + 1));
+    int limit = fuzzy_limit(query);
+    *count = 0;
+    for(uint32_t i = 0; i < snapshot.header->items; i++) {
+        int distance = fuzzy_distance(query, snapshot_string(snapshot.items[i].name));
+        if(distance <= limit) {
+            hits[*count].distance = distance;
+            hits[*count].index = i;
+            (*count)++;
+        }
+    }
+    qsort(hits, *count, sizeof(struct fuzzy_hit_t), fuzzy_compare);
+    return hits;
+}
+
+int snapshot_search_count(struct reader_t* reader, int type, const char* query) {
+    int cnt = 0;
+    if(type == BY_ATTR) return 0;
+    if(type == BY_FUZZY) {
+        free(snapshot_fuzzy(query, &cnt));
+        return cnt;
+    }
+    for(uint32_t i = 0; i < snapshot.header->items; i++) {
+        if(like_match(query, snapshot_field(&snapshot.items[i], type))) cnt++;
+    }
+    return cnt;
+}
+
+int snapshot_search(struct reader_t* reader, int type, const char* query, int offset, int limit, struct entry_t* entries, struct arena_t* arena) {
+    int i = 0;
+    if(type == BY_ATTR) return 0;
+    if(type == BY_FUZZY) {
+        int count;
+        struct fuzzy_hit_t* hits = snapshot_fuzzy(query, &count);
+        for(i = 0; i < limit && offset + i < count; i++) {
+            snapshot_entry(&snapshot.items[hits[offset + i].index], &entries[i]);
+        }
+        free(hits);
+        return i;
+    }
+    for(uint32_t j = 0; j < snapshot.header->items && i < limit; j++) {
+        if(like_match(query, snapshot_field(&snapshot.items[j], type))) {
+            if(offset > 0) {
+                offset--;
+            } else {
+                snapshot_entry(&snapshot.items[j], &entries[i]);
+                if(type == BY_ABOUT) entry_snippet(&entries[i], snapshot_field(&snapshot.items[j], type), query, arena);
+                i++;
+            }
+        }
+    }
+    return i;
+}
+
+int snapshot_get(int id, struct entry_t* entry, struct arena_t* arena) {
+    const struct snapshot_item_t* item = snapshot_find(id);
+    if(item == NULL) return FALSE;
+    snapshot_entry(item, entry);
+    return TRUE;
+}
+
+struct path_t* snapshot_path(int id) {
+    struct path_t* path = NULL;
+    const struct snapshot_item_t* item = snapshot_find(id);
+    for(uint32_t steps = 0; item != NULL && steps < snapshot.header->items; steps++) {
+        path = path_push(path, item->id, snapshot_string(item->name));
+        item = item->parent != 0 ? snapshot_find(item->parent) : NULL;
+    }
+    return path;
+}
+
+char* snapshot_description(int id) {
+    const struct snapshot_item_t* item = snapshot_find(id);
+    if(item == NULL || item->about == SNAPSHOT_NONE) return NULL;
+    return strdup(snapshot_string(item->about));
+}
+
+struct store_t snapshot_store = {
+    "snapshot",
+    snapshot_count_children,
+    snapshot_children,
+    snapshot_locate,
+    snapshot_get,
+    snapshot_search_count,
+    snapshot_search,
+    snapshot_path,
+    snapshot_description,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+void snapshot_close() {
+    if(snapshot.map != NULL) {
+        munmap(snapshot.map, snapshot.size);
+    }
+    memset(&snapshot, 0, sizeof(snapshot));
+    sort_epoch++;
+}
+
+/* A kiosk may be handed any file, so the header is checked against the
+   file size: the sections must lie in order inside the file and the text
+   must end in a terminator. This stays constant time however large the
+   snapshot; the offsets and runs inside items and child slots are checked
+   where they are read instead. */
+int snapshot_valid(const char* map, size_t size) {
+    const struct snapshot_header_t* header = (const struct snapshot_header_t*)map;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION) return FALSE;
+    if(header->items_offset < sizeof(struct snapshot_header_t) || header->items_offset % 4 != 0
+       || header->items_offset > size || header->items > (size - header->items_offset) / sizeof(struct snapshot_item_t)) return FALSE;
+    uint64_t items_end = header->items_offset + (uint64_t)header->items * sizeof(struct snapshot_item_t);
+    if(header->children_offset < items_end || header->children_offset % 4 != 0
+       || header->strings_offset < header->children_offset || header->strings_offset > size
+       || header->strings_size > size - header->strings_offset) return FALSE;
+    uint64_t slots = (header->strings_offset - header->children_offset) / sizeof(uint32_t);
+    if(slots > UINT32_MAX || (uint64_t)header->root_first + header->root_count > slots) return FALSE;
+    const char* strings = map + header->strings_offset;
+    if(header->strings_size == 0 ? header->items > 0 : strings[header->strings_size - 1] != 0) return FALSE;
+    return TRUE;
+}
+
+// Maps filename if it is a snapshot that holds together
+int snapshot_open(const char* filename) {
+    struct stat info;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return FALSE;
+    if(fstat(fd, &info) != 0 || info.st_size < sizeof(struct snapshot_header_t)) {
+        close(fd);
+        return FALSE;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return FALSE;
+    const struct snapshot_header_t* header = map;
+    if(!snapshot_valid(map, info.st_size)) {
+        munmap(map, info.st_size);
+        return FALSE;
+    }
+    snapshot_close();
+    snapshot.map = map;
+    snapshot.size = info.st_size;
+    snapshot.header = header;
+    snapshot.items = (const struct snapshot_item_t*)((const char*)map + header->items_offset);
+    snapshot.children = (const uint32_t*)((const char*)map + header->children_offset);
+    snapshot.slots = (header->strings_offset - header->children_offset) / sizeof(uint32_t);
+    snapshot.strings = (const char*)map + header->strings_offset;
+    return TRUE;
+}
+
+int snapshot_item_index(struct snapshot_item_t* items, uint32_t count, int id) {
+    int low = 0, high = (int)count - 1;
+    while(low <= high) {
+        int middle = low + (high - low) / 2;
+        if(items[middle].id == id) return middle;
+        if(items[middle].id < id) low = middle + 1; else high = middle - 1;
+    }
+    return -1;
+}
+
+uint32_t snapshot_add_string(char** strings, uint64_t* size, uint64_t* capacity, const char* text) {
+    size_t length = strlen(text) + 1;
+    while(*size + length > *capacity) {
+        *capacity *= 2;
+        *strings = realloc(*strings, *capacity);
+    }
+    memcpy(*strings + *size, text, length);
+    uint32_t offset = *size;
+    *size += length;
+    return offset;
+}
+
+int snapshot_export(const char* source, const char* target) {
+    sqlite3* in;
+    sqlite3_stmt* stmt;
+    int opened = sqlite3_open_v2(source, &in, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK;
+    if(opened) {
+        sqlite3_create_function(in, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+        about_dictionaries_load(in);
+    }
+    if(!opened || sqlite3_prepare_v2(in, "select id,parent,name,invc_about(about),count from item order by id", -1, &stmt, 0) != SQLITE_OK) {
+        fprintf(stderr, "Can't read items from %s: %s\n", source, sqlite3_errmsg(in));
+        sqlite3_close(in);
+        return 1;
+    }
+
+    uint32_t count = 0, capacity = 1024;
+    uint64_t strings_size = 0, strings_capacity = 65536;
+    struct snapshot_item_t* items = malloc(sizeof(struct snapshot_item_t) * capacity);
+    char* strings = malloc(strings_capacity);
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        if(count == capacity) {
+            capacity *= 2;
+            items = realloc(items, sizeof(struct snapshot_item_t) * capacity);
+        }
+        struct snapshot_item_t* item = &items[count++];
+        memset(item, 0, sizeof(struct snapshot_item_t));
+        item->id = sqlite3_column_int(stmt, 0);
+        item->parent = sqlite3_column_int(stmt, 1);
+        item->count = sqlite3_column_int(stmt, 4);
+        item->name = snapshot_add_string(&strings, &strings_size, &strings_capacity, sqlite3_column_text(stmt, 2));
+        if(sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+            item->about = SNAPSHOT_NONE;
+        } else {
+            item->about = snapshot_add_string(&strings, &strings_size, &strings_capacity, sqlite3_column_text(stmt, 3));
+        }
+        if(strings_size >= SNAPSHOT_NONE) {
+            fprintf(stderr, "Too much text for a snapshot.\n");
+            sqlite3_finalize(stmt);
+            sqlite3_close(in);
+            return 1;
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(in);
+
+    /* Count children per parent, hand out runs of the children array, then
+       fill the runs in id order. Orphans whose parent is missing are left
+       out, as they could never be browsed to. */
+    struct snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.items = count;
+    int* parents = malloc(sizeof(int) * (count + 1));
+    uint32_t placed = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        parents[i] = items[i].parent == 0 ? -1 : snapshot_item_index(items, count, items[i].parent);
+        if(parents[i] == -1 && items[i].parent == 0) {
+            header.root_count++;
+            placed++;
+        } else if(parents[i] >= 0) {
+            items[parents[i]].children++;
+            placed++;
+        } else {
+            parents[i] = -2;
+        }
+    }
+    uint32_t next = header.root_count;
+    header.root_first = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        items[i].first_child = next;
+        next += items[i].children;
+    }
+    uint32_t* children = malloc(sizeof(uint32_t) * (placed + 1));
+    uint32_t* fill = malloc(sizeof(uint32_t) * (count + 1));
+    uint32_t root_fill = 0;
+    for(uint32_t i = 0; i < count; i++) fill[i] = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(parents[i] == -1) {
+            children[header.root_first + root_fill++] = i;
+        } else if(parents[i] >= 0) {
+            children[items[parents[i]].first_child + fill[parents[i]]++] = i;
+        }
+    }
+
+    header.items_offset = (sizeof(header) + 7) & ~7;
+    header.children_offset = header.items_offset + sizeof(struct snapshot_item_t) * count;
+    header.strings_offset = (header.children_offset + sizeof(uint32_t) * placed + 7) & ~7;
+    header.strings_size = strings_size;
+
+    /* Kiosks map the target shared, and truncating a mapped file under them
+       would fault their next read; the new snapshot is written beside it
+       and renamed over it, so they keep the old one until they reopen. */
+    int result = 0;
+    char* temporary = malloc(strlen(target) + 5);
+    sprintf(temporary, "%s.tmp", target);
+    FILE* out = fopen(temporary, "wb");
+    if(out == NULL) {
+        fprintf(stderr, "Can't create %s\n", temporary);
+        result = 1;
+    } else {
+        static const char padding[8];
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(padding, header.items_offset - sizeof(header), 1, out);
+        fwrite(items, sizeof(struct snapshot_item_t), count, out);
+        fwrite(children, sizeof(uint32_t), placed, out);
+        fwrite(padding, header.strings_offset - header.children_offset - sizeof(uint32_t) * placed, 1, out);
+        fwrite(strings, 1, strings_size, out);
+        int failed = ferror(out);
+        if(fclose(out) != 0 || failed) {
+            fprintf(stderr, "Can't write %s\n", temporary);
+            unlink(temporary);
+            result = 1;
+        } else if(rename(temporary, target) != 0) {
+            fprintf(stderr, "Can't replace %s\n", target);
+            unlink(temporary);
+            result = 1;
+        } else {
+            printf("%u items, %u reachable, %llu bytes of text\n", count, placed, (unsigned long long)strings_size);
+        }
+    }
+    free(temporary);
+    free(fill);
+    free(children);
+    free(parents);
+    free(strings);
+    free(items);
+    return result;
+}
+
+// Records changes to items and their attributes made on conn
+sqlite3_session* sync_start(sqlite3* conn) {
+    sqlite3_session* session;
+    if(sqlite3session_create(conn, "main", &session) != SQLITE_OK) return NULL;
+    sqlite3session_attach(session, "item");
+    sqlite3session_attach(session, "item_attr");
+    return session;
+}
+
+/* Moves what a session has recorded into sync_log as one changeset, and
+   starts it afresh. origin is the replica the changes were synced from,
+   or -1 for edits made in this copy. */
+int sync_record(sqlite3* conn, sqlite3_session** session, int origin) {
+    sqlite3_stmt* stmt;
+    void* changes = NULL;
+    int size = 0, failed = FALSE;
+    if(*session == NULL || sqlite3session_isempty(*session)) return 0;
+    if(sqlite3session_changeset(*session, &size, &changes) != SQLITE_OK) return 1;
+    if(size > 0) {
+        failed = sqlite3_prepare_v2(conn, "insert into sync_log(stamp, origin, changes) values(strftime('%s','now'), ?1, ?2)", -1, &stmt, 0) != SQLITE_OK;
+        if(!failed) {
+            if(origin >= 0) sqlite3_bind_int(stmt, 1, origin);
+            sqlite3_bind_blob(stmt, 2, changes, size, SQLITE_STATIC);
+            failed = sqlite3_step(stmt) != SQLITE_DONE;
+            sqlite3_finalize(stmt);
+        }
+    }
+    sqlite3_free(changes);
+    sqlite3session_delete(*session);
+    *session = sync_start(conn);
+    return failed;
+}
+
+// Replica number of the copy open on conn; 0 is the master
+int sync_replica(sqlite3* conn) {
+    sqlite3_stmt* stmt;
+    int replica = 0;
+    if(sqlite3_prepare_v2(conn, "select replica from sync_state", -1, &stmt, 0) == SQLITE_OK) {
+        if(sqlite3_step(stmt) == SQLITE_ROW) replica = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return replica;
+}
+
+// Reads one integer; a missing row gives fallback
+sqlite3_int64 sqlite_query_int(sqlite3* conn, const char* sql, int parameter, sqlite3_int64 fallback) {
+    sqlite3_stmt* stmt;
+    sqlite3_int64 value = fallback;
+    if(sqlite3_prepare_v2(conn, sql, -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, parameter);
+        if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) value = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+/* Indexes the items noted as changed by connections without the TEMP
+   trigger, in schema, which is main or an attached site. */
+int trigram_catch_up(sqlite3* conn, const char* schema) {
+    char* sql = sqlite3_mprintf("select exists (select 1 from \"%w\".item_text_pending)", schema);
+    int pending = sqlite_query_int(conn, sql, 0, 0);
+    sqlite3_free(sql);
+    if(!pending) return 0;
+    sql = sqlite3_mprintf("BEGIN;" \
+                          "INSERT INTO \"%w\".item_trigram(item_trigram, rowid, name, about) " \
+                          "SELECT 'delete', id, name, invc_about(about) FROM \"%w\".item_text_pending WHERE old;" \
+                          "INSERT INTO \"%w\".item_trigram(rowid, name, about) SELECT id, name, invc_about(about) FROM \"%w\".item " \
+                          "WHERE id IN (SELECT id FROM \"%w\".item_text_pending);" \
+                          "DELETE FROM \"%w\".item_text_pending;" \
+                          "COMMIT;", schema, schema, schema, schema, schema, schema);
+    int failed = sqlite3_exec(conn, sql, 0, 0, 0) != SQLITE_OK;
+    sqlite3_free(sql);
+    if(failed) sqlite3_exec(conn, "ROLLBACK", 0, 0, 0);
+    return failed;
+}
+
+// Opens a database for the sync commands, with what its triggers call
+sqlite3* sync_open(const char* filename) {
+    sqlite3* conn;
+    if(sqlite3_open_v2(filename, &conn, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return NULL;
+    }
+    sqlite3_busy_timeout(conn, 5000);
+    sqlite3_create_function(conn, "invc_user", 0, SQLITE_UTF8, NULL, database_user, NULL, NULL);
+    sqlite3_create_function(conn, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+    if(sqlite3_exec(conn, SYNC_TABLES SQL_LEDGER_TRIGGERS, 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Can't prepare %s for sync: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return NULL;
+    }
+    about_dictionaries_load(conn);
+    return conn;
+}
+
+/* Makes a new replica of the master. The copy starts with an empty sync
+   log, and both sides note that it already holds everything the master
+   has logged so far. */
+int sync_copy(const char* source, const char* target, int replica) {
+    if(replica <= 0 || replica >= SYNC_REPLICAS) {
+        fprintf(stderr, "Replica numbers run from 1 to %d.\n", SYNC_REPLICAS - 1);
+        return 1;
+    }
+    sqlite3* conn = sync_open(source);
+    if(conn == NULL) return 1;
+    if(sync_replica(conn) != 0) {
+        fprintf(stderr, "Replicas are copied from the master, replica 0.\n");
+        sqlite3_close(conn);
+        return 1;
+    }
+    if(sqlite_query_int(conn, "select 1 from sync_peer where replica=?1", replica, 0)) {
+        fprintf(stderr, "Replica %d already exists.\n", replica);
+        sqlite3_close(conn);
+        return 1;
+    }
+    sqlite3_int64 last = sqlite_query_int(conn, "select max(id) from sync_log", 0, 0);
+    char* sql = sqlite3_mprintf("VACUUM INTO %Q;" \
+                                "INSERT INTO sync_peer(replica, sent, received) VALUES (%d, %lld, 0);", target, replica, last);
+    int failed = sqlite3_exec(conn, sql, 0, 0, 0) != SQLITE_OK;
+    sqlite3_free(sql);
+    if(failed) fprintf(stderr, "Can't copy %s: %s\n", source, sqlite3_errmsg(conn));
+    sqlite3_close(conn);
+    if(failed) return 1;
+
+    if(sqlite3_open_v2(target, &conn, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK) {
+        sql = sqlite3_mprintf("BEGIN;" \
+                              "DELETE FROM sync_log; DELETE FROM sync_peer; DELETE FROM sync_state;" \
+                              "INSERT INTO sync_state(replica) VALUES (%d);" \
+                              "INSERT INTO sync_peer(replica, sent, received) VALUES (0, 0, %lld);" \
+                              "COMMIT;", replica, last);
+        failed = sqlite3_exec(conn, sql, 0, 0, 0) != SQLITE_OK;
+        sqlite3_free(sql);
+    } else {
+        failed = TRUE;
+    }
+    if(failed) fprintf(stderr, "Can't set up %s: %s\n", target, sqlite3_errmsg(conn));
+    sqlite3_close(conn);
+    if(!failed) printf("%s is replica %d; its new items are numbered from %d\n", target, replica, replica * SYNC_BLOCK + 1);
+    return failed;
+}
+
+/* Writes the changes logged since the last export to peer, merged into
+   one changeset, leaving out those that came from peer in the first place.
+   The master is the only peer of a replica, and the hub between them. */
+int sync_export(const char* filename, int peer, const char* target) {
+    sqlite3_stmt* stmt;
+    sqlite3_changegroup* group;
+    sqlite3* conn = sync_open(filename);
+    if(conn == NULL) return 1;
+    struct sync_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYNC_MAGIC, sizeof(header.magic));
+    header.version = SYNC_VERSION;
+    header.replica = sync_replica(conn);
+    int failed = sqlite3_exec(conn, "BEGIN IMMEDIATE", 0, 0, 0) != SQLITE_OK || sqlite3changegroup_new(&group) != SQLITE_OK;
+    if(failed) {
+        fprintf(stderr, "Can't read %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return 1;
+    }
+    header.after = sqlite_query_int(conn, "select sent from sync_peer where replica=?1", peer, 0);
+    header.last = sqlite_query_int(conn, "select max(id) from sync_log", 0, header.after);
+    int entries = 0;
+    if(sqlite3_prepare_v2(conn, "select changes from sync_log where id > ?1 and id <= ?2 and origin is not ?3 order by id", -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, header.after);
+        sqlite3_bind_int64(stmt, 2, header.last);
+        sqlite3_bind_int(stmt, 3, peer);
+        while(!failed && sqlite3_step(stmt) == SQLITE_ROW) {
+            failed = sqlite3changegroup_add(group, sqlite3_column_bytes(stmt, 0), (void*)sqlite3_column_blob(stmt, 0)) != SQLITE_OK;
+            entries++;
+        }
+        sqlite3_finalize(stmt);
+    } else {
+        failed = TRUE;
+    }
+    int size = 0;
+    void* changes = NULL;
+    if(!failed) failed = sqlite3changegroup_output(group, &size, &changes) != SQLITE_OK;
+    sqlite3changegroup_delete(group);
+    header.changes_size = size;
+
+    FILE* out = failed ? NULL : fopen(target, "wb");
+    if(out != NULL) {
+        // The receiver may need the dictionaries to read deflated descriptions
+        header.dictionaries = about_dictionary_count;
+        fwrite(&header, sizeof(header), 1, out);
+        for(int i = 0; i < about_dictionary_count; i++) {
+            uint32_t record[2] = { about_dictionaries[i].id, about_dictionaries[i].size };
+            fwrite(record, sizeof(record), 1, out);
+            fwrite(about_dictionaries[i].data, 1, about_dictionaries[i].size, out);
+        }
+        if(size > 0) fwrite(changes, 1, size, out);
+        failed = fclose(out) != 0;
+    } else {
+        failed = TRUE;
+    }
+    if(!failed) {
+        char* sql = sqlite3_mprintf("INSERT INTO sync_peer(replica, sent, received) VALUES (%d, %lld, 0) " \
+                                    "ON CONFLICT(replica) DO UPDATE SET sent=excluded.sent", peer, header.last);
+        failed = sqlite3_exec(conn, sql, 0, 0, 0) != SQLITE_OK;
+        sqlite3_free(sql);
+    }
+    sqlite3_exec(conn, failed ? "ROLLBACK" : "COMMIT", 0, 0, 0);
+    if(failed) {
+        fprintf(stderr, "Can't write %s\n", target);
+    } else {
+        printf("%d log entries for replica %d in %d bytes\n", entries, peer, size);
+    }
+    sqlite3_free(changes);
+    sqlite3_close(conn);
+    return failed;
+}
+
+// Whether two column values are the same; descriptions compare as text however they are stored
+int sync_equal(sqlite3_value* a, sqlite3_value* b) {
+    int type = sqlite3_value_type(a);
+    if(type == SQLITE_BLOB || sqlite3_value_type(b) == SQLITE_BLOB) {
+        char* text[2];
+        sqlite3_value* values[2] = { a, b };
+        for(int i = 0; i < 2; i++) {
+            if(sqlite3_value_type(values[i]) == SQLITE_BLOB) {
+                text[i] = about_inflate(sqlite3_value_blob(values[i]), sqlite3_value_bytes(values[i]));
+            } else {
+                text[i] = sqlite3_value_type(values[i]) == SQLITE_NULL ? NULL : strdup((const char*)sqlite3_value_text(values[i]));
+            }
+        }
+        int equal = text[0] != NULL && text[1] != NULL ? strcmp(text[0], text[1]) == 0 : text[0] == text[1];
+        free(text[0]);
+        free(text[1]);
+        return equal;
+    }
+    if(type != sqlite3_value_type(b)) return FALSE;
+    if(type == SQLITE_NULL) return TRUE;
+    if(type == SQLITE_INTEGER) return sqlite3_value_int64(a) == sqlite3_value_int64(b);
+    if(type == SQLITE_FLOAT) return sqlite3_value_double(a) == sqlite3_value_double(b);
+    return sqlite3_value_bytes(a) == sqlite3_value_bytes(b) && memcmp(sqlite3_value_text(a), sqlite3_value_text(b), sqlite3_value_bytes(a)) == 0;
+}
+
+/* Settles one value of a row. A value this copy left alone takes the
+   incoming one; when both copies changed it, the lower replica wins, so
+   both copies settle it the same way. */
+sqlite3_value* sync_resolve(sqlite3_value* local, sqlite3_value* old, sqlite3_value* incoming, int incoming_wins, struct sync_report_t* report) {
+    if(incoming == NULL || sync_equal(local, incoming)) return local;
+    if(old != NULL && sync_equal(local, old)) return incoming;
+    report->settled++;
+    return incoming_wins ? incoming : local;
+}
+
+struct sync_t {
+    sqlite3* conn;
+    int incoming_wins;
+    struct sync_report_t report;
+    sqlite3_stmt* item_get;
+    sqlite3_stmt* item_insert;
+    sqlite3_stmt* item_update;
+    sqlite3_stmt* item_delete;
+    sqlite3_stmt* item_inside;
+    sqlite3_stmt* attr_get;
+    sqlite3_stmt* attr_put;
+    sqlite3_stmt* attr_delete;
+};
+
+// Columns of item as changesets carry them
+#define SYNC_ITEM_PARENT  1
+#define SYNC_ITEM_COUNT   4
+#define SYNC_ITEM_COLUMNS 6
+
+/* Counts merge: a count both copies changed gets both changes. A move is
+   refused when it would put the item inside itself, which two copies
+   moving items into each other could otherwise do. */
+void sync_item(struct sync_t* sync, sqlite3_changeset_iter* iter, int op, int columns) {
+    sqlite3_value *id, *old = NULL, *incoming;
+    if(op == SQLITE_INSERT) {
+        for(int c = 0; c < SYNC_ITEM_COLUMNS; c++) {
+            incoming = NULL;
+            if(c < columns) sqlite3changeset_new(iter, c, &incoming);
+            if(incoming != NULL) sqlite3_bind_value(sync->item_insert, c + 1, incoming); else sqlite3_bind_null(sync->item_insert, c + 1);
+        }
+        if(sqlite_write(sync->item_insert) == 0 && sqlite3_changes(sync->conn) > 0) sync->report.added++;
+        return;
+    }
+    sqlite3changeset_old(iter, 0, &id);
+    if(op == SQLITE_DELETE) {
+        // A deletion wins over changes this copy made to the item
+        sqlite3_bind_value(sync->item_delete, 1, id);
+        if(sqlite_write(sync->item_delete) == 0 && sqlite3_changes(sync->conn) > 0) sync->report.deleted++; else sync->report.skipped++;
+        return;
+    }
+    sqlite3_bind_value(sync->item_get, 1, id);
+    if(sqlite3_step(sync->item_get) != SQLITE_ROW) {
+        sqlite3_reset(sync->item_get);
+        sync->report.skipped++;
+        return;
+    }
+    sqlite3_bind_value(sync->item_update, 1, id);
+    for(int c = 1; c < SYNC_ITEM_COLUMNS; c++) {
+        sqlite3_value* local = sqlite3_column_value(sync->item_get, c - 1);
+        incoming = NULL;
+        if(c < columns) sqlite3changeset_new(iter, c, &incoming);
+        if(incoming != NULL) sqlite3changeset_old(iter, c, &old);
+        if(c == SYNC_ITEM_COUNT && incoming != NULL && !sync_equal(local, old)) {
+            sqlite3_bind_int64(sync->item_update, c + 1, sqlite3_value_int64(local) + sqlite3_value_int64(incoming) - sqlite3_value_int64(old));
+            sync->report.counts++;
+            continue;
+        }
+        sqlite3_value* value = sync_resolve(local, old, incoming, sync->incoming_wins, &sync->report);
+        if(c == SYNC_ITEM_PARENT && value == incoming && sqlite3_value_type(incoming) != SQLITE_NULL) {
+            sqlite3_bind_value(sync->item_inside, 1, id);
+            sqlite3_bind_value(sync->item_inside, 2, incoming);
+            if(sqlite3_step(sync->item_inside) == SQLITE_ROW) {
+                value = local;
+                sync->report.refused++;
+            }
+            sqlite3_reset(sync->item_inside);
+        }
+        sqlite3_bind_value(sync->item_update, c + 1, value);
+    }
+    sqlite3_reset(sync->item_get);
+    if(sqlite_write(sync->item_update) == 0) sync->report.changed++;
+}
+
+// Attributes follow the same rules; an attribute of a deleted item is skipped
+void sync_attr(struct sync_t* sync, sqlite3_changeset_iter* iter, int op) {
+    sqlite3_value *item, *key, *old = NULL, *incoming = NULL;
+    if(op == SQLITE_INSERT) {
+        sqlite3changeset_new(iter, 0, &item);
+        sqlite3changeset_new(iter, 1, &key);
+    } else {
+        sqlite3changeset_old(iter, 0, &item);
+        sqlite3changeset_old(iter, 1, &key);
+    }
+    if(op == SQLITE_DELETE) {
+        sqlite3_bind_value(sync->attr_delete, 1, item);
+        sqlite3_bind_value(sync->attr_delete, 2, key);
+        if(sqlite_write(sync->attr_delete) == 0 && sqlite3_changes(sync->conn) > 0) sync->report.attributes++;
+        return;
+    }
+    sqlite3changeset_new(iter, 2, &incoming);
+    if(op == SQLITE_UPDATE) sqlite3changeset_old(iter, 2, &old);
+    sqlite3_bind_value(sync->attr_get, 1, item);
+    sqlite3_bind_value(sync->attr_get, 2, key);
+    int found = sqlite3_step(sync->attr_get) == SQLITE_ROW;
+    sqlite3_value* value = incoming;
+    if(found) {
+        sqlite3_value* local = sqlite3_column_value(sync->attr_get, 0);
+        // An attribute both copies added has no common old value to compare with
+        value = sync_resolve(local, op == SQLITE_UPDATE ? old : NULL, incoming, sync->incoming_wins, &sync->report);
+        if(value == local) value = NULL;
+    } else if(op == SQLITE_UPDATE) {
+        // This copy removed the attribute, and the removal wins
+        value = NULL;
+        sync->report.skipped++;
+    }
+    if(value != NULL) {
+        sqlite3_bind_value(sync->attr_put, 1, item);
+        sqlite3_bind_value(sync->attr_put, 2, key);
+        sqlite3_bind_value(sync->attr_put, 3, value);
+    }
+    sqlite3_reset(sync->attr_get);
+    if(value != NULL) {
+        if(sqlite_write(sync->attr_put) == 0 && sqlite3_changes(sync->conn) > 0) sync->report.attributes++; else sync->report.skipped++;
+    }
+}
+
+/* Applies a file from sync_export. The changes are applied row by row
+   rather than with sqlite3changeset_apply, so that both copies settle
+   conflicts the same way, and are logged again here so that the master
+   passes them on to its other replicas. */
+int sync_apply(const char* filename, const char* source) {
+    struct sync_header_t header;
+    FILE* in = fopen(source, "rb");
+    if(in == NULL) {
+        fprintf(stderr, "Can't open %s\n", source);
+        return 1;
+    }
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, SYNC_MAGIC, sizeof(header.magic)) != 0 || header.version != SYNC_VERSION) {
+        fprintf(stderr, "%s is not an inventory sync file.\n", source);
+        fclose(in);
+        return 1;
+    }
+    sqlite3* conn = sync_open(filename);
+    if(conn == NULL) {
+        fclose(in);
+        return 1;
+    }
+    int replica = sync_replica(conn);
+    sqlite3_int64 received = sqlite_query_int(conn, "select received from sync_peer where replica=?1", header.replica, 0);
+    int failed = FALSE;
+    if(header.replica == (uint32_t)replica) {
+        fprintf(stderr, "%s came from this copy, replica %d.\n", source, replica);
+        failed = TRUE;
+    } else if(header.last <= received) {
+        printf("%s is already applied.\n", source);
+        fclose(in);
+        sqlite3_close(conn);
+        return 0;
+    } else if(header.after > received) {
+        fprintf(stderr, "Warning: changes of replica %u before this file were never applied here.\n", header.replica);
+    }
+    if(!failed) failed = sqlite3_exec(conn, "BEGIN IMMEDIATE", 0, 0, 0) != SQLITE_OK;
+
+    sqlite3_stmt* stmt = NULL;
+    if(!failed) failed = sqlite3_prepare_v2(conn, "insert or ignore into about_dictionary(id, data, trained) values(?1, ?2, strftime('%s','now'))", -1, &stmt, 0) != SQLITE_OK;
+    for(uint32_t i = 0; !failed && i < header.dictionaries; i++) {
+        uint32_t record[2];
+        failed = fread(record, sizeof(record), 1, in) != 1;
+        unsigned char* data = failed ? NULL : malloc(record[1] + 1);
+        if(data != NULL) {
+            failed = fread(data, 1, record[1], in) != record[1];
+            sqlite3_bind_int64(stmt, 1, record[0]);
+            sqlite3_bind_blob(stmt, 2, data, record[1], SQLITE_STATIC);
+            if(!failed) failed = sqlite_write(stmt) != 0;
+            free(data);
+        }
+    }
+    sqlite3_finalize(stmt);
+    about_dictionaries_load(conn);
+
+    void* changes = failed ? NULL : malloc(header.changes_size + 1);
+    if(changes != NULL) failed = fread(changes, 1, header.changes_size, in) != header.changes_size;
+    fclose(in);
+
+    struct sync_t sync;
+    memset(&sync, 0, sizeof(sync));
+    sync.conn = conn;
+    sync.incoming_wins = (int)header.replica < replica;
+    sqlite3_stmt** statements[] = { &sync.item_get, &sync.item_insert, &sync.item_update, &sync.item_delete,
+                                    &sync.item_inside, &sync.attr_get, &sync.attr_put, &sync.attr_delete };
+    const char* sql[] = {
+        "select parent,name,about,count,threshold from item where id=?1",
+        "insert or ignore into item(id,parent,name,about,count,threshold) values(?1,?2,?3,?4,?5,?6)",
+        "update item set parent=?2,name=?3,about=?4,count=?5,threshold=?6 where id=?1",
+        "delete from item where id=?1",
+        "with recursive up(id) as (select ?2 union select item.parent from item join up on item.id=up.id where item.parent is not null) " \
+        "select 1 from up where id=?1",
+        "select value from item_attr where item=?1 and key=?2",
+        "insert into item_attr(item,key,value) select ?1,?2,?3 where exists (select 1 from item where id=?1) " \
+        "on conflict(item,key) do update set value=excluded.value",
+        "delete from item_attr where item=?1 and key=?2"
+    };
+    for(int i = 0; !failed && i < (int)(sizeof(statements) / sizeof(statements[0])); i++) {
+        failed = sqlite3_prepare_v2(conn, sql[i], -1, statements[i], 0) != SQLITE_OK;
+    }
+
+    sqlite3_session* session = failed ? NULL : sync_start(conn);
+    sqlite3_changeset_iter* iter;
+    if(session != NULL && header.changes_size > 0 && sqlite3changeset_start(&iter, header.changes_size, changes) == SQLITE_OK) {
+        const char* table;
+        int columns, op, indirect;
+        while(sqlite3changeset_next(iter) == SQLITE_ROW) {
+            sqlite3changeset_op(iter, &table, &columns, &op, &indirect);
+            if(strcmp(table, "item") == 0) sync_item(&sync, iter, op, columns);
+            else if(strcmp(table, "item_attr") == 0 && columns >= 3) sync_attr(&sync, iter, op);
+        }
+        failed = sqlite3changeset_finalize(iter) != SQLITE_OK;
+    } else if(header.changes_size > 0) {
+        failed = TRUE;
+    }
+    free(changes);
+    for(int i = 0; i < (int)(sizeof(statements) / sizeof(statements[0])); i++) sqlite3_finalize(*statements[i]);
+
+    if(!failed) failed = sync_record(conn, &session, header.replica) != 0;
+    if(session != NULL) sqlite3session_delete(session);
+    if(!failed) {
+        char* update = sqlite3_mprintf("INSERT INTO sync_peer(replica, sent, received) VALUES (%u, 0, %lld) " \
+                                       "ON CONFLICT(replica) DO UPDATE SET received=excluded.received", header.replica, header.last);
+        failed = sqlite3_exec(conn, update, 0, 0, 0) != SQLITE_OK;
+        sqlite3_free(update);
+    }
+    if(failed) {
+        fprintf(stderr, "Can't apply %s: %s\n", source, sqlite3_errmsg(conn));
+        sqlite3_exec(conn, "ROLLBACK", 0, 0, 0);
+    } else {
+        sqlite3_exec(conn, "COMMIT", 0, 0, 0);
+        printf("Replica %u: %d added, %d changed, %d deleted, %d attributes; %d counts merged, %d conflicts settled, %d moves refused, %d skipped\n",
+               header.replica, sync.report.added, sync.report.changed, sync.report.deleted, sync.report.attributes,
+               sync.report.counts, sync.report.settled, sync.report.refused, sync.report.skipped);
+    }
+    about_dictionaries_free();
+    sqlite3_close(conn);
+    return failed;
+}
+
+int id_list_position(struct id_list_t* list, int id) {
+    int low = 0, high = list->count;
+    while(low < high) {
+        int middle = low + (high - low) / 2;
+        if(list->ids[middle] < id) low = middle + 1; else high = middle;
+    }
+    return low;
+}
+
+int id_list_contains(struct id_list_t* list, int id) {
+    int position = id_list_position(list, id);
+    return position < list->count && list->ids[position] == id;
+}
+
+void id_list_insert(struct id_list_t* list, int id) {
+    int position = id_list_position(list, id);
+    if(list->count >= list->capacity) {
+        int capacity = list->count < 2 ? 4 : list->count * 2;
+        int* ids = malloc(sizeof(int) * capacity);
+        if(list->count > 0) memcpy(ids, list->ids, sizeof(int) * list->count);
+        if(list->capacity > 0) free(list->ids);
+        list->ids = ids;
+        list->capacity = capacity;
+    }
+    memmove(&list->ids[position + 1], &list->ids[position], sizeof(int) * (list->count - position));
+    list->ids[position] = id;
+    list->count++;
+}
+
+void id_list_remove(struct id_list_t* list, int id) {
+    int position = id_list_position(list, id);
+    if(position < list->count && list->ids[position] == id) {
+        memmove(&list->ids[position], &list->ids[position + 1], sizeof(int) * (list->count - position - 1));
+        list->count--;
+    }
+}
+
+void id_list_free(struct id_list_t* list) {
+    if(list->capacity > 0) free(list->ids);
+    memset(list, 0, sizeof(struct id_list_t));
+}
+
+unsigned intern_hash(const char* text) {
+    unsigned hash = 2166136261u;
+    while(*text) {
+        hash = (hash ^ (unsigned char)*text++) * 16777619u;
+    }
+    return hash;
+}
+
+void intern_place(struct intern_t* pool, const char* text) {
+    unsigned mask = pool->capacity - 1;
+    unsigned slot = intern_hash(text) & mask;
+    while(pool->slots[slot] != NULL) slot = (slot + 1) & mask;
+    pool->slots[slot] = text;
+}
+
+// Returns the pooled copy of text, so equal names and descriptions share storage
+const char* intern(struct intern_t* pool, const char* text) {
+    if(text == NULL) return NULL;
+    if((pool->count + 1) * 2 > pool->capacity) {
+        const char** slots = pool->slots;
+        int capacity = pool->capacity;
+        pool->capacity = capacity == 0 ? 1024 : capacity * 2;
+        pool->slots = calloc(pool->capacity, sizeof(const char*));
+        for(int i = 0; i < capacity; i++) {
+            if(slots[i] != NULL) intern_place(pool, slots[i]);
+        }
+        free(slots);
+    }
+    unsigned mask = pool->capacity - 1;
+    unsigned slot = intern_hash(text) & mask;
+    while(pool->slots[slot] != NULL) {
+        if(strcmp(pool->slots[slot], text) == 0) return pool->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+    pool->slots[slot] = arena_copy(&pool->text, text, strlen(text));
+    pool->count++;
+    return pool->slots[slot];
+}
+
+void intern_free(struct intern_t* pool) {
+    free(pool->slots);
+    arena_free(&pool->text);
+    memset(pool, 0, sizeof(struct intern_t));
+}
+
+int memory_index(int id) {
+    int low = 0, high = memory.count - 1;
+    while(low <= high) {
+        int middle = low + (high - low) / 2;
+        if(memory.items[middle].id == id) return middle;
+        if(memory.items[middle].id < id) low = middle + 1; else high = middle - 1;
+    }
+    return -1;
+}
+
+struct memory_item_t* memory_find(int id) {
+    int index = memory_index(id);
+    return index < 0 || memory.items[index].removed ? NULL : &memory.items[index];
+}
+
+// The child list an item under parent belongs in, NULL if parent is gone
+struct id_list_t* memory_children_of(int parent) {
+    if(parent == 0) return &memory.roots;
+    struct memory_item_t* item = memory_find(parent);
+    return item != NULL ? &item->children : NULL;
+}
+
+void memory_link(struct memory_item_t* item) {
+    struct id_list_t* siblings = memory_children_of(item->parent);
+    if(siblings != NULL) id_list_insert(siblings, item->id);
+}
+
+void memory_unlink(struct memory_item_t* item) {
+    struct id_list_t* siblings = memory_children_of(item->parent);
+    if(siblings != NULL) id_list_remove(siblings, item->id);
+}
+
+// Adds an item without linking it; ids normally arrive in increasing order
+struct memory_item_t* memory_add(int id, int parent, const char* name, const char* about, int count) {
+    if(memory.count == memory.capacity) {
+        memory.capacity = memory.capacity == 0 ? 1024 : memory.capacity * 2;
+        memory.items = realloc(memory.items, sizeof(struct memory_item_t) * memory.capacity);
+    }
+    int position = memory.count;
+    if(position > 0 && memory.items[position - 1].id > id) {
+        while(position > 0 && memory.items[position - 1].id > id) position--;
+        memmove(&memory.items[position + 1], &memory.items[position], sizeof(struct memory_item_t) * (memory.count - position));
+    }
+    struct memory_item_t* item = &memory.items[position];
+    memset(item, 0, sizeof(struct memory_item_t));
+    item->id = id;
+    item->parent = parent;
+    item->count = count;
+    item->name = intern(&memory.strings, name != NULL ? name : "");
+    item->about = intern(&memory.strings, about);
+    memory.count++;
+    memory.live++;
+    return item;
+}
+
+void memory_clear() {
+    for(int i = 0; i < memory.count; i++) {
+        id_list_free(&memory.items[i].children);
+    }
+    for(int i = 0; i < ARRLEN(memory.columns); i++) {
+        free(memory.columns[i].text);
+        free(memory.columns[i].starts);
+    }
+    free(memory.hits.query);
+    free(memory.hits.items);
+    id_list_free(&memory.roots);
+    intern_free(&memory.strings);
+    free(memory.items);
+    free(memory.adjacency);
+    memset(&memory, 0, sizeof(memory));
+    sort_epoch++;
+}
+
+double clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/* Every key invc reads comes through input_key(). With --record the keys
+   are written to a file, one "milliseconds code" line each, the time being
+   how long after the key before it this one came. With --trace the count
+   of keys read so far is written to a file descriptor each time invc waits
+   for the next one with the screen up to date; the replay harness takes
+   that as the end of the previous key's work. */
+struct input_t {
+    FILE* record;
+    int trace;
+    int keys;
+    int traced;
+    double last_ms;
+};
+
+struct input_t input = { NULL, -1, 0, -1, 0 };
+
+int input_key() {
+    if(input.trace >= 0 && input.traced != input.keys) {
+        // getch() would bring stdscr up to date first; do it before saying so
+        if(is_wintouched(stdscr)) wrefresh(stdscr);
+        dprintf(input.trace, "%d\n", input.keys);
+        input.traced = input.keys;
+    }
+    int ch = getch();
+    if(ch == ERR) return ch;
+    input.keys++;
+    if(input.record != NULL) {
+        double now = clock_ms();
+        fprintf(input.record, "%.0f %d\n", input.last_ms > 0 ? now - input.last_ms : 0, ch);
+        fflush(input.record);
+        input.last_ms = now;
+    }
+    return ch;
+}
+
+/* Reads a line of at most length characters into buf at y, x of win,
+   showing its tail when it is wider than the window. Backspace and Left
+   erase, ^U clears the line, other special keys are ignored. */
+int input_string(WINDOW* win, int y, int x, char* buf, int length) {
+    int used = 0, ch;
+    int visible = getmaxx(win) - 1 - x;
+    buf[0] = 0;
+    while(TRUE) {
+        int start = used > visible - 1 ? used - (visible - 1) : 0;
+        mvwhline(win, y, x, ' ', visible);
+        mvwaddstr(win, y, x, buf + start);
+        wrefresh(win);
+        ch = input_key();
+        if(ch == '\n' || ch == '\r' || ch == KEY_ENTER) break;
+        if((ch == KEY_BACKSPACE || ch == KEY_LEFT || ch == 127 || ch == 8) && used > 0) {
+            buf[--used] = 0;
+        } else if(ch == 21) {
+            used = 0;
+            buf[0] = 0;
+        } else if(ch >= ' ' && ch < 127 && used < length) {
+            buf[used++] = ch;
+            buf[used] = 0;
+        }
+    }
+    return used;
+}
+
+/* Loads every item of source in one pass. Rows arrive in id order, so the
+   item array is appended to and every child list comes out sorted; all of
+   them are slices of a single adjacency array. */
+int memory_load(sqlite3* source) {
+    sqlite3_stmt* stmt;
+    double started = clock_ms();
+    memory_clear();
+    if(sqlite3_prepare_v2(source, "select count(*) from item", -1, &stmt, 0) != SQLITE_OK) {
+        return 1;
+    }
+    if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0) {
+        memory.capacity = sqlite3_column_int(stmt, 0);
+        memory.items = malloc(sizeof(struct memory_item_t) * memory.capacity);
+    }
+    sqlite3_finalize(stmt);
+    if(sqlite3_prepare_v2(source, "select id,parent,name,invc_about(about),count from item order by id", -1, &stmt, 0) != SQLITE_OK) {
+        return 1;
+    }
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        memory_add(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_text(stmt, 2),
+                   sqlite3_column_text(stmt, 3), sqlite3_column_int(stmt, 4));
+    }
+    sqlite3_finalize(stmt);
+
+    // Count children first, then hand out slices and fill them in id order
+    int placed = 0;
+    for(int i = 0; i < memory.count; i++) {
+        struct id_list_t* siblings = memory_children_of(memory.items[i].parent);
+        if(siblings != NULL) {
+            siblings->count++;
+            placed++;
+        }
+    }
+    memory.adjacency = malloc(sizeof(int) * (placed > 0 ? placed : 1));
+    int next = 0;
+    memory.roots.ids = memory.adjacency;
+    next += memory.roots.count;
+    memory.roots.count = 0;
+    for(int i = 0; i < memory.count; i++) {
+        struct id_list_t* children = &memory.items[i].children;
+        children->ids = memory.adjacency + next;
+        next += children->count;
+        children->count = 0;
+    }
+    for(int i = 0; i < memory.count; i++) {
+        struct id_list_t* siblings = memory_children_of(memory.items[i].parent);
+        if(siblings != NULL) siblings->ids[siblings->count++] = memory.items[i].id;
+    }
+    memory.load_ms = clock_ms() - started;
+    return 0;
+}
+
+void memory_entry(struct memory_item_t* item, struct entry_t* entry, struct arena_t* arena) {
+    entry->id = item->id;
+    entry->parent = item->parent;
+    entry->name = arena_copy(arena, item->name, strlen(item->name));
+    entry->snippet = NULL;
+    entry->site = 0;
+    entry->count = item->count;
+}
+
+int memory_count_children(struct reader_t* reader, int parent) {
+    struct id_list_t* children = memory_children_of(parent);
+    return children != NULL ? children->count : 0;
+}
+
+/* Child ids of parent ascending on the field of sort: the child list
+   itself for id order, else the reader's sorted copy. NULL if parent is gone. */
+const int* memory_order(struct reader_t* reader, int parent, int sort, int* count) {
+    struct id_list_t* children = memory_children_of(parent);
+    if(children == NULL) return NULL;
+    *count = children->count;
+    if(SORT_FIELD(sort) == SORT_ID || reader == NULL) return children->ids;
+    // The tree changes under a session, so its generation is part of the key
+    long long epoch = sort_epoch * ((long long)1 << 32) + memory.generation;
+    if(!sorted_fresh(&reader->sorted, parent, SORT_FIELD(sort), epoch)) {
+        struct sort_key_t* keys = malloc(sizeof(struct sort_key_t) * (children->count + 1));
+        for(int i = 0; i < children->count; i++) {
+            struct memory_item_t* item = memory_find(children->ids[i]);
+            keys[i].name = item->name;
+            keys[i].count = item->count;
+            keys[i].id = item->id;
+            keys[i].ref = item->id;
+        }
+        sorted_fill(&reader->sorted, keys, children->count, parent, SORT_FIELD(sort), epoch);
+        free(keys);
+    }
+    return reader->sorted.refs;
+}
+
+int memory_children(struct reader_t* reader, int parent, int sort, const struct seek_t* seek, int limit, struct entry_t* entries, struct arena_t* arena) {
+    int count, i;
+    const int* order = memory_order(reader, parent, sort, &count);
+    if(order == NULL) return 0;
+    for(i = 0; i < limit && seek->offset + i < count; i++) {
+        memory_entry(memory_find(order[sorted_position(sort, count, seek->offset + i)]), &entries[i], arena);
+    }
+    return i;
+}
+
+int memory_locate(struct reader_t* reader, int parent, int sort, const char* prefix) {
+    int count;
+    const int* order = memory_order(reader, parent, sort, &count);
+    size_t length = strlen(prefix);
+    for(int i = 0; order != NULL && i < count; i++) {
+        if(strncmp(memory_find(order[sorted_position(sort, count, i)])->name, prefix, length) == 0) return i;
+    }
+    return -1;
+}
+
+int memory_get(int id, struct entry_t* entry, struct arena_t* arena) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL) return FALSE;
+    memory_entry(item, entry, arena);
+    return TRUE;
+}
+
+// Rebuilds the packed column of a field once items changed since the last search
+struct memory_column_t* memory_column(int type) {
+    struct memory_column_t* column = &memory.columns[type];
+    if(column->text != NULL && column->generation == memory.generation) return column;
+    size_t size = 0;
+    for(int i = 0; i < memory.count; i++) {
+        const char* text = type == BY_ABOUT ? memory.items[i].about : memory.items[i].name;
+        if(!memory.items[i].removed && text != NULL) size += strlen(text);
+        size++;
+    }
+    free(column->text);
+    free(column->starts);
+    column->text = malloc(size + 1);
+    column->starts = malloc(sizeof(size_t) * (memory.count + 1));
+    size = 0;
+    for(int i = 0; i < memory.count; i++) {
+        const char* text = type == BY_ABOUT ? memory.items[i].about : memory.items[i].name;
+        column->starts[i] = size;
+        if(!memory.items[i].removed && text != NULL) {
+            while(*text) column->text[size++] = tolower((unsigned char)*text++);
+        }
+        column->text[size++] = 0;
+    }
+    column->starts[memory.count] = size;
+    column->generation = memory.generation;
+    return column;
+}
+
+/* memmem for a lowercased needle. With SSE2 sixteen positions are tested at
+   once against the first and last byte of the needle and only the
+   survivors are compared in full. */
+const char* find_needle(const char* haystack, size_t length, const char* needle, size_t needle_length) {
+    if(needle_length > length) return NULL;
+#ifdef __SSE2__
+    if(needle_length > 1) {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+        size_t i = 0;
+        for(; i + needle_length - 1 + 16 <= length; i += 16) {
+            __m128i head = _mm_loadu_si128((const __m128i*)(haystack + i));
+            __m128i tail = _mm_loadu_si128((const __m128i*)(haystack + i + needle_length - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+            while(mask != 0) {
+                int bit = __builtin_ctz(mask);
+                if(memcmp(haystack + i + bit + 1, needle + 1, needle_length - 2) == 0) return haystack + i + bit;
+                mask &= mask - 1;
+            }
+        }
+        return memmem(haystack + i, length - i, needle, needle_length);
+    }
+#endif
+    return memmem(haystack, length, needle, needle_length);
+}
+
+struct search_job_t {
+    pthread_t thread;
+    int threaded;
+    int type;
+    const char* pattern;
+    const char* needle;
+    size_t needle_length;
+    int exact;
+    const struct memory_column_t* column;
+    int first;
+    int last;
+    int* items;
+    int* distances;
+    int count;
+};
+
+// Fuzzy slices measure every live item against the query
+void memory_fuzzy_slice(struct search_job_t* job) {
+    int limit = fuzzy_limit(job->pattern);
+    job->distances = malloc(sizeof(int) * (job->last - job->first + 1));
+    for(int i = job->first; i < job->last; i++) {
+        if(memory.items[i].removed) continue;
+        int distance = fuzzy_distance(job->pattern, memory.items[i].name);
+        if(distance <= limit) {
+            job->distances[job->count] = distance;
+            job->items[job->count++] = i;
+        }
+    }
+}
+
+/* Matches the items of one slice. The longest literal run of the pattern is
+   looked up in the column; the items it lands in are checked against the
+   whole pattern unless the pattern was just that run between wildcards. */
+void* memory_search_slice(void* argument) {
+    struct search_job_t* job = argument;
+    job->items = malloc(sizeof(int) * (job->last - job->first + 1));
+    job->distances = NULL;
+    job->count = 0;
+    if(job->type == BY_FUZZY) {
+        memory_fuzzy_slice(job);
+        return NULL;
+    }
+    const size_t* starts = job->column->starts;
+    for(int i = job->first; i < job->last; ) {
+        if(job->needle_length > 0) {
+            const char* found = find_needle(job->column->text + starts[i], starts[job->last] - starts[i], job->needle, job->needle_length);
+            if(found == NULL) break;
+            size_t offset = found - job->column->text;
+            while(starts[i + 1] <= offset) i++;
+        }
+        struct memory_item_t* item = &memory.items[i];
+        if(!item->removed && (job->exact || like_match(job->pattern, job->type == BY_ABOUT ? item->about : item->name))) {
+            job->items[job->count++] = i;
+        }
+        i++;
+    }
+    return NULL;
+}
+
+// Attributes stay in the database; its matches are mapped onto live items
+void memory_attr_hits(struct memory_hits_t* hits, const char* query) {
+    free(hits->query);
+    free(hits->items);
+    hits->query = NULL;
+    hits->items = NULL;
+    hits->count = 0;
+    sqlite3_stmt* stmt = attr_prepare(db, "select item from (%s) order by item", query);
+    int capacity = 0;
+    while(stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW) {
+        int index = memory_index(sqlite3_column_int(stmt, 0));
+        if(index < 0 || memory.items[index].removed) continue;
+        if(hits->count == capacity) {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            hits->items = realloc(hits->items, sizeof(int) * capacity);
+        }
+        hits->items[hits->count++] = index;
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Splits the items into slices searched side by side; results stay in id order
+struct memory_hits_t* memory_hits(int type, const char* query) {
+    struct memory_hits_t* hits = &memory.hits;
+    if(hits->query != NULL && hits->type == type && hits->generation == memory.generation && strcmp(hits->query, query) == 0) {
+        return hits;
+    }
+    double started = clock_ms();
+    if(type == BY_ATTR) {
+        memory_attr_hits(hits, query);
+        hits->type = type;
+        hits->query = strdup(query);
+        hits->generation = memory.generation;
+        memory.search_ms = clock_ms() - started;
+        return hits;
+    }
+    const struct memory_column_t* column = type == BY_FUZZY ? NULL : memory_column(type);
+
+    // Longest run without wildcards, lowercased like the column
+    size_t length = strlen(query), best;
+    size_t best_length = like_needle(query, &best);
+    char* needle = malloc(best_length + 1);
+    for(size_t i = 0; i < best_length; i++) needle[i] = tolower((unsigned char)query[best + i]);
+    needle[best_length] = 0;
+    // A plain %text% needs no second look at the matched items
+    int exact = best_length > 0 && best > 0 && best + best_length < length;
+    for(size_t i = 0; i < length && exact; i++) {
+        if(i < best || i >= best + best_length) exact = query[i] == '%';
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = memory.count / SEARCH_SLICE + 1;
+    if(threads > cores) threads = cores;
+    if(threads > SEARCH_THREADS) threads = SEARCH_THREADS;
+    if(threads < 1) threads = 1;
+    struct search_job_t jobs[SEARCH_THREADS];
+    for(int t = 0; t < threads; t++) {
+        jobs[t].type = type;
+        jobs[t].pattern = query;
+        jobs[t].needle = needle;
+        jobs[t].needle_length = best_length;
+        jobs[t].exact = exact;
+        jobs[t].column = column;
+        jobs[t].first = (int)((long long)memory.count * t / threads);
+        jobs[t].last = (int)((long long)memory.count * (t + 1) / threads);
+        jobs[t].threaded = t > 0 && pthread_create(&jobs[t].thread, NULL, memory_search_slice, &jobs[t]) == 0;
+        if(t > 0 && !jobs[t].threaded) memory_search_slice(&jobs[t]);
+    }
+    memory_search_slice(&jobs[0]);
+
+    free(hits->query);
+    free(hits->items);
+    hits->count = 0;
+    for(int t = 0; t < threads; t++) {
+        if(jobs[t].threaded) pthread_join(jobs[t].thread, NULL);
+        hits->count += jobs[t].count;
+    }
+    hits->items = malloc(sizeof(int) * (hits->count + 1));
+    hits->count = 0;
+    struct fuzzy_hit_t* ranked = type == BY_FUZZY ? malloc(sizeof(struct fuzzy_hit_t) * (hits->count + 1)) : NULL;
+    for(int t = 0; t < threads; t++) {
+        for(int i = 0; ranked != NULL && i < jobs[t].count; i++) {
+            ranked[hits->count + i].distance = jobs[t].distances[i];
+            ranked[hits->count + i].index = jobs[t].items[i];
+        }
+        memcpy(hits->items + hits->count, jobs[t].items, sizeof(int) * jobs[t].count);
+        hits->count += jobs[t].count;
+        free(jobs[t].items);
+        free(jobs[t].distances);
+    }
+    if(ranked != NULL) {
+        qsort(ranked, hits->count, sizeof(struct fuzzy_hit_t), fuzzy_compare);
+        for(int i = 0; i < hits->count; i++) hits->items[i] = ranked[i].index;
+        free(ranked);
+    }
+    free(needle);
+    hits->type = type;
+    hits->query = strdup(query);
+    hits->generation = memory.generation;
+    memory.search_threads = threads;
+    memory.search_ms = clock_ms() - started;
+    return hits;
+}
+
+int memory_search_count(struct reader_t* reader, int type, const char* query) {
+    return memory_hits(type, query)->count;
+}
+
+int memory_search(struct reader_t* reader, int type, const char* query, int offset, int limit, struct entry_t* entries, struct arena_t* arena) {
+    struct memory_hits_t* hits = memory_hits(type, query);
+    int i;
+    for(i = 0; i < limit && offset + i < hits->count; i++) {
+        struct memory_item_t* item = &memory.items[hits->items[offset + i]];
+        memory_entry(item, &entries[i], arena);
+        if(type == BY_ABOUT) entry_snippet(&entries[i], item->about, query, arena);
+    }
+    return i;
+}
+
+struct path_t* memory_path(int id) {
+    struct path_t* path = NULL;
+    struct memory_item_t* item = memory_find(id);
+    // A parent cycle can hold no more steps than there are items
+    for(int steps = 0; item != NULL && steps < memory.count; steps++) {
+        path = path_push(path, item->id, item->name);
+        item = item->parent != 0 ? memory_find(item->parent) : NULL;
+    }
+    return path;
+}
+
+char* memory_description(int id) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL || item->about == NULL) return NULL;
+    return strdup(item->about);
+}
+
+int sqlite_insert_id(int id, int parent, const char* name, const char* about, int count);
+
+// Replays the queued changes against the database in one transaction
+int memory_flush() {
+    if(write_queue.count == 0 || db == NULL) return 0;
+    double started = clock_ms();
+    int failed = sqlite3_exec(db, "BEGIN", 0, 0, 0) != SQLITE_OK;
+    for(int i = 0; i < write_queue.count && !failed; i++) {
+        struct write_op_t* op = &write_queue.ops[i];
+        switch(op->type) {
+        case WRITE_INSERT:
+            failed = sqlite_insert_id(op->id, op->parent, op->name, op->about, op->count) == 0;
+            break;
+        case WRITE_REPARENT:
+            failed = sqlite_store.reparent(&op->id, 1, op->parent) != 0;
+            break;
+        case WRITE_REMOVE:
+            failed = sqlite_store.remove(op->id) != 0;
+            break;
+        case WRITE_RENAME:
+            failed = sqlite_store.rename(op->id, op->name) != 0;
+            break;
+        case WRITE_COUNT:
+            failed = sqlite_store.set_count(op->id, op->count) != 0;
+            break;
+        case WRITE_DESCRIBE:
+            failed = sqlite_store.describe(op->id, op->about) != 0;
+            break;
+        }
+    }
+    if(!failed) failed = sqlite3_exec(db, "COMMIT", 0, 0, 0) != SQLITE_OK;
+    int lost = failed ? write_queue.count : 0;
+    if(failed) sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+    write_queue.flushed += write_queue.count - lost;
+    write_queue.batches++;
+    write_queue.count = 0;
+    write_queue.last_batch_ms = clock_ms() - started;
+    if(lost > 0) {
+        /* The tree still holds the edits the file refused, and later edits
+           may build on them, so it is loaded again to match the file. This
+           frees every item, which is why flushes wait for a command to end. */
+        memory_load(db);
+        show_modal_error("Could not write changes back to the database; they were undone.");
+        return 1;
+    }
+    return 0;
+}
+
+// Queues a change for the database behind a memory session, if there is one
+void memory_write(int type, int id, int parent, int count, const char* name, const char* about) {
+    memory.generation++;
+    if(db == NULL) return;
+    if(write_queue.count == write_queue.capacity) {
+        write_queue.capacity = write_queue.capacity == 0 ? WRITE_BATCH : write_queue.capacity * 2;
+        write_queue.ops = realloc(write_queue.ops, sizeof(struct write_op_t) * write_queue.capacity);
+    }
+    struct write_op_t* op = &write_queue.ops[write_queue.count++];
+    op->type = type;
+    op->id = id;
+    op->parent = parent;
+    op->count = count;
+    op->name = name;
+    op->about = about;
+}
+
+/* Starts copying source to filename, replacing what the file held once the
+   copy is complete. Backing a file up onto itself is refused. */
+int backup_start(sqlite3* source, const char* filename) {
+    const char* path = sqlite3_db_filename(source, "main");
+    char* from = path != NULL && path[0] != 0 ? realpath(path, NULL) : NULL;
+    char* to = realpath(filename, NULL);
+    int same = from != NULL && to != NULL && strcmp(from, to) == 0;
+    free(from);
+    free(to);
+    if(same || maintenance.backup != NULL) return 1;
+    if(sqlite3_open(filename, &maintenance.target) == SQLITE_OK) {
+        maintenance.backup = sqlite3_backup_init(maintenance.target, "main", source, "main");
+    }
+    if(maintenance.backup == NULL) {
+        sqlite3_close(maintenance.target);
+        maintenance.target = NULL;
+        return 1;
+    }
+    snprintf(maintenance.file, sizeof(maintenance.file), "%s", filename);
+    maintenance.pages = 0;
+    maintenance.remaining = 0;
+    maintenance.failed = FALSE;
+    maintenance.started_ms = clock_ms();
+    return 0;
+}
+
+// Ends a backup; an unfinished one leaves the target file as it was
+void backup_finish(int rc) {
+    sqlite3_backup_finish(maintenance.backup);
+    sqlite3_close(maintenance.target);
+    maintenance.backup = NULL;
+    maintenance.target = NULL;
+    maintenance.failed = rc != SQLITE_DONE;
+    maintenance.backup_ms = clock_ms() - maintenance.started_ms;
+}
+
+/* Copies the next pages of the running backup, giving TRUE while some are
+   left. Writes made on the source connection are carried into the copy as
+   they happen; a write from any other connection starts it over. */
+int backup_step() {
+    if(maintenance.backup == NULL) return FALSE;
+    int rc = sqlite3_backup_step(maintenance.backup, BACKUP_PAGES);
+    maintenance.pages = sqlite3_backup_pagecount(maintenance.backup);
+    maintenance.remaining = sqlite3_backup_remaining(maintenance.backup);
+    maintenance.blocked = rc == SQLITE_BUSY || rc == SQLITE_LOCKED;
+    if(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) return TRUE;
+    backup_finish(rc);
+    return FALSE;
+}
+
+/* Upkeep for idle time, called whenever no key came in time. Gives TRUE
+   while there is more to do, so that the next key is waited for only
+   briefly. Free pages are only given back by files made with incremental
+   auto vacuum; 'invc --compact' converts older ones. PRAGMA optimize runs
+   ANALYZE on the tables whose statistics the churn has made stale. */
+int maintenance_idle() {
+    if(db == NULL) return FALSE;
+    if(maintenance.backup != NULL) {
+        if(backup_step()) return TRUE;
+        if(maintenance.failed) show_modal_error("The backup could not be written.");
+        return FALSE;
+    }
+    if(sqlite3_total_changes64(db) - maintenance.changes < MAINTENANCE_CHANGES) return FALSE;
+    double started = clock_ms();
+    int free_pages = sqlite_query_int(db, "pragma freelist_count", 0, 0);
+    if(free_pages > 0 && sqlite_query_int(db, "pragma auto_vacuum", 0, 0) == 2) {
+        char sql[64];
+        snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d);", MAINTENANCE_PAGES);
+        if(sqlite3_exec(db, sql, 0, 0, 0) == SQLITE_OK) {
+            maintenance.released += free_pages < MAINTENANCE_PAGES ? free_pages : MAINTENANCE_PAGES;
+            if(free_pages > MAINTENANCE_PAGES) return TRUE;
+        }
+    }
+    sqlite3_exec(db, "PRAGMA optimize; PRAGMA wal_checkpoint(PASSIVE);", 0, 0, 0);
+    maintenance.changes = sqlite3_total_changes64(db);
+    maintenance.runs++;
+    maintenance.last_ms = clock_ms() - started;
+    return FALSE;
+}
+
+// 'invc --backup': the same chunked copy, from a connection of its own
+int backup_database(const char* source, const char* target) {
+    sqlite3* conn;
+    if(sqlite3_open_v2(source, &conn, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open %s: %s\n", source, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return 1;
+    }
+    if(backup_start(conn, target) != 0) {
+        fprintf(stderr, "Can't write a backup to %s\n", target);
+        sqlite3_close(conn);
+        return 1;
+    }
+    // A locked step is retried after the pause the idle path takes between steps
+    while(backup_step()) {
+        if(maintenance.blocked) sqlite3_sleep(BACKUP_STEP_MS);
+    }
+    sqlite3_close(conn);
+    if(maintenance.failed) {
+        fprintf(stderr, "Can't write %s\n", target);
+        return 1;
+    }
+    printf("%d pages copied in %.0f ms\n", maintenance.pages, maintenance.backup_ms);
+    return 0;
+}
+
+/* 'invc --compact': rewrites a database with incremental auto vacuum, so
+   that from then on invc gives free pages back while it is idle. It waits
+   for other writers, and invc can stay open meanwhile. */
+int compact_database(const char* filename) {
+    sqlite3* conn;
+    if(sqlite3_open_v2(filename, &conn, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open %s: %s\n", filename, sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return 1;
+    }
+    sqlite3_busy_timeout(conn, 5000);
+    sqlite3_int64 before = sqlite_query_int(conn, "pragma page_count", 0, 0);
+    int failed = sqlite3_exec(conn, "PRAGMA auto_vacuum=INCREMENTAL; VACUUM; ANALYZE;", 0, 0, 0) != SQLITE_OK;
+    if(failed) {
+        fprintf(stderr, "Can't compact %s: %s\n", filename, sqlite3_errmsg(conn));
+    } else {
+        printf("%lld pages before, %lld after\n", before, sqlite_query_int(conn, "pragma page_count", 0, 0));
+    }
+    sqlite3_close(conn);
+    return failed;
+}
+
+// One above the highest id of this replica's block, found by bisecting the id order
+int memory_next_id() {
+    int low = 0, high = memory.count;
+    while(low < high) {
+        int middle = low + (high - low) / 2;
+        if(memory.items[middle].id <= sync_base + (SYNC_BLOCK - 1)) low = middle + 1; else high = middle;
+    }
+    return low > 0 && memory.items[low - 1].id > sync_base ? memory.items[low - 1].id + 1 : sync_base + 1;
+}
+
+int memory_insert(int parent, const char* name, const char* about, int count) {
+    int id = memory_next_id();
+    struct memory_item_t* item = memory_add(id, parent, name, about, count);
+    memory_link(item);
+    memory_write(WRITE_INSERT, id, parent, count, item->name, item->about);
+    return id;
+}
+
+int memory_move(const int* ids, int count, int parent) {
+    for(int i = 0; i < count; i++) {
+        if(memory_find(ids[i]) == NULL) return 1;
+    }
+    for(int i = 0; i < count; i++) {
+        struct memory_item_t* item = memory_find(ids[i]);
+        memory_unlink(item);
+        item->parent = parent;
+        memory_link(item);
+        memory_write(WRITE_REPARENT, ids[i], parent, 0, NULL, NULL);
+    }
+    return 0;
+}
+
+/* Walks the subtrees breadth first, so every parent is numbered before
+   its children; copy i gets the id base + i. Attributes are written to
+   the database straight away, as they are never held in memory. */
+int memory_copy(const int* ids, int count, int parent) {
+    struct copy_t { int id; int parent; } *copies = malloc(sizeof(struct copy_t) * count);
+    int total = 0, capacity = count;
+    for(int i = 0; i < count; i++) {
+        if(memory_find(ids[i]) == NULL) continue;
+        copies[total].id = ids[i];
+        copies[total++].parent = -1;
+    }
+    for(int i = 0; i < total; i++) {
+        struct id_list_t* children = &memory_find(copies[i].id)->children;
+        if(total + children->count > capacity) {
+            capacity = (total + children->count) * 2;
+            copies = realloc(copies, sizeof(struct copy_t) * capacity);
+        }
+        for(int j = 0; j < children->count; j++) {
+            copies[total].id = children->ids[j];
+            copies[total++].parent = i;
+        }
+    }
+    int base = memory_next_id();
+    for(int i = 0; i < total; i++) {
+        struct memory_item_t* source = memory_find(copies[i].id);
+        const char* name = source->name;
+        const char* about = source->about;
+        int stock = source->count;
+        int copy_parent = copies[i].parent < 0 ? parent : base + copies[i].parent;
+        struct memory_item_t* item = memory_add(base + i, copy_parent, name, about, stock);
+        memory_link(item);
+        memory_write(WRITE_INSERT, base + i, copy_parent, stock, item->name, item->about);
+    }
+    // Attribute and attachment rows name the new items, which must be written first
+    int failed = memory_flush() != 0;
+    if(!failed && db != NULL && sqlite3_exec(db, "BEGIN", 0, 0, 0) == SQLITE_OK) {
+        for(int i = 0; i < total; i++) {
+            sqlite3_bind_int(attr_copy_stmt, 1, copies[i].id);
+            sqlite3_bind_int(attr_copy_stmt, 2, base + i);
+            sqlite_write(attr_copy_stmt);
+            sqlite3_bind_int(attach_copy_stmt, 1, copies[i].id);
+            sqlite3_bind_int(attach_copy_stmt, 2, base + i);
+            sqlite_write(attach_copy_stmt);
+        }
+        sqlite3_exec(db, "COMMIT", 0, 0, 0);
+    }
+    free(copies);
+    return failed || total == 0;
+}
+
+// Like the SQLite store, children of a removed item are left orphaned
+int memory_remove(int id) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL) return 1;
+    memory_unlink(item);
+    id_list_free(&item->children);
+    item->removed = TRUE;
+    memory.live--;
+    memory_write(WRITE_REMOVE, id, 0, 0, NULL, NULL);
+    return 0;
+}
+
+int memory_rename(int id, const char* name) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL) return 1;
+    item->name = intern(&memory.strings, name);
+    memory_write(WRITE_RENAME, id, 0, 0, item->name, NULL);
+    return 0;
+}
+
+int memory_set_count(int id, int count) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL) return 1;
+    item->count = count;
+    memory_write(WRITE_COUNT, id, 0, count, NULL, NULL);
+    return 0;
+}
+
+int memory_describe(int id, const char* about) {
+    struct memory_item_t* item = memory_find(id);
+    if(item == NULL) return 1;
+    item->about = intern(&memory.strings, about);
+    memory_write(WRITE_DESCRIBE, id, 0, 0, NULL, item->about);
+    return 0;
+}
+
+struct store_t memory_store = {
+    "memory",
+    memory_count_children,
+    memory_children,
+    memory_locate,
+    memory_get,
+    memory_search_count,
+    memory_search,
+    memory_path,
+    memory_description,
+    memory_insert,
+    memory_move,
+    memory_copy,
+    memory_remove,
+    memory_rename,
+    memory_set_count,
+    memory_describe
+};
+
+void reader_begin(struct reader_t* reader) {
+    if(reader_ready(reader)) sqlite3_exec(reader->db, "BEGIN", 0, 0, 0);
+}
+
+void reader_end(struct reader_t* reader) {
+    if(reader_ready(reader)) sqlite3_exec(reader->db, "COMMIT", 0, 0, 0);
+}
+
+/* Reads the count and current page of a tree panel in one read
+   transaction. It touches no curses state, so the two panels may run it
+   on separate threads. */
+void* panel_load_tree(void* argument) {
+    struct panel_t* panel = argument;
+    int parent = panel->path == NULL ? 0 : panel->parent;
+    int first = (panel->offset / win_props.view_limit) * win_props.view_limit;
+    // The page next to the cached one seeks from its edge row
+    struct seek_t seek = {first, NULL, NULL};
+    struct entry_t anchor;
+    if(panel->cached > 0 && panel->page_parent == parent && panel->page_sort == panel->sort) {
+        if(first == panel->first + win_props.view_limit && panel->cached == win_props.view_limit) {
+            anchor = panel->entries[panel->cached - 1];
+            seek.after = &anchor;
+        } else if(first == panel->first - win_props.view_limit) {
+            anchor = panel->entries[0];
+            seek.before = &anchor;
+        }
+    }
+    reader_begin(&panel->reader);
+    panel->count = store->count_children(&panel->reader, parent);
+    arena_reset(&panel->arena);
+    int i = store->children(&panel->reader, parent, panel->sort, &seek, win_props.view_limit, panel->entries, &panel->arena);
+    reader_end(&panel->reader);
+    panel->page_parent = parent;
+    panel->page_sort = panel->sort;
+    panel->first = first;
+    panel->cached = i;
+    for(; i < win_props.view_limit; i++) {
+        panel->entries[i].id = 0;
+        panel->entries[i].name = NULL;
+    }
+    return NULL;
+}
+
+/* Reloads both panels after a change. Tree panels load side by side when
+   each has its own reader (the memory and snapshot stores only read
+   shared structures), then everything is drawn on this thread. */
+int panels_refresh() {
+    pthread_t threads[ARRLEN(panels)];
+    int threaded[ARRLEN(panels)];
+    for(int i = 0; i < ARRLEN(panels); i++) {
+        struct panel_t* p = &panels[i];
+        threaded[i] = p->loaded && p->mode == PANEL_TREE && (store != &sqlite_store || reader_ready(&p->reader)) &&
+                      pthread_create(&threads[i], NULL, panel_load_tree, p) == 0;
+    }
+    for(int i = 0; i < ARRLEN(panels); i++) {
+        if(threaded[i]) {
+            pthread_join(threads[i], NULL);
+            select_window(panels[i].win);
+            draw_dataview(&panels[i]);
+        } else {
+            update_dataview(&panels[i], TRUE);
+        }
+    }
+}
+
+int update_dataview(struct panel_t* panel, int reload) {
+    //reload = TRUE;
+    select_window(panel->win);
+    if(panel->loaded == FALSE) return 1;
+    sqlite3_stmt* select = NULL;
+    sqlite3_stmt* counter = NULL;
+    struct query_cache_t* cache = NULL;
+    int first = (panel->offset / win_props.view_limit) * win_props.view_limit;
+    int load = (panel->offset % win_props.view_limit) == 0 || (panel->offset % win_props.view_limit) == win_props.view_limit - 1 || reload == TRUE;
+    int i = 0;
+    if(panel->mode == PANEL_LOW) {
+        // Both statements only walk the partial index of low items
+        select = low_stmt;
+        counter = count_low_stmt;
+        sqlite3_bind_int(select, 1, win_props.view_limit);
+        sqlite3_bind_int(select, 2, first);
+    } else if(panel->mode == PANEL_QUERIES) {
+        select = queries_stmt;
+        counter = count_queries_stmt;
+        sqlite3_bind_int(select, 1, win_props.view_limit);
+        sqlite3_bind_int(select, 2, first);
+    } else if(panel->mode == PANEL_QUERY) {
+        cache = query_cache(panel->query);
+        if(cache == NULL) return 1;
+        select = cache->page_stmt;
+        query_cache_seek(cache, panel->offset / win_props.view_limit);
+    }
+    if(panel->mode == PANEL_TREE) {
+        if(load) {
+            panel_load_tree(panel);
+            return draw_dataview(panel);
+        }
+        reader_begin(&panel->reader);
+        panel->count = store->count_children(&panel->reader, panel->path == NULL ? 0 : panel->parent);
+        reader_end(&panel->reader);
+    } else {
+        int s, cnt = 0;
+        if(cache != NULL) {
+            cnt = cache->count;
+        } else {
+            while ((s = sqlite3_step(counter)) != SQLITE_DONE) {
+                if(s == SQLITE_ROW) {
+                    cnt = sqlite3_column_int(counter, 0);
+                }
+            }
+            sqlite3_reset(counter);
+        }
+        panel->count = cnt;
+        if(load) {
+            arena_reset(&panel->arena);
+            i = sqlite_fill_entries(select, panel->entries, win_props.view_limit, &panel->arena);
+            if(cache != NULL && i == win_props.view_limit) {
+                query_cache_note(cache, panel->offset / win_props.view_limit, panel->entries[i - 1].id);
+            }
+            if(panel->mode == PANEL_QUERIES) {
+                // Virtual containers show how many items they currently hold
+                for(int j = 0; j < i; j++) {
+                    struct query_cache_t* c = query_cache(panel->entries[j].id);
+                    panel->entries[j].count = c != NULL ? c->count : 0;
+                }
+            }
+        }
+        sqlite3_reset(select);
+    }
+    if(load) {
+        panel->first = first;
+        panel->cached = i;
+        for(; i < win_props.view_limit; i++) {
+            panel->entries[i].id = 0;
+            panel->entries[i].name = NULL;
+        }
+    }
+    draw_dataview(panel);
+}
+
+int draw_dataview(struct panel_t* panel) {
+    int i;
+    int name_length = (win_props.main_width / 2) - 4 - win_props.int_length * 2;
+    // An attribute column takes its width out of the name column
+    int column = panel->column != NULL && db != NULL && panel->site == 0 && name_length > ATTR_WIDTH * 2;
+    int name_width = column ? name_length - ATTR_WIDTH - 1 : name_length;
+    mvwhline(panel->win, 1, 1, ' ', win_props.data_width);
+    if(column) {
+        mvwaddch(panel->win, 0, 2 + win_props.int_length + name_width, ACS_TTEE);
+        mvwaddch(panel->win, 1, 2 + win_props.int_length + name_width, ACS_VLINE);
+        mvwaddch(panel->win, win_props.main_height - 2, 2 + win_props.int_length + name_width, ACS_BTEE);
+        wattron(panel->win, WA_BOLD | COLOR_PAIR(6));
+        mvwprintw(panel->win, 1, 3 + win_props.int_length + name_width, "%.*s", ATTR_WIDTH, panel->column);
+        wattroff(panel->win, WA_BOLD | COLOR_PAIR(6));
+    }
+    mvwaddch(panel->win, 1, 1 + win_props.int_length, ACS_VLINE);
+    mvwaddch(panel->win, 0, 2 + win_props.int_length + name_length, ACS_TTEE);
+    mvwaddch(panel->win, 1, 2 + win_props.int_length + name_length, ACS_VLINE);
+    mvwaddch(panel->win, win_props.main_height - 2, 2 + win_props.int_length + name_length, ACS_BTEE);
+    wattron(panel->win, WA_BOLD);
+    wattron(panel->win, COLOR_PAIR(6));
+    // The sorted column is flagged with ^ or v for its direction
+    const char* flag = panel->sort & SORT_DESC ? "v" : "^";
+    mvwprintw(panel->win, 1, 1, "Id%s", panel->mode == PANEL_TREE && SORT_FIELD(panel->sort) == SORT_ID ? flag : "");
+    wattroff(panel->win, COLOR_PAIR(6));
+    wattron(panel->win, COLOR_PAIR(6));
+    mvwprintw(panel->win, 1, 2 + win_props.int_length, "Name%s", panel->mode == PANEL_TREE && SORT_FIELD(panel->sort) == SORT_NAME ? flag : "");
+    wattroff(panel->win, COLOR_PAIR(6));
+    wattron(panel->win, COLOR_PAIR(6));
+    mvwprintw(panel->win, 1, 3 + win_props.int_length + name_length, "Qty%s", panel->mode == PANEL_TREE && SORT_FIELD(panel->sort) == SORT_COUNT ? flag : "");
+    wattroff(panel->win, COLOR_PAIR(6));
+    wattroff(panel->win, WA_BOLD);
+    struct id_list_t* marks = panel_marks(panel);
+    for(i = 0; i < win_props.view_limit; i++) {
+        if(panel->entries[i].id != 0) {
+            if(i == ((panel->offset)% win_props.view_limit)) {
+                wattron(panel->win, WA_STANDOUT);
+            }
+            if(id_list_contains(marks, panel->entries[i].id)) {
+                wattron(panel->win, COLOR_PAIR(6) | WA_BOLD);
+            }
+            mvwhline(panel->win, 2+i, 1, ' ', win_props.data_width);
+            mvwaddch(panel->win, 2 + i, 1 + win_props.int_length, ACS_VLINE);
+            mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_length, ACS_VLINE);
+            if(column) mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_width, ACS_VLINE);
+            //mvwhline(panel->win, 2 + i, 1, ' ', win_props.data_width);
+            //mvwhline(panel->win, 2+i, 1, ' ', win_props.int_length);
+            //mvwhline(panel->win, 2+i, 1, ' ', win_props.int_length);
+            mvwprintw(panel->win, 2 + i, 1, "%d", panel->entries[i].id);
+            //mvwaddch(panel->win, 2 + i, win_props.data_width_tab * 1, ACS_VLINE);
+            if(panel->entries[i].name != NULL) {
+                mvwprintw(panel->win, 2 + i, 2 + win_props.int_length * 1, "%.*s", name_width, panel->entries[i].name);
+            }
+            if(column) {
+                sqlite3_bind_int(attr_get_stmt, 1, panel->entries[i].id);
+                sqlite3_bind_text(attr_get_stmt, 2, panel->column, -1, SQLITE_STATIC);
+                if(sqlite3_step(attr_get_stmt) == SQLITE_ROW) {
+                    mvwprintw(panel->win, 2 + i, 3 + win_props.int_length + name_width, "%.*s", ATTR_WIDTH, sqlite3_column_text(attr_get_stmt, 0));
+                }
+                sqlite3_reset(attr_get_stmt);
+            }
+            //mvwaddch(panel->win, 2 + i, win_props.data_width_tab * 2, ACS_VLINE);
+            mvwprintw(panel->win, 2 + i, 3 + win_props.int_length * 1 + name_length, "%d", panel->entries[i].count);
+            wattroff(panel->win, WA_STANDOUT | COLOR_PAIR(6) | WA_BOLD);
+        } else {
+            mvwhline(panel->win, 2+i, 1, ' ', win_props.data_width);
+            mvwaddch(panel->win, 2 + i, 1 + win_props.int_length, ACS_VLINE);
+            mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_length, ACS_VLINE);
+            if(column) mvwaddch(panel->win, 2 + i, 2 + win_props.int_length + name_width, ACS_VLINE);
+        }
+    }
+    //int id = current_entry()->id;
+    //mvwprintw(panel->win, 23, 1, "ID: %d OFF: %d PAR: %d", id, panel->offset % win_props.view_limit, panel->parent);
+    wrefresh(panel->win);
+}
+
+int switch_panels() {
+    panel = (panel + 1) % ARRLEN(panels);
+    select_window(panels[panel].win);
+}
+
+int draw_command_bar(WINDOW *command, struct action_t* bar) {
+    int n = 0;
+    for(int i = 0; bar[i].key != 0; i++) {
+        if(bar[i].show_on_bar) {
+            wattron(command, COLOR_PAIR(1));
+            mvwprintw(command, 0, n * win_props.action_length, "%s", bar[i].keyname);
+            wattron(command, COLOR_PAIR(2));
+            waddstr(command, bar[i].name);
+            int len = win_props.action_length - strlen(bar[i].name);
+            for(int j = 0; j < len; j++) {
+                waddch(command, ' ');
+            }
+            n++;
+        }
+    }
+    wrefresh(command);
+}
+
+int draw_panel(struct panel_t* p) {
+    WINDOW* win = p->win;
+    wbkgd(win, COLOR_PAIR(3));
+    box(win, 0, 0);
+    if(p->loaded == FALSE) {
+        wattron(win, WA_STANDOUT);
+        mvwaddstr(win, 0, 2, "No Database Loaded");
+        wattroff(win, WA_STANDOUT);
+    } else {
+        mvwaddch(p->win, win_props.main_height - 2, 1 + win_props.int_length, ACS_BTEE);
+        wattron(win, WA_STANDOUT);
+        if(p->mode == PANEL_LOW) {
+            mvwaddstr(win, 0, 2, "Below reorder threshold");
+        } else if(p->mode == PANEL_QUERIES) {
+            mvwaddstr(win, 0, 2, "Saved queries");
+        } else if(p->mode == PANEL_QUERY) {
+            mvwprintw(win, 0, 2, "Saved query %d", p->query);
+        } else if(p->path == NULL) {
+            // A panel on another site names it before the path
+            mvwprintw(win, 0, 2, "%s%s/ (root)", p->site != 0 ? sites[p->site].name : "", p->site != 0 ? ":" : "");
+        } else {
+            const char* name;
+            struct path_t* path = p->path;
+            mvwprintw(win, 0, 2, "%s%s/", p->site != 0 ? sites[p->site].name : "", p->site != 0 ? ":" : "");
+            while(path != NULL) {
+                wprintw(p->win, "%d/", path->id);
+                name = path->name;
+                path = path->next;
+            }
+            if(name != NULL) {
+                int name_length = (win_props.main_width / 2) - 4 - win_props.int_length * 2;
+                mvwprintw(p->win, win_props.main_height - 2, 2, "%s", name);
+            }
+        }
+	wattroff(win, WA_STANDOUT);
+    }
+    wrefresh(win);
+}
+
+// Grows the page buffer by doubling, and only once the view outgrows it
+void panel_reserve(struct panel_t* panel, int limit) {
+    if(limit <= panel->capacity) return;
+    int capacity = panel->capacity == 0 ? limit : panel->capacity;
+    while(capacity < limit) capacity *= 2;
+    panel->entries = realloc(panel->entries, sizeof(struct entry_t) * capacity);
+    panel->capacity = capacity;
+}
+
+/* Re-pages a panel for a new view limit. If the rows of the page now
+   holding the cursor were all fetched already they are shifted into
+   place; only otherwise is the page read from the store again. */
+int panel_relayout(struct panel_t* panel) {
+    if(panel->loaded == FALSE) return 0;
+    int first = (panel->offset / win_props.view_limit) * win_props.view_limit;
+    int rows = panel->count - first < win_props.view_limit ? panel->count - first : win_props.view_limit;
+    if(first < panel->first || first + rows > panel->first + panel->cached) {
+        return update_dataview(panel, TRUE);
+    }
+    memmove(panel->entries, panel->entries + (first - panel->first), sizeof(struct entry_t) * rows);
+    panel->first = first;
+    panel->cached = rows;
+    for(int i = rows; i < win_props.view_limit; i++) {
+        panel->entries[i].id = 0;
+        panel->entries[i].name = NULL;
+    }
+    return draw_dataview(panel);
+}
+
+/* Follows the terminal size, which ncurses updates on SIGWINCH before it
+   reports KEY_RESIZE. Windows are resized in place; returns FALSE when the
+   size did not change. */
+int layout_update() {
+    int height, width;
+    getmaxyx(stdscr, height, width);
+    if(height == win_props.main_height && width == win_props.main_width) return FALSE;
+    setup_window_properties();
+    wresize(bar, 1, win_props.main_width);
+    mvwin(bar, win_props.main_height - 1, 0);
+    for(int i = 0; i < ARRLEN(panels); i++) {
+        wresize(panels[i].win, win_props.main_height - 1, win_props.main_width / 2);
+        mvwin(panels[i].win, 0, i == win_props.panel_right ? win_props.main_width / 2 : 0);
+        werase(panels[i].win);
+        panel_reserve(&panels[i], win_props.view_limit);
+    }
+    werase(bar);
+    return TRUE;
+}
+
+/* Frames a view that covers both panels, and its command bar, at the
+   current terminal size; views call it again when the terminal resizes. */
+void draw_view_frame(WINDOW* win, WINDOW* view_bar, const char* title, struct action_t* view_actions) {
+    wresize(win, win_props.main_height - 1, win_props.main_width);
+    wresize(view_bar, 1, win_props.main_width);
+    mvwin(view_bar, win_props.main_height - 1, 0);
+    werase(win);
+    wbkgd(win, COLOR_PAIR(3));
+    box(win, 0, 0);
+    wattron(win, WA_STANDOUT);
+    mvwprintw(win, 0, (win_props.main_width - strlen(title))/2, title);
+    wattroff(win, WA_STANDOUT);
+    werase(view_bar);
+    draw_command_bar(view_bar, view_actions);
+    wrefresh(view_bar);
+}
+
+// Repaints from the cached pages; the terminal may have been cleared even if the size is back where it was
+int resize_layout() {
+    layout_update();
+    current_window = NULL;
+    // getch() refreshes stdscr, so settle it first or it would paint over the panels
+    erase();
+    refresh();
+    draw_command_bar(bar, actions);
+    for(int i = 0; i < ARRLEN(panels); i++) {
+        draw_panel(&panels[i]);
+        panel_relayout(&panels[i]);
+    }
+    select_window(panels[panel].win);
+}
+
+int redraw() {
+    current_window = NULL;
+    layout_update();
+    draw_command_bar(bar, actions);
+    for(int i = 0; i < ARRLEN(panels); i++) {
+      draw_panel(&panels[i]);
+    }
+    for(int i = 0; i < ARRLEN(panels); i++) {
+        update_dataview(&panels[i], TRUE);
+    }
+}
+
+int show_modal_help() {
+    int ch = 0;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = current_window = newwin(win_props.main_height - 4, width, 2, 3);
+    const char* title = "Using Inventory Commander";
+    // Rows left for the action list once the border and the two notes are drawn
+    int rows = win_props.main_height - 8;
+    int total = 0, top = 0;
+    while(actions[total].key != 0) total++;
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, rows + 1, 1, "NOTE: Any changes made will be committed immediately.");
+    mvwaddstr(modal, rows + 2, 1, "Hit 'F1' to close this help message, Up/Down to scroll");
+    do {
+        if(ch == KEY_UP && top > 0) top--;
+        if(ch == KEY_DOWN && top + rows < total) top++;
+        for(int i = 0; i < rows; i++) {
+            wattron(modal, COLOR_PAIR(1));
+            mvwhline(modal, i + 1, 1, ' ', width - 2);
+            if(top + i >= total) continue;
+            struct action_t* action = &actions[top + i];
+            mvwaddstr(modal, i + 1, 1, action->keyname);
+            waddstr(modal, " (");
+            wattron(modal, COLOR_PAIR(4) | WA_BOLD);
+            waddstr(modal, action->name);
+            wattroff(modal, WA_BOLD);
+            wattron(modal, COLOR_PAIR(1));
+            waddstr(modal, ") ");
+            waddnstr(modal, action->description, width - 2 - getcurx(modal));
+        }
+        wrefresh(modal);
+    } while ((ch = input_key()) != KEY_F(1));
+    delwin(modal);
+    redraw();
+}
+
+int show_modal_error(char* message) {
+    int ch;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
+    const char* title = "An Error Has Occurred";
+    box(modal, 0, 0);
+    wbkgd(modal, ' ' | COLOR_PAIR(5));
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    wattron(modal, COLOR_PAIR(5));
+    mvwaddstr(modal, 2, 2, message);
+    mvwaddstr(modal, 6, 2, "Hit 'x' to close this error message");
+    wattroff(modal, COLOR_PAIR(5));
+    wrefresh(modal);
+    while ((ch = input_key()) != 'x') { }
+    delwin(modal);
+    if(current_window == NULL) {
+        redraw();
+    } else {
+        redrawwin(current_window);
+    }
+}
+
+/* Description text being edited. Text before the cursor sits at the front
+   of the array and text after it at the back, so typing and deleting at
+   the cursor only touch the gap between them, whatever the text length. */
+struct gap_buffer_t {
+    char* text;
+    size_t size;
+    size_t gap_start;
+    size_t gap_end;
+};
+
+struct editor_t {
+    struct gap_buffer_t text;
+    int top;
+} editor;
+
+size_t gap_length(struct gap_buffer_t* gap) {
+    return gap->size - (gap->gap_end - gap->gap_start);
+}
+
+char gap_at(struct gap_buffer_t* gap, size_t position) {
+    return position < gap->gap_start ? gap->text[position] : gap->text[position + gap->gap_end - gap->gap_start];
+}
+
+// Moves the gap, and with it the cursor, to position
+void gap_move(struct gap_buffer_t* gap, size_t position) {
+    if(position < gap->gap_start) {
+        size_t count = gap->gap_start - position;
+        memmove(gap->text + gap->gap_end - count, gap->text + position, count);
+        gap->gap_start -= count;
+        gap->gap_end -= count;
+    } else if(position > gap->gap_start) {
+        size_t count = position - gap->gap_start;
+        memmove(gap->text + gap->gap_start, gap->text + gap->gap_end, count);
+        gap->gap_start += count;
+        gap->gap_end += count;
+    }
+}
+
+void gap_insert(struct gap_buffer_t* gap, char ch) {
+    if(gap->gap_start == gap->gap_end) {
+        size_t tail = gap->size - gap->gap_end;
+        size_t size = gap->size < 128 ? 256 : gap->size * 2;
+        gap->text = realloc(gap->text, size);
+        memmove(gap->text + size - tail, gap->text + gap->gap_end, tail);
+        gap->gap_end = size - tail;
+        gap->size = size;
+    }
+    gap->text[gap->gap_start++] = ch;
+}
+
+void gap_init(struct gap_buffer_t* gap, const char* text) {
+    memset(gap, 0, sizeof(struct gap_buffer_t));
+    while(text != NULL && *text != 0) gap_insert(gap, *text++);
+    gap_move(gap, 0);
+}
+
+// The text in one allocation, for saving
+char* gap_text(struct gap_buffer_t* gap) {
+    size_t length = gap_length(gap);
+    char* text = malloc(length + 1);
+    memcpy(text, gap->text, gap->gap_start);
+    memcpy(text + gap->gap_start, gap->text + gap->gap_end, gap->size - gap->gap_end);
+    text[length] = 0;
+    return text;
+}
+
+void gap_free(struct gap_buffer_t* gap) {
+    free(gap->text);
+    memset(gap, 0, sizeof(struct gap_buffer_t));
+}
+
+/* Lines wrap at width; a character that would land past the last column
+   starts the next row. Gives the row and column text position lands on. */
+void editor_place(struct gap_buffer_t* gap, size_t position, int width, int* row, int* col) {
+    *row = 0;
+    *col = 0;
+    for(size_t i = 0; i < position; i++) {
+        if(*col == width) {
+            (*row)++;
+            *col = 0;
+        }
+        if(gap_at(gap, i) == '\n') {
+            (*row)++;
+            *col = 0;
+        } else {
+            (*col)++;
+        }
+    }
+    if(*col == width) {
+        (*row)++;
+        *col = 0;
+    }
+}
+
+// The text position nearest to row and col, the inverse of editor_place
+size_t editor_find(struct gap_buffer_t* gap, int width, int row, int col) {
+    int r = 0, c = 0;
+    size_t length = gap_length(gap);
+    for(size_t i = 0; i < length; i++) {
+        if(c == width) {
+            r++;
+            c = 0;
+        }
+        if(r > row || (r == row && c >= col)) return i;
+        if(gap_at(gap, i) == '\n') {
+            if(r == row) return i;
+            r++;
+            c = 0;
+        } else {
+            c++;
+        }
+    }
+    return length;
+}
+
+// Draws the rows from editor.top down and leaves the cursor in place
+void editor_draw(WINDOW* win, int width, int height) {
+    struct gap_buffer_t* gap = &editor.text;
+    int row, col, r = 0, c = 0, rows;
+    editor_place(gap, gap->gap_start, width, &row, &col);
+    if(row < editor.top) editor.top = row;
+    if(row >= editor.top + height) editor.top = row - height + 1;
+    for(int i = 0; i < height; i++) mvwhline(win, i + 1, 1, ' ', width);
+    size_t length = gap_length(gap);
+    for(size_t i = 0; i < length; i++) {
+        if(c == width) {
+            r++;
+            c = 0;
+        }
+        char ch = gap_at(gap, i);
+        if(ch == '\n') {
+            r++;
+            c = 0;
+            continue;
+        }
+        if(r >= editor.top && r < editor.top + height) {
+            mvwaddch(win, r - editor.top + 1, c + 1, isprint((unsigned char)ch) ? ch : ' ');
+        }
+        c++;
+    }
+    editor_place(gap, length, width, &rows, &c);
+    mvwhline(win, height + 1, 1, ACS_HLINE, width);
+    mvwprintw(win, height + 1, 2, " Row %d of %d ", row + 1, rows + 1);
+    wmove(win, row - editor.top + 1, col + 1);
+}
+
+int editor_save(struct action_source_t source) {
+    if(!require_writable()) return 1;
+    char* text = gap_text(&editor.text);
+    if (store->describe(source.entry->id, text) != 0) {
+        free(text);
+        show_modal_error("Error in saving data to database.");
+        return 1;
+    }
+    free(text);
+}
+
+/* Edits the description in a gap buffer rather than on the screen, so the
+   text can run past one screen and is saved from the buffer as it is. */
+int show_modal_editor() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_home_site()) return 1;
+
+    int ch, row, col;
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+    WINDOW *modal = current_window = newwin(win_props.main_height - 1, win_props.main_width, 0, 0);
+    const char* title = "Edit Item Description";
+    WINDOW *bar = newwin(1, win_props.main_width, win_props.main_height - 1, 0);
+    int width = win_props.main_width - 2;
+    int height = win_props.main_height - 3;
+    draw_view_frame(modal, bar, title, editor_actions);
+
+    char* txt = store->description(entry->id);
+    gap_init(&editor.text, txt);
+    free(txt);
+    editor.top = 0;
+    struct gap_buffer_t* gap = &editor.text;
+
+    editor_draw(modal, width, height);
+    wrefresh(modal);
+    struct action_source_t source = { .window = modal, .entry = entry };
+    while ((ch = input_key()) != KEY_F(3)) {
+        if(ch == ERR) continue;
+        for(int i = 0; i < ARRLEN(editor_actions); i++) {
+            if(ch == editor_actions[i].key && editor_actions[i].function != NULL) {
+                editor_actions[i].function(source);
+            }
+        }
+        size_t length = gap_length(gap);
+        editor_place(gap, gap->gap_start, width, &row, &col);
+        if((ch >= 32 && ch <= 126) || ch == '\n') {
+            gap_insert(gap, ch);
+        } else if(ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if(gap->gap_start > 0) gap->gap_start--;
+        } else if(ch == KEY_DC) {
+            if(gap->gap_end < gap->size) gap->gap_end++;
+        } else if(ch == KEY_LEFT) {
+            if(gap->gap_start > 0) gap_move(gap, gap->gap_start - 1);
+        } else if(ch == KEY_RIGHT) {
+            if(gap->gap_start < length) gap_move(gap, gap->gap_start + 1);
+        } else if(ch == KEY_UP) {
+            if(row > 0) gap_move(gap, editor_find(gap, width, row - 1, col));
+        } else if(ch == KEY_DOWN) {
+            gap_move(gap, editor_find(gap, width, row + 1, col));
+        } else if(ch == KEY_PPAGE) {
+            gap_move(gap, editor_find(gap, width, row > height ? row - height : 0, col));
+        } else if(ch == KEY_NPAGE) {
+            gap_move(gap, editor_find(gap, width, row + height, col));
+        } else if(ch == KEY_HOME) {
+            gap_move(gap, editor_find(gap, width, row, 0));
+        } else if(ch == KEY_END) {
+            gap_move(gap, editor_find(gap, width, row, width));
+        } else if(ch == KEY_RESIZE) {
+            // The panels behind follow when the editor closes
+            layout_update();
+            erase();
+            refresh();
+            width = win_props.main_width - 2;
+            height = win_props.main_height - 3;
+            draw_view_frame(modal, bar, title, editor_actions);
+        }
+        editor_draw(modal, width, height);
+        wrefresh(modal);
+    }
+    gap_free(gap);
+    delwin(modal);
+    delwin(bar);
+    redraw();
+}
+
+int show_modal_add() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_writable()) return 1;
+
+    if(panels[panel].mode != PANEL_TREE) {
+        show_modal_error("Items can only be added inside a container.");
+        return 1;
+    }
+
+    int ch;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
+    const char* title = "Add New Item";
+    char buf[BUFF_SIZE];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "ITEM NAME: ");
+    mvwaddstr(modal, 7, 1, "NOTE: Any changes made will be committed immediately.");
+    wrefresh(modal);
+    input_string(modal, 1, 12, buf, BUFF_SIZE - 1);
+    if (store->insert(panels[panel].path == NULL ? 0 : panels[panel].parent, buf, NULL, 1) == 0) {
+        show_modal_error("Could not add item to database.");
+        return 1;
+    }
+    delwin(modal);
+    redraw();
+}
+
+int show_modal_rename() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_writable()) return 1;
+
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+    int ch;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
+    const char* title = "Rename Existing Item";
+    char* buf = malloc(BUFF_SIZE);
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "ITEM NAME: ");
+    mvwaddstr(modal, 7, 1, "NOTE: Any changes made will be committed immediately.");
+    wrefresh(modal);
+    input_string(modal, 1, 12, buf, BUFF_SIZE - 1);
+    if (store->rename(entry->id, buf) != 0) {
+        free(buf);
+        delwin(modal);
+        show_modal_error("Could not rename item.");
+        return 1;
+    }
+    free(buf);
+    delwin(modal);
+    redraw();
+}
+
+int show_modal_count() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_writable()) return 1;
+    if(current_item() == NULL) return 1;
+
+    int ch;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
+    const char* title = "Update Item Count";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 6, 1, "NOTE: Any changes made will be committed immediately.");
+    mvwaddstr(modal, 7, 1, "Hit 'Enter' to close this window");
+    wrefresh(modal);
+    int cnt = 0;
+    struct entry_t item;
+    struct arena_t arena = { NULL, NULL };
+    struct entry_t *entry = current_entry();
+    if(store->get(entry->id, &item, &arena)) {
+        cnt = item.count;
+        mvwprintw(modal, 1, 1, "ITEM COUNT: %d", cnt);
+        mvwprintw(modal, 3, 1, "Hit '+' to increment, '-' to decrement");
+        mvwprintw(modal, 4, 1, "Hit 'Tab' to enter a new value");
+        wrefresh(modal);
+        int newvalue = cnt;
+        char buf[256];
+        while ((ch = input_key()) != '\n') {
+            if(ch == '+' || ch == '-' || ch == '\t') {
+                if(ch == '+') newvalue = newvalue + 1;
+                if(ch == '-' && newvalue > 0) newvalue = newvalue - 1;
+                if(ch == '\t') {
+                    mvwhline(modal, 1, 13, ' ', 10);
+                    input_string(modal, 1, 13, buf, sizeof(buf) - 1);
+                    newvalue = atoi(buf);
+                }
+                entry->count = newvalue;
+                mvwhline(modal, 1, 13, ' ', 10);
+                mvwprintw(modal, 1, 13, "%d", newvalue);
+                wrefresh(modal);
+            }
+        }
+        if(store->set_count(entry->id, newvalue) != 0) {
+            arena_free(&arena);
+            show_modal_error("Could not update count.");
+            return 1;
+        }
+    } else {
+        mvwprintw(modal, 1, 1, "ITEM NO LONGER EXISTS");
+        wrefresh(modal);
+        while ((ch = input_key()) != '\n') { }
+    }
+    arena_free(&arena);
+    delwin(modal);
+    redraw();
+}
+
+int show_modal_threshold() {
+    if(!require_sqlite()) return 1;
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(win_props.main_height - 16, width, 8, 3);
+    const char* title = "Update Reorder Threshold";
+    char buf[BUFF_SIZE];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    sqlite3_bind_int(item_threshold_stmt, 1, entry->id);
+    if(sqlite3_step(item_threshold_stmt) == SQLITE_ROW && sqlite3_column_type(item_threshold_stmt, 0) != SQLITE_NULL) {
+        mvwprintw(modal, 3, 1, "CURRENT THRESHOLD: %d", sqlite3_column_int(item_threshold_stmt, 0));
+    } else {
+        mvwaddstr(modal, 3, 1, "CURRENT THRESHOLD: none");
+    }
+    sqlite3_reset(item_threshold_stmt);
+    mvwaddstr(modal, 1, 1, "THRESHOLD: ");
+    mvwaddstr(modal, 5, 1, "Leave empty to remove the threshold.");
+    mvwaddstr(modal, 7, 1, "NOTE: Any changes made will be committed immediately.");
+    wrefresh(modal);
+    input_string(modal, 1, 12, buf, BUFF_SIZE - 1);
+    if(buf[0] == 0) {
+        sqlite3_bind_null(threshold_stmt, 1);
+    } else {
+        sqlite3_bind_int(threshold_stmt, 1, atoi(buf));
+    }
+    sqlite3_bind_int(threshold_stmt, 2, entry->id);
+    if (sqlite3_step(threshold_stmt) != SQLITE_DONE) {
+        sqlite3_reset(threshold_stmt);
+        show_modal_error("Could not update threshold.");
+        return 1;
+    }
+    sqlite3_reset(threshold_stmt);
+    delwin(modal);
+    redraw();
+}
+
+/* Lists the attributes of the current item and sets one from a line such
+   as "voltage=12". Values that read as numbers are stored as numbers
+   unless quoted; an empty value removes the attribute. */
+int show_modal_attributes() {
+    if(!require_writable() || !require_database("Attributes")) return 1;
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+
+    int width = win_props.main_width - 6;
+    int height = win_props.main_height - 8;
+    WINDOW *modal = newwin(height, width, 4, 3);
+    const char* title = "Item Attributes";
+    char buf[BUFF_SIZE * 2];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    int row = 5;
+    sqlite3_bind_int(attr_list_stmt, 1, entry->id);
+    while(row < height - 1 && sqlite3_step(attr_list_stmt) == SQLITE_ROW) {
+        const char* type = sqlite3_column_type(attr_list_stmt, 1) == SQLITE_TEXT ? "text"
+                         : sqlite3_column_type(attr_list_stmt, 1) == SQLITE_INTEGER ? "int" : "real";
+        mvwprintw(modal, row++, 1, "%-20.20s %-4s %.*s", sqlite3_column_text(attr_list_stmt, 0), type,
+                  width - 28, sqlite3_column_text(attr_list_stmt, 1));
+    }
+    sqlite3_reset(attr_list_stmt);
+    if(row == 5) mvwaddstr(modal, row, 1, "(no attributes)");
+    mvwaddstr(modal, 1, 1, "SET: ");
+    mvwaddstr(modal, 3, 1, "Enter key=value; leave the value empty to remove the key.");
+    wrefresh(modal);
+    input_string(modal, 1, 6, buf, sizeof(buf) - 1);
+    delwin(modal);
+
+    char* value = strchr(buf, '=');
+    if(buf[0] != 0) {
+        char* key = buf;
+        if(value == NULL) {
+            show_modal_error("Attributes are set as key=value.");
+            return 1;
+        }
+        *value++ = 0;
+        while(*key == ' ') key++;
+        for(char* end = value - 2; end >= key && *end == ' '; end--) *end = 0;
+        while(*value == ' ') value++;
+        size_t length = strlen(value);
+        while(length > 0 && value[length - 1] == ' ') value[--length] = 0;
+        if(*key == 0) {
+            show_modal_error("Attributes are set as key=value.");
+            return 1;
+        }
+        sqlite3_stmt* stmt = length == 0 ? attr_delete_stmt : attr_set_stmt;
+        sqlite3_bind_int(stmt, 1, entry->id);
+        sqlite3_bind_text(stmt, 2, key, -1, SQLITE_TRANSIENT);
+        if(length >= 2 && (value[0] == '"' || value[0] == '\'') && value[length - 1] == value[0]) {
+            value[length - 1] = 0;
+            sqlite3_bind_text(stmt, 3, value + 1, -1, SQLITE_TRANSIENT);
+        } else if(length > 0) {
+            attr_bind_value(stmt, 3, value, attr_numeric(value));
+        }
+        if(sqlite_write(stmt) != 0) {
+            show_modal_error("Could not update attribute.");
+            return 1;
+        }
+        memory.generation++;
+    }
+    redraw();
+}
+
+/* Lists the files attached to the current item. A path attaches that
+   file, "-name" removes an attachment and "name>path" saves one to a
+   file. The last column counts the items sharing the same content. */
+int show_modal_attachments() {
+    if(!require_writable() || !require_database("Attachments")) return 1;
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+
+    int width = win_props.main_width - 6;
+    int height = win_props.main_height - 8;
+    WINDOW *modal = newwin(height, width, 4, 3);
+    const char* title = "Item Attachments";
+    char buf[BUFF_SIZE * 4];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    int row = 5;
+    sqlite3_bind_int(attach_list_stmt, 1, entry->id);
+    while(row < height - 1 && sqlite3_step(attach_list_stmt) == SQLITE_ROW) {
+        mvwprintw(modal, row++, 1, "%-*.*s %10lld  %.12s  %d", width - 35, width - 35, sqlite3_column_text(attach_list_stmt, 0),
+                  sqlite3_column_int64(attach_list_stmt, 1), sqlite3_column_text(attach_list_stmt, 2), sqlite3_column_int(attach_list_stmt, 3));
+    }
+    sqlite3_reset(attach_list_stmt);
+    if(row == 5) mvwaddstr(modal, row, 1, "(no attachments)");
+    mvwaddstr(modal, 1, 1, "FILE: ");
+    mvwaddstr(modal, 3, 1, "Enter a path to attach, -name to remove, name>path to save a copy.");
+    wrefresh(modal);
+    input_string(modal, 1, 7, buf, sizeof(buf) - 1);
+    delwin(modal);
+
+    char* target = strchr(buf, '>');
+    if(buf[0] == '-') {
+        sqlite3_bind_int(attach_unlink_stmt, 1, entry->id);
+        sqlite3_bind_text(attach_unlink_stmt, 2, buf + 1, -1, SQLITE_STATIC);
+        if(sqlite_write(attach_unlink_stmt) != 0 || sqlite3_changes(db) == 0) {
+            show_modal_error("No such attachment.");
+            return 1;
+        }
+    } else if(target != NULL) {
+        *target++ = 0;
+        if(attachment_save(entry->id, buf, target) != 0) {
+            show_modal_error("Could not save attachment.");
+            return 1;
+        }
+    } else if(buf[0] != 0) {
+        if(attachment_add(entry->id, buf) != 0) {
+            show_modal_error("Could not attach file.");
+            return 1;
+        }
+    }
+    redraw();
+}
+
+// Picks the attribute shown between the name and quantity columns
+int show_modal_column() {
+    if(!require_database("Attributes")) return 1;
+    struct panel_t* p = &panels[panel];
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(8, width, (win_props.main_height - 8) / 2, 3);
+    const char* title = "Attribute Column";
+    char buf[BUFF_SIZE];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "ATTRIBUTE: ");
+    mvwprintw(modal, 3, 1, "CURRENT COLUMN: %s", p->column != NULL ? p->column : "none");
+    mvwaddstr(modal, 5, 1, "Leave empty to hide the column.");
+    wrefresh(modal);
+    input_string(modal, 1, 12, buf, BUFF_SIZE - 1);
+    delwin(modal);
+    free(p->column);
+    p->column = buf[0] != 0 ? strdup(buf) : NULL;
+    redraw();
+}
+
+int show_modal_stats() {
+    int ch;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(14, width, (win_props.main_height - 14) / 2, 3);
+    const char* title = "Storage Statistics";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwprintw(modal, 1, 1, "STORE:         %s", store != NULL ? store->name : "none");
+    if(store == &memory_store) {
+        mvwprintw(modal, 2, 1, "ITEMS:         %d (%d slots)", memory.live, memory.count);
+        mvwprintw(modal, 3, 1, "STRINGS:       %d interned", memory.strings.count);
+        mvwprintw(modal, 4, 1, "LOAD TIME:     %.1f ms", memory.load_ms);
+        mvwprintw(modal, 5, 1, "LAST SEARCH:   %.1f ms on %d threads", memory.search_ms, memory.search_threads);
+        mvwprintw(modal, 6, 1, "WRITE-BEHIND:  %s", db != NULL ? "on" : "off, scratch inventory");
+        mvwprintw(modal, 7, 1, "PENDING:       %d changes", write_queue.count);
+        mvwprintw(modal, 8, 1, "WRITTEN:       %ld changes in %d batches", write_queue.flushed, write_queue.batches);
+        mvwprintw(modal, 9, 1, "LAST BATCH:    %.1f ms", write_queue.last_batch_ms);
+    }
+    mvwprintw(modal, 10, 1, "PATH NODES:    %d in use, %d pooled, %d names", allocations.paths, allocations.pooled, allocations.path_names);
+    mvwprintw(modal, 11, 1, "ENTRY PAGES:   %d outside the panels", allocations.entry_pages);
+    mvwaddstr(modal, 12, 1, "Hit 'Enter' to close this window");
+    wrefresh(modal);
+    while ((ch = input_key()) != '\n') { }
+    delwin(modal);
+    redraw();
+}
+
+/* Starts a backup of the open database, which is copied a few pages at a
+   time whenever no key is pressed, and shows how the last one went. */
+int show_modal_backup() {
+    if(!require_database("Backups")) return 1;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(10, width, (win_props.main_height - 10) / 2, 3);
+    const char* title = "Backup";
+    char buf[256];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "FILE: ");
+    if(maintenance.backup != NULL) {
+        mvwprintw(modal, 3, 1, "RUNNING:  %d of %d pages to %s", maintenance.pages - maintenance.remaining, maintenance.pages, maintenance.file);
+    } else if(maintenance.file[0] != 0) {
+        mvwprintw(modal, 3, 1, "LAST:     %s %s, %d pages in %.0f ms", maintenance.failed ? "failed," : "written to",
+                  maintenance.file, maintenance.pages, maintenance.backup_ms);
+    }
+    mvwprintw(modal, 4, 1, "FREE:     %lld of %lld pages%s", sqlite_query_int(db, "pragma freelist_count", 0, 0),
+              sqlite_query_int(db, "pragma page_count", 0, 0),
+              sqlite_query_int(db, "pragma auto_vacuum", 0, 0) == 2 ? "" : ", kept until 'invc --compact'");
+    mvwprintw(modal, 5, 1, "UPKEEP:   %d runs, %ld pages released, last took %.1f ms", maintenance.runs, maintenance.released, maintenance.last_ms);
+    mvwaddstr(modal, 7, 1, "Work goes on while the copy is made. Leave empty to close.");
+    wrefresh(modal);
+    input_string(modal, 1, 7, buf, sizeof(buf) - 1);
+    delwin(modal);
+    if(buf[0] != 0) {
+        memory_flush();
+        if(maintenance.backup != NULL) {
+            show_modal_error("A backup is already running.");
+        } else if(backup_start(db, buf) != 0) {
+            show_modal_error("Can't write a backup to that file.");
+        }
+    }
+    redraw();
+}
+
+int show_modal_save_query() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_sqlite()) return 1;
+
+    const char* labels[] = {"QUERY NAME: ", "NAME LIKE:  ", "TEXT LIKE:  ", "MIN QTY:    ", "MAX QTY:    "};
+    char buf[ARRLEN(labels)][BUFF_SIZE];
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(11, width, (win_props.main_height - 11) / 2, 3);
+    const char* title = "Save Query As Virtual Container";
+    int scoped = panels[panel].mode == PANEL_TREE && panels[panel].path != NULL;
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    for(int i = 0; i < ARRLEN(labels); i++) {
+        mvwaddstr(modal, i + 1, 1, labels[i]);
+    }
+    if(scoped) {
+        mvwprintw(modal, 7, 1, "SCOPE: everything below container %d", panels[panel].parent);
+    } else {
+        mvwaddstr(modal, 7, 1, "SCOPE: the whole inventory");
+    }
+    mvwaddstr(modal, 9, 1, "Leave a field empty to not filter on it.");
+    wrefresh(modal);
+    for(int i = 0; i < ARRLEN(labels); i++) {
+        input_string(modal, i + 1, 1 + strlen(labels[i]), buf[i], BUFF_SIZE - 1);
+    }
+    delwin(modal);
+    if(buf[0][0] == 0) {
+        redraw();
+        return 1;
+    }
+    for(int i = 0; i < ARRLEN(labels); i++) {
+        if(buf[i][0] == 0) {
+            sqlite3_bind_null(insert_query_stmt, i + 1);
+        } else if(i >= 3) {
+            sqlite3_bind_int(insert_query_stmt, i + 1, atoi(buf[i]));
+        } else {
+            sqlite3_bind_text(insert_query_stmt, i + 1, buf[i], strlen(buf[i]), SQLITE_STATIC);
+        }
+    }
+    if(scoped) {
+        sqlite3_bind_int(insert_query_stmt, 6, panels[panel].parent);
+    } else {
+        sqlite3_bind_null(insert_query_stmt, 6);
+    }
+    if (sqlite3_step(insert_query_stmt) != SQLITE_DONE) {
+        sqlite3_reset(insert_query_stmt);
+        show_modal_error("Could not save query.");
+        return 1;
+    }
+    sqlite3_reset(insert_query_stmt);
+    redraw();
+}
+
+int history_ranges[] = {7, 30, 90, 365};
+// Marks days with no known level; any count, negative ones too, is a level
+#define HISTORY_NONE INT_MIN
+const char history_levels[] = " .:-=+*#%@";
+
+int show_modal_history() {
+    if(!require_sqlite()) return 1;
+    struct entry_t* entry = current_item();
+    if(entry == NULL) return 1;
+
+    int ch = 0, range = 1;
+    int width = win_props.main_width - 6;
+    int columns = width - 4;
+    WINDOW *modal = newwin(12, width, (win_props.main_height - 12) / 2, 3);
+    const char* title = "Item Stock History";
+    int* daily = malloc(sizeof(int) * history_ranges[ARRLEN(history_ranges) - 1]);
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwprintw(modal, 1, 2, "ITEM: %d %.*s", entry->id, width - 20, entry->name != NULL ? entry->name : "");
+    mvwaddstr(modal, 10, 2, "Hit 'Tab' to change the range, 'Enter' to close");
+    do {
+        if(ch == '\t') range = (range + 1) % ARRLEN(history_ranges);
+        int days = history_ranges[range];
+        int today = time(NULL) / 86400;
+        int first = today - days + 1;
+        int level = HISTORY_NONE, low = HISTORY_NONE, high = HISTORY_NONE, changes = 0, s;
+
+        // Level carried in from the last bucket before the range, if any
+        sqlite3_bind_int(history_carry_stmt, 1, entry->id);
+        sqlite3_bind_int(history_carry_stmt, 2, first);
+        if(sqlite3_step(history_carry_stmt) == SQLITE_ROW) {
+            level = low = high = sqlite3_column_int(history_carry_stmt, 0);
+        }
+        sqlite3_reset(history_carry_stmt);
+
+        for(int d = 0; d < days; d++) daily[d] = HISTORY_NONE;
+        sqlite3_bind_int(history_stmt, 1, entry->id);
+        sqlite3_bind_int(history_stmt, 2, first);
+        sqlite3_bind_int(history_stmt, 3, today);
+        while ((s = sqlite3_step(history_stmt)) == SQLITE_ROW) {
+            int bucket_low = sqlite3_column_int(history_stmt, 1);
+            int bucket_high = sqlite3_column_int(history_stmt, 2);
+            daily[sqlite3_column_int(history_stmt, 0) - first] = sqlite3_column_int(history_stmt, 3);
+            changes += sqlite3_column_int(history_stmt, 4);
+            if(low == HISTORY_NONE || bucket_low < low) low = bucket_low;
+            if(bucket_high > high) high = bucket_high;
+        }
+        sqlite3_reset(history_stmt);
+
+        // Days without changes keep the level of the day before
+        long sum = 0;
+        int known = 0;
+        for(int d = 0; d < days; d++) {
+            if(daily[d] == HISTORY_NONE) daily[d] = level; else level = daily[d];
+            if(daily[d] != HISTORY_NONE) { sum += daily[d]; known++; }
+        }
+
+        mvwhline(modal, 2, 2, ' ', width - 4);
+        mvwprintw(modal, 2, 2, "RANGE: last %d days", days);
+        mvwhline(modal, 4, 2, ' ', columns);
+        int shown = days < columns ? days : columns;
+        for(int c = 0; c < shown; c++) {
+            // Each column averages the days that fall into it
+            long column_sum = 0;
+            int column_known = 0;
+            for(int d = c * days / shown; d < (c + 1) * days / shown; d++) {
+                if(daily[d] != HISTORY_NONE) { column_sum += daily[d]; column_known++; }
+            }
+            if(column_known == 0) continue;
+            int value = column_sum / column_known;
+            int step = high > low ? ((long long)value - low) * (int)(sizeof(history_levels) - 2) / ((long long)high - low) : (sizeof(history_levels) - 2) / 2;
+            mvwaddch(modal, 4, 2 + c, history_levels[step]);
+        }
+        char date[16];
+        time_t stamp = (time_t)first * 86400;
+        strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&stamp));
+        mvwhline(modal, 5, 2, ' ', columns);
+        mvwaddstr(modal, 5, 2, date);
+        stamp = (time_t)today * 86400;
+        strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&stamp));
+        mvwaddstr(modal, 5, 2 + shown - strlen(date), date);
+        mvwhline(modal, 7, 2, ' ', width - 4);
+        mvwhline(modal, 8, 2, ' ', width - 4);
+        if(known > 0) {
+            mvwprintw(modal, 7, 2, "MIN: %d  MAX: %d  AVG: %.1f", low, high, (double)sum / known);
+        } else {
+            mvwaddstr(modal, 7, 2, "No recorded changes in this range");
+        }
+        mvwprintw(modal, 8, 2, "CHANGES: %d", changes);
+        wrefresh(modal);
+    } while ((ch = input_key()) != '\n');
+    free(daily);
+    delwin(modal);
+    redraw();
+}
+
+/* Pick lists. Each line's item and every container above it are read in
+   one query, and the list is put in depth-first order of the container
+   tree, so every container is entered once and left once: the shortest
+   walk that reaches every line. Siblings follow their PICK_POSITION
+   attribute where they have one, then their id. */
+struct pick_step_t {
+    int id;
+    int placed;
+    double position;
+    const char* name;
+};
+
+struct pick_line_t {
+    const char* ref;
+    int id;
+    int quantity;
+    int count;
+    int depth;  // Steps from the top level down to the item itself, 0 if not found
+    struct pick_step_t* steps;
+};
+
+struct pick_list_t {
+    struct pick_line_t* lines;
+    int count;
+    int capacity;
+    struct pick_step_t* steps;
+    struct arena_t arena;
+};
+
+void pick_add(struct pick_list_t* list, const char* ref, size_t length, int quantity) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        list->lines = realloc(list->lines, sizeof(struct pick_line_t) * list->capacity);
+    }
+    struct pick_line_t* line = &list->lines[list->count++];
+    memset(line, 0, sizeof(struct pick_line_t));
+    line->ref = arena_copy(&list->arena, ref, length);
+    line->quantity = quantity;
+}
+
+/* Entries are "id or name", optionally followed by "*quantity", split by
+   commas or lines. Only a last '*' with nothing but digits after it starts
+   a quantity; any other '*' is part of the name, as in "M3*10 screw". */
+int pick_parse(struct pick_list_t* list, const char* text) {
+    while(*text != 0) {
+        size_t length = strcspn(text, ",\r\n");
+        const char* end = text + length;
+        const char* star = end;
+        while(star > text && star[-1] != '*') star--;
+        const char* digits = star;
+        while(digits < end && (*digits == ' ' || *digits == '\t')) digits++;
+        const char* rest = digits;
+        while(rest < end && isdigit((unsigned char)*rest)) rest++;
+        int counted = star > text && rest > digits;
+        while(rest < end && (*rest == ' ' || *rest == '\t')) rest++;
+        counted = counted && rest == end;
+        int quantity = 1;
+        if(counted) {
+            quantity = strtol(digits, NULL, 10);
+            if(quantity < 1) return 1;
+            end = star - 1;
+        }
+        const char* start = text;
+        while(start < end && (*start == ' ' || *start == '\t')) start++;
+        while(end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if(end > start) {
+            pick_add(list, start, end - start, quantity);
+        } else if(counted) {
+            return 1;
+        }
+        text += length;
+        if(*text != 0) text++;
+    }
+    return 0;
+}
+
+int pick_import(struct pick_list_t* list, const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if(file == NULL) return 1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    int failed = size < 0 || fread(text, 1, size, file) != size;
+    fclose(file);
+    if(!failed) {
+        text[size] = 0;
+        failed = pick_parse(list, text);
+    }
+    free(text);
+    return failed;
+}
+
+// Writes the references as a JSON array, ids as numbers and names as strings
+char* pick_refs(struct pick_list_t* list) {
+    size_t size = 3;
+    for(int i = 0; i < list->count; i++) size += strlen(list->lines[i].ref) * 6 + 3;
+    char* json = malloc(size);
+    char* out = json;
+    *out++ = '[';
+    for(int i = 0; i < list->count; i++) {
+        const char* ref = list->lines[i].ref;
+        if(i > 0) *out++ = ',';
+        if(strspn(ref, "0123456789") == strlen(ref) && strlen(ref) < 10) {
+            out += sprintf(out, "%d", atoi(ref));
+            continue;
+        }
+        *out++ = '"';
+        for(const unsigned char* c = (const unsigned char*)ref; *c != 0; c++) {
+            if(*c == '"' || *c == '\\') {
+                *out++ = '\\';
+                *out++ = *c;
+            } else if(*c < 0x20) {
+                out += sprintf(out, "\\u%04x", *c);
+            } else {
+                *out++ = *c;
+            }
+        }
+        *out++ = '"';
+    }
+    strcpy(out, "]");
+    return json;
+}
+
+/* Rows come back item first and ordered by line, so each line's rows are
+   contiguous and are turned around to read from the top level down. */
+int pick_resolve(struct pick_list_t* list) {
+    int total = 0, capacity = list->count * 4 + 16, s;
+    int* first = malloc(sizeof(int) * (list->count + 1));
+    list->steps = malloc(sizeof(struct pick_step_t) * capacity);
+    sqlite3_bind_text(pick_path_stmt, 1, pick_refs(list), -1, free);
+    while((s = sqlite3_step(pick_path_stmt)) == SQLITE_ROW) {
+        struct pick_line_t* line = &list->lines[sqlite3_column_int(pick_path_stmt, 0)];
+        if(sqlite3_column_int(pick_path_stmt, 1) == 0) {
+            line->id = sqlite3_column_int(pick_path_stmt, 2);
+            line->count = sqlite3_column_int(pick_path_stmt, 4);
+            first[line - list->lines] = total;
+        }
+        if(total == capacity) list->steps = realloc(list->steps, sizeof(struct pick_step_t) * (capacity *= 2));
+        struct pick_step_t* step = &list->steps[total++];
+        step->id = sqlite3_column_int(pick_path_stmt, 2);
+        step->name = arena_copy(&list->arena, sqlite3_column_text(pick_path_stmt, 3), sqlite3_column_bytes(pick_path_stmt, 3));
+        step->placed = sqlite3_column_type(pick_path_stmt, 5) != SQLITE_NULL;
+        step->position = sqlite3_column_double(pick_path_stmt, 5);
+        line->depth++;
+    }
+    sqlite3_reset(pick_path_stmt);
+    for(int i = 0; i < list->count; i++) {
+        struct pick_line_t* line = &list->lines[i];
+        if(line->depth == 0) continue;
+        line->steps = list->steps + first[i];
+        for(int a = 0, b = line->depth - 1; a < b; a++, b--) {
+            struct pick_step_t swap = line->steps[a];
+            line->steps[a] = line->steps[b];
+            line->steps[b] = swap;
+        }
+    }
+    free(first);
+    return s != SQLITE_DONE;
+}
+
+// Lines not found come first, the rest in depth-first order
+int pick_compare(const void* a, const void* b) {
+    const struct pick_line_t *x = a, *y = b;
+    if(x->depth == 0 || y->depth == 0) return (y->depth == 0) - (x->depth == 0);
+    for(int i = 0; i < x->depth && i < y->depth; i++) {
+        const struct pick_step_t *s = &x->steps[i], *t = &y->steps[i];
+        if(s->id == t->id) continue;
+        if(s->placed != t->placed) return t->placed - s->placed;
+        if(s->placed && s->position != t->position) return s->position < t->position ? -1 : 1;
+        return s->id < t->id ? -1 : 1;
+    }
+    return x->depth - y->depth;
+}
+
+// Containers shared by the places two lines are picked from
+int pick_shared(const struct pick_line_t* a, const struct pick_line_t* b) {
+    int shared = 0;
+    while(shared < a->depth - 1 && shared < b->depth - 1 && a->steps[shared].id == b->steps[shared].id) shared++;
+    return shared;
+}
+
+// Containers entered or left going down the list from the top level
+int pick_walk(struct pick_list_t* list) {
+    int walk = 0;
+    const struct pick_line_t* last = NULL;
+    for(int i = 0; i < list->count; i++) {
+        const struct pick_line_t* line = &list->lines[i];
+        if(line->depth == 0) continue;
+        int shared = last != NULL ? pick_shared(last, line) : 0;
+        walk += (last != NULL ? last->depth - 1 - shared : 0) + line->depth - 1 - shared;
+        last = line;
+    }
+    return walk;
+}
+
+// Sorted lines of the same item become one
+void pick_merge(struct pick_list_t* list) {
+    int kept = 0;
+    for(int i = 0; i < list->count; i++) {
+        struct pick_line_t* line = &list->lines[i];
+        if(kept > 0 && line->depth > 0 && list->lines[kept - 1].id == line->id) {
+            list->lines[kept - 1].quantity += line->quantity;
+        } else {
+            list->lines[kept++] = *line;
+        }
+    }
+    list->count = kept;
+}
+
+// All counts go down in one statement and one transaction, or none do
+int pick_take(struct pick_list_t* list) {
+    size_t size = 3;
+    for(int i = 0; i < list->count; i++) size += 26;
+    char* json = malloc(size);
+    char* out = json;
+    *out++ = '[';
+    for(int i = 0; i < list->count; i++) {
+        out += sprintf(out, i > 0 ? ",[%d,%d]" : "[%d,%d]", list->lines[i].id, list->lines[i].quantity);
+    }
+    strcpy(out, "]");
+    if(sqlite3_exec(db, "BEGIN", 0, 0, 0) != SQLITE_OK) {
+        free(json);
+        return 1;
+    }
+    sqlite3_bind_text(pick_take_stmt, 1, json, -1, free);
+    int failed = sqlite_write(pick_take_stmt) != 0 || sqlite3_changes(db) != list->count;
+    if(!failed) failed = sqlite3_exec(db, "COMMIT", 0, 0, 0) != SQLITE_OK;
+    if(failed) sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+    return failed;
+}
+
+void pick_free(struct pick_list_t* list) {
+    free(list->lines);
+    free(list->steps);
+    arena_free(&list->arena);
+}
+
+int pick_short(const struct pick_line_t* line) {
+    return line->depth == 0 || line->quantity > line->count;
+}
+
+void draw_pick_header(WINDOW* modal, int y, int width, const struct pick_line_t* line) {
+    wattron(modal, COLOR_PAIR(4) | WA_BOLD);
+    wmove(modal, y, 2);
+    if(line->depth == 1) waddstr(modal, "(top level)");
+    for(int i = 0; i < line->depth - 1 && getcurx(modal) < width - 2; i++) {
+        if(i > 0) waddstr(modal, " / ");
+        waddnstr(modal, line->steps[i].name, width - 2 - getcurx(modal));
+    }
+    wattroff(modal, COLOR_PAIR(4) | WA_BOLD);
+}
+
+void draw_pick_line(WINDOW* modal, int y, int width, const struct pick_line_t* line) {
+    if(line->depth == 0) {
+        wattron(modal, COLOR_PAIR(5));
+        mvwprintw(modal, y, 4, "%5d x NOT FOUND: %.*s", line->quantity, width - 26, line->ref);
+        wattroff(modal, COLOR_PAIR(5));
+        return;
+    }
+    mvwprintw(modal, y, 4, "%5d x %.*s (%d)", line->quantity, width - 40, line->steps[line->depth - 1].name, line->id);
+    if(pick_short(line)) wattron(modal, COLOR_PAIR(5));
+    mvwprintw(modal, y, width - 24, "STOCK %d%s", line->count, pick_short(line) ? " SHORT" : "");
+    wattroff(modal, COLOR_PAIR(5));
+}
+
+int show_modal_pick() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(!require_sqlite()) return 1;
+
+    char items[PICK_ITEMS_SIZE], filename[BUFF_SIZE];
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(8, width, (win_props.main_height - 8) / 2, 3);
+    const char* title = "Make A Pick List";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "ITEMS: ");
+    mvwaddstr(modal, 2, 1, "FILE:  ");
+    mvwaddstr(modal, 4, 1, "Give ids or names, each with '*quantity' if more than one,");
+    mvwaddstr(modal, 5, 1, "split by commas, or a file of them, one to a line.");
+    mvwaddstr(modal, 6, 1, "Leave both empty to pick the marked items.");
+    wrefresh(modal);
+    input_string(modal, 1, 8, items, sizeof(items) - 1);
+    input_string(modal, 2, 8, filename, sizeof(filename) - 1);
+    delwin(modal);
+
+    struct pick_list_t list;
+    memset(&list, 0, sizeof(list));
+    char message[BUFF_SIZE + 32];
+    message[0] = 0;
+    if(pick_parse(&list, items) != 0) {
+        snprintf(message, sizeof(message), "Could not read the items entered.");
+    } else if(filename[0] != 0 && pick_import(&list, filename) != 0) {
+        snprintf(message, sizeof(message), "Could not read %s.", filename);
+    } else if(list.count == 0) {
+        struct id_list_t* marks = panel_marks(&panels[panel]);
+        for(int i = 0; i < marks->count; i++) {
+            char ref[16];
+            pick_add(&list, ref, snprintf(ref, sizeof(ref), "%d", marks->ids[i]), 1);
+        }
+        if(list.count == 0) snprintf(message, sizeof(message), "Nothing to pick.");
+    }
+    if(message[0] == 0 && pick_resolve(&list) != 0) snprintf(message, sizeof(message), "Could not look up the items.");
+    if(message[0] != 0) {
+        pick_free(&list);
+        show_modal_error(message);
+        return 1;
+    }
+    int entered = pick_walk(&list);
+    qsort(list.lines, list.count, sizeof(struct pick_line_t), pick_compare);
+    pick_merge(&list);
+    int walk = pick_walk(&list);
+
+    // A container heading goes before each run of lines picked from it
+    int* rows = malloc(sizeof(int) * list.count * 2);
+    int total = 0, units = 0, short_lines = 0;
+    for(int i = 0; i < list.count; i++) {
+        const struct pick_line_t* line = &list.lines[i];
+        if(line->depth > 0 && (i == 0 || list.lines[i - 1].depth == 0 || pick_shared(&list.lines[i - 1], line) != line->depth - 1
+                               || list.lines[i - 1].depth != line->depth)) {
+            rows[total++] = -1 - i;
+        }
+        rows[total++] = i;
+        units += line->quantity;
+        if(pick_short(line)) short_lines++;
+    }
+
+    int ch = 0, top = 0, taken = FALSE;
+    int height = win_props.main_height - 4;
+    int shown = height - 4;
+    modal = current_window = newwin(height, width, 2, 3);
+    title = "Pick List";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwprintw(modal, 1, 2, "LINES: %d  UNITS: %d  SHORT: %d  WALK: %d containers, %d as entered",
+              list.count, units, short_lines, walk, entered);
+    mvwaddstr(modal, height - 2, 2, "Hit 't' to take the stock, Up/Down to scroll, 'Enter' to close");
+    do {
+        if(ch == KEY_UP && top > 0) top--;
+        if(ch == KEY_DOWN && top + shown < total) top++;
+        if(ch == KEY_PPAGE) top = top > shown ? top - shown : 0;
+        if(ch == KEY_NPAGE && top + shown < total) top += shown;
+        if(ch == 't') {
+            if(short_lines > 0) {
+                show_modal_error("Some lines are not found or short of stock.");
+            } else if(pick_take(&list) != 0) {
+                show_modal_error("Could not take the stock; nothing was changed.");
+            } else {
+                taken = TRUE;
+                break;
+            }
+        }
+        for(int i = 0; i < shown; i++) {
+            mvwhline(modal, i + 2, 1, ' ', width - 2);
+            if(top + i >= total) continue;
+            int row = rows[top + i];
+            if(row < 0) {
+                draw_pick_header(modal, i + 2, width, &list.lines[-1 - row]);
+            } else {
+                draw_pick_line(modal, i + 2, width, &list.lines[row]);
+            }
+        }
+        wrefresh(modal);
+    } while ((ch = input_key()) != '\n');
+    free(rows);
+    pick_free(&list);
+    delwin(modal);
+    redraw();
+    return taken ? 0 : 1;
+}
+
+int draw_button_bar(WINDOW* win, int y, int x, struct button_t* buttons, int selected) {
+    wmove(win, y, x);
+    for(int i = 0; buttons[i].name != NULL; i++) {
+        if(i == selected) {
+            wattron(win, WA_STANDOUT);
+        } else {
+            wattroff(win, WA_STANDOUT);
+        }
+        waddch(win, '[');
+        wprintw(win, buttons[i].name);
+        waddch(win, ']');
+        wattroff(win, WA_STANDOUT);
+        waddch(win, ' ');
+    }
+    wrefresh(win);
+}
+
+int show_modal_open() {
+    int ch, button = 0;
+    int width_diff = 6;
+    int height_diff = 20;
+    int width = win_props.main_width - width_diff;
+    int height = win_props.main_height - height_diff;
+    WINDOW *modal = newwin(height, width, height_diff / 2, width_diff / 2);
+    const char* title = "Open Database File";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddch(modal, 1, 3, '[');
+    mvwaddch(modal, 1, width - 4, ']');
+    wrefresh(modal);
+    char buf[256];
+    draw_button_bar(modal, 3, 3, file_open_buttons, button);
+    input_string(modal, 1, 4, buf, sizeof(buf) - 1);
+    wmove(modal, 3, 3);
+    wrefresh(modal);
+    while ((ch = input_key()) != '\n') {
+        if(ch == '\t') {
+            button = (button + 1) % (ARRLEN(file_open_buttons) - 1);
+            draw_button_bar(modal, 3, 3, file_open_buttons, button);
+        }
+    }
+    if(file_open_buttons[button].function != NULL) {
+        file_open_buttons[button].function(buf);
+    }
+    delwin(modal);
+    redraw();
+}
+
+int update_searchview() {
+    int i = 0;
+    int reload = (search_panel.offset % win_props.view_limit) == 0 || (search_panel.offset % win_props.view_limit) == win_props.view_limit - 1;
+    // The page is as long as the view; a resize gives it a new length
+    if(search_panel.capacity != win_props.view_limit) {
+        entry_page_free(search_panel.entries);
+        search_panel.entries = entry_page(win_props.view_limit + 1);
+        search_panel.capacity = win_props.view_limit;
+        search_panel.current = NULL;
+        reload = TRUE;
+    }
+    if(reload == TRUE) {
+        arena_reset(&search_panel.arena);
+        i = store->search(&search_panel.reader, search_panel.type, search_panel.query, (search_panel.offset / win_props.view_limit) * win_props.view_limit,
+                          win_props.view_limit, search_panel.entries, &search_panel.arena);
+        while ( i < win_props.view_limit ) {
+            search_panel.entries[i].id = 0;
+            search_panel.entries[i].name = NULL;
+            search_panel.entries[i].snippet = NULL;
+            i++;
+        }
+    }
+
+    i = 0;
+    int name_width = win_props.main_width - 2 - (win_props.int_length * 3) - 3;
+    /* Description searches give half of the name column to the matched
+       text, and searches of all sites a quarter to the site of each row */
+    int match_width = search_panel.type == BY_ABOUT ? name_width / 2 : search_panel.type == BY_SITES ? name_width / 4 : 0;
+    int match_x = 3 + win_props.int_length * 2 + name_width - match_width;
+    mvwaddch(search_panel.win, 0, 1 + win_props.int_length, ACS_TTEE);
+    mvwaddch(search_panel.win, 0, 2 + win_props.int_length * 2, ACS_TTEE);
+    mvwaddch(search_panel.win, 0, 3 + win_props.int_length * 2 + name_width, ACS_TTEE);
+    mvwaddch(search_panel.win, win_props.main_height - 2, 1 + win_props.int_length, ACS_BTEE);
+    mvwaddch(search_panel.win, win_props.main_height - 2, 2 + win_props.int_length * 2, ACS_BTEE);
+    mvwaddch(search_panel.win, win_props.main_height - 2, 3 + win_props.int_length * 2 + name_width, ACS_BTEE);
+
+    wattron(search_panel.win, WA_BOLD);
+    wattron(search_panel.win, COLOR_PAIR(6));
+    mvwprintw(search_panel.win, 1, 1, "%s", "ID");
+    wattroff(search_panel.win, COLOR_PAIR(6));
+    mvwaddch(search_panel.win, 1, 1 + win_props.int_length, ACS_VLINE);
+    wattron(search_panel.win, COLOR_PAIR(6));
+    mvwprintw(search_panel.win, 1, 2 + win_props.int_length, "%s", "PID");
+    wattroff(search_panel.win, COLOR_PAIR(6));
+    mvwaddch(search_panel.win, 1, 2 + win_props.int_length * 2, ACS_VLINE);
+    wattron(search_panel.win, COLOR_PAIR(6));
+    mvwprintw(search_panel.win, 1, 3 + win_props.int_length * 2, "%s", "Item Name");
+    wattroff(search_panel.win, COLOR_PAIR(6));
+    if(match_width > 0) {
+        // No tee on the top border, where it would cut into the title
+        mvwaddch(search_panel.win, win_props.main_height - 2, match_x - 1, ACS_BTEE);
+        mvwaddch(search_panel.win, 1, match_x - 1, ACS_VLINE);
+        wattron(search_panel.win, COLOR_PAIR(6));
+        mvwprintw(search_panel.win, 1, match_x, "%s", search_panel.type == BY_SITES ? "Site" : "Match");
+        wattroff(search_panel.win, COLOR_PAIR(6));
+    }
+    mvwaddch(search_panel.win, 1, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
+    wattron(search_panel.win, COLOR_PAIR(6));
+    mvwprintw(search_panel.win, 1, 4 + win_props.int_length * 2 + name_width, "%s", "Qty");
+    wattroff(search_panel.win, COLOR_PAIR(6));
+    wattroff(search_panel.win, WA_BOLD);
+    while ( search_panel.entries[i].id > 0 ) {
+        if(i == ((search_panel.offset)% win_props.view_limit)) {
+            search_panel.current = &(search_panel.entries[i]);
+            wattron(search_panel.win, WA_STANDOUT);
+        }
+        //mvwprintw(search_panel.win, i + 2, 1, "%d %d %s %d", id, parent, name, count);
+        mvwhline(search_panel.win, i + 2, 1, ' ', win_props.main_width - 2);
+        mvwprintw(search_panel.win, i + 2, 1, "%d", search_panel.entries[i].id);
+        mvwaddch(search_panel.win, i + 2, 1 + win_props.int_length, ACS_VLINE);
+        mvwprintw(search_panel.win, i + 2, 2 + win_props.int_length, "%d", search_panel.entries[i].parent);
+        mvwaddch(search_panel.win, i + 2, 2 + win_props.int_length * 2, ACS_VLINE);
+        if(search_panel.entries[i].name != NULL) {
+            mvwprintw(search_panel.win, i + 2, 3 + win_props.int_length * 2, "%s", search_panel.entries[i].name);
+        }
+        if(match_width > 0) {
+            mvwhline(search_panel.win, i + 2, match_x - 1, ' ', match_width);
+            mvwaddch(search_panel.win, i + 2, match_x - 1, ACS_VLINE);
+            const char* match = search_panel.type == BY_SITES ? sites[search_panel.entries[i].site].name : search_panel.entries[i].snippet;
+            if(match != NULL) {
+                mvwprintw(search_panel.win, i + 2, match_x, "%.*s", match_width - 1, match);
+            }
+        }
+        mvwaddch(search_panel.win, i + 2, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
+        mvwprintw(search_panel.win, i + 2, 4 + win_props.int_length * 2 + name_width, "%d", search_panel.entries[i].count);
+        wattroff(search_panel.win, WA_STANDOUT);
+        i++;
+    }
+    while ( i < win_props.view_limit ) {
+        mvwhline(search_panel.win, i + 2, 1, ' ', win_props.main_width - 2);
+        mvwaddch(search_panel.win, i + 2, 1 + win_props.int_length, ACS_VLINE);
+        mvwaddch(search_panel.win, i + 2, 2 + win_props.int_length * 2, ACS_VLINE);
+        if(match_width > 0) mvwaddch(search_panel.win, i + 2, match_x - 1, ACS_VLINE);
+        mvwaddch(search_panel.win, i + 2, 3 + win_props.int_length * 2 + name_width, ACS_VLINE);
+        i++;
+    }
+    //mvwprintw(search_panel.win, 0, 0, "%d", search_panel.offset);
+    wrefresh(search_panel.win);
+}
+
+int search_offset_dec() {
+    if(search_panel.offset > 0) {
+        search_panel.offset--;
+        update_searchview();
+    }
+}
+
+int search_offset_inc() {
+    if(search_panel.offset < search_panel.count - 1) {
+        search_panel.offset++;
+        update_searchview();
+    }
+}
+
+int search_offset_pgdn() {
+    if((search_panel.offset / win_props.view_limit) * win_props.view_limit + win_props.view_limit < search_panel.count) {
+        search_panel.offset = (search_panel.offset / win_props.view_limit) * win_props.view_limit + win_props.view_limit;
+        update_searchview();
+    }
+}
+
+int search_offset_pgup() {
+    if(search_panel.offset >= win_props.view_limit) {
+        search_panel.offset = (search_panel.offset / win_props.view_limit) * win_props.view_limit - win_props.view_limit;
+        update_searchview();
+    }
+}
+
+struct path_t* search_build_path(int item) {
+    if(item == 0) return NULL; // item == 0 => root directory
+    return store->path(item);
+}
+
+int search_goto_parent() {
+    // A hit on another site takes the panel there
+    if(search_panel.current->site != panels[panel].site && panel_set_site(&panels[panel], search_panel.current->site) != 0) return 1;
+    panels[panel].parent = search_panel.current->parent;
+    panels[panel].offset = 0;
+    panel_set_path(&panels[panel], site_path(search_panel.current->site, search_panel.current->parent));
+    //fprintf(stderr, "%d\n", panels[panel].parent);
+    update_dataview(&panels[panel], TRUE);
+}
+
+int search_goto() {
+    if(search_panel.current != NULL) {
+        if(search_panel.current->site != panels[panel].site && panel_set_site(&panels[panel], search_panel.current->site) != 0) return 1;
+        panels[panel].parent = search_panel.current->id;
+        panels[panel].offset = 0;
+        panel_set_path(&panels[panel], site_path(search_panel.current->site, search_panel.current->id));
+        //fprintf(stderr, "%d\n", panels[panel].parent);
+        update_dataview(&panels[panel], TRUE);
+    }
+}
+
+int item_search(int type, char* name) {
+    int ch;
+    // One spare entry stays zeroed to end the drawing loop on a full page
+    search_panel.entries = entry_page(win_props.view_limit + 1);
+    search_panel.capacity = win_props.view_limit;
+
+    search_panel.win = newwin(win_props.main_height - 1, win_props.main_width, 0, 0);
+    search_panel.offset = 0;
+    search_panel.count = store->search_count(&search_panel.reader, type, name);
+    search_panel.type = type;
+    search_panel.query = name;
+
+    const char* title = "Item Search Results";
+    WINDOW *bar = newwin(1, win_props.main_width, win_props.main_height - 1, 0);
+    draw_view_frame(search_panel.win, bar, title, search_actions);
+    wrefresh(search_panel.win);
+
+    update_searchview();
+    struct action_source_t source = { .window = search_panel.win };
+    while ((ch = input_key()) != KEY_F(3) && ch != KEY_F(1) && ch != KEY_F(2)) {
+        if(ch == KEY_RESIZE) {
+            layout_update();
+            erase();
+            refresh();
+            draw_view_frame(search_panel.win, bar, title, search_actions);
+            update_searchview();
+        } else if(ch != ERR) {
+            for(int i = 0; i < ARRLEN(search_actions); i++) {
+                if(ch == search_actions[i].key && search_actions[i].function != NULL) {
+                    search_actions[i].function(source);
+                }
+            }
+        }
+    }
+    if(ch != ERR) {
+        for(int i = 0; i < ARRLEN(search_actions); i++) {
+            if(ch == search_actions[i].key && search_actions[i].function != NULL) {
+                search_actions[i].function(source);
+            }
+        }
+    }
+
+
+    delwin(search_panel.win);
+    delwin(bar);
+    entry_page_free(search_panel.entries);
+    search_panel.entries = NULL;
+    search_panel.current = NULL;
+    search_panel.capacity = 0;
+    //redraw();
+}
+
+int item_search_by_name(char* name) {
+    item_search(BY_NAME, name);
 }
 
 int item_search_by_about(char* about) {
     item_search(BY_ABOUT, about);
 }
 
-int show_modal_search() {
-    if(panels[panel].loaded == FALSE) {
-        show_modal_error("No database loaded.");
-        return 1;
-    }
+int item_search_fuzzy(char* name) {
+    if(strlen(name) < FUZZY_MIN) {
+        show_modal_error("Fuzzy search needs at least three characters.");
+        return 1;
+    }
+    item_search(BY_FUZZY, name);
+}
+
+int item_search_attr(char* query) {
+    struct attr_term_t terms[ATTR_TERMS];
+    if(!require_database("Attributes")) return 1;
+    if(attr_parse(query, terms) <= 0) {
+        show_modal_error("Attribute searches look like: voltage>=12 colour=red");
+        return 1;
+    }
+    item_search(BY_ATTR, query);
+}
+
+// Names across the open database and every site attached so far
+int item_search_sites(char* name) {
+    if(federation_open() != 0) return 1;
+    item_search(BY_SITES, name);
+}
+
+int show_modal_search() {
+    if(panels[panel].loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+
+    int ch, button = 0;
+    int width_diff = 6;
+    int height_diff = 20;
+    int width = win_props.main_width - width_diff;
+    int height = win_props.main_height - height_diff;
+    WINDOW *modal = newwin(height, width, height_diff / 2, width_diff / 2);
+    const char* title = "Search For Item";
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddch(modal, 1, 3, '[');
+    mvwaddch(modal, 1, width - 4, ']');
+    wrefresh(modal);
+    char buf[256];
+    draw_button_bar(modal, 3, 3, item_search_buttons, button);
+    input_string(modal, 1, 4, buf, sizeof(buf) - 1);
+    wmove(modal, 3, 3);
+    wrefresh(modal);
+    while ((ch = input_key()) != '\n') {
+        if(ch == '\t') {
+            button = (button + 1) % (ARRLEN(item_search_buttons) - 1);
+            draw_button_bar(modal, 3, 3, item_search_buttons, button);
+        }
+    }
+    if(item_search_buttons[button].function != NULL) {
+        item_search_buttons[button].function(buf);
+    }
+    delwin(modal);
+    redraw();
+}
+
+int reader_open(struct reader_t* reader, const char* filename) {
+    struct { const char* sql; sqlite3_stmt** stmt; } statements[] = {
+        {SQL_COUNT_CHILDREN, &reader->count},
+        {SQL_BY_NAME, &reader->by_name},
+        {SQL_BY_ABOUT, &reader->by_about},
+        {SQL_COUNT_BY_NAME, &reader->count_by_name},
+        {SQL_COUNT_BY_ABOUT, &reader->count_by_about},
+        {SQL_FUZZY, &reader->fuzzy},
+        {SQL_COUNT_FUZZY, &reader->count_fuzzy}
+    };
+    if(sqlite3_open_v2(filename, &reader->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(reader->db);
+        reader->db = NULL;
+        return 1;
+    }
+    sqlite3_busy_timeout(reader->db, 1000);
+    sqlite3_create_function(reader->db, "invc_fuzzy", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_fuzzy, NULL, NULL);
+    sqlite3_create_function(reader->db, "invc_snippet", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_snippet, NULL, NULL);
+    sqlite3_create_function(reader->db, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+    for(int i = 0; i < ARRLEN(statements); i++) {
+        if(sqlite3_prepare_v2(reader->db, statements[i].sql, -1, statements[i].stmt, 0) != SQLITE_OK) {
+            reader_close(reader);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void reader_close(struct reader_t* reader) {
+    sqlite3_stmt* statements[] = {reader->count, reader->by_name, reader->by_about, reader->count_by_name,
+                                  reader->count_by_about, reader->fuzzy, reader->count_fuzzy};
+    free(reader->sorted.refs);
+    memset(&reader->sorted, 0, sizeof(struct sorted_t));
+    if(reader->db == NULL) return;
+    /* Only the reader's own statements are finalized here. The trigram
+       table holds statements of its own, which closing the table finalizes;
+       finalizing them first would free them twice. */
+    for(int i = 0; i < SORT_MODES; i++) {
+        for(int j = 0; j < SEEK_KINDS; j++) sqlite3_finalize(reader->children[i][j]);
+    }
+    for(int i = 0; i < ARRLEN(statements); i++) {
+        sqlite3_finalize(statements[i]);
+    }
+    sqlite3_close(reader->db);
+    memset(reader, 0, sizeof(struct reader_t));
+}
+
+/* Opens the federation connection on the open database, which becomes
+   site 0 under its schema name main. Sites are attached there and not on
+   the primary connection, since ATTACH changes the schema and would expire
+   every statement prepared on it. */
+int federation_open() {
+    if(federation != NULL) return 0;
+    const char* path = db != NULL ? sqlite3_db_filename(db, "main") : NULL;
+    char* file = store == &sqlite_store && path != NULL && path[0] != 0 ? realpath(path, NULL) : NULL;
+    if(file == NULL) {
+        show_modal_error("Sites need a database file opened without --memory.");
+        return 1;
+    }
+    if(sqlite3_open(file, &federation) != SQLITE_OK) {
+        sqlite3_close(federation);
+        federation = NULL;
+        free(file);
+        show_modal_error("Can't open database.");
+        return 1;
+    }
+    sqlite3_busy_timeout(federation, 1000);
+    sqlite3_create_function(federation, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+    sqlite3_exec(federation, "CREATE TEMP TABLE IF NOT EXISTS copy_map(old INTEGER PRIMARY KEY, new INT NOT NULL);", 0, 0, NULL);
+    federation_session = sync_start(federation);
+    strcpy(sites[0].alias, "main");
+    sites[0].file = file;
+    sites[0].name = strrchr(file, '/') + 1;
+    site_count = 1;
+    return 0;
+}
+
+/* Attaches a site database, or finds it among those already attached.
+   Gives its index, or -1 once it has said why the file cannot be shown. */
+int site_attach(const char* filename) {
+    if(federation_open() != 0) return -1;
+    char* file = realpath(filename, NULL);
+    if(file == NULL) {
+        show_modal_error("Can't open site database.");
+        return -1;
+    }
+    for(int i = 0; i < site_count; i++) {
+        if(strcmp(sites[i].file, file) == 0) {
+            free(file);
+            return i;
+        }
+    }
+    if(site_count == SITE_MAX) {
+        free(file);
+        show_modal_error("No more sites can be open at once.");
+        return -1;
+    }
+    struct site_t* site = &sites[site_count];
+    snprintf(site->alias, sizeof(site->alias), "site%d", site_count);
+    char* sql = sqlite3_mprintf("ATTACH %Q AS \"%w\"", file, site->alias);
+    int rc = sqlite3_exec(federation, sql, 0, 0, 0);
+    sqlite3_free(sql);
+    // Only a file invc has opened has the index and tables a site needs
+    int ready = FALSE;
+    if(rc == SQLITE_OK) {
+        sqlite3_stmt* stmt;
+        sql = sqlite3_mprintf("select count(*) from \"%w\".sqlite_master " \
+                              "where name in ('item_trigram', 'item_attr', 'item_attachment', 'about_dictionary', 'sync_state')", site->alias);
+        if(sqlite3_prepare_v2(federation, sql, -1, &stmt, 0) == SQLITE_OK) {
+            ready = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 5;
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_free(sql);
+        if(!ready) {
+            sql = sqlite3_mprintf("DETACH \"%w\"", site->alias);
+            sqlite3_exec(federation, sql, 0, 0, 0);
+            sqlite3_free(sql);
+        }
+    }
+    if(!ready) {
+        free(file);
+        show_modal_error(rc == SQLITE_OK ? "Open the site database with invc once first." : "Can't open site database.");
+        return -1;
+    }
+    site->file = file;
+    site->name = strrchr(file, '/') + 1;
+    // Descriptions of the site may be deflated with dictionaries of its own
+    about_dictionaries_load(federation);
+    trigram_catch_up(federation, site->alias);
+    return site_count++;
+}
+
+/* Points a panel at the root of a site. The panel reads it through a
+   reader of its own on the site's file, as it reads the open database. */
+int panel_set_site(struct panel_t* p, int site) {
+    struct reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    if(reader_open(&reader, sites[site].file) != 0) {
+        show_modal_error("Can't read site database.");
+        return 1;
+    }
+    reader_close(&p->reader);
+    p->reader = reader;
+    panel_set_path(p, NULL);
+    p->parent = 0;
+    p->offset = 0;
+    p->mode = PANEL_TREE;
+    p->marks.count = 0;
+    p->cached = 0;
+    p->site = site;
+    return 0;
+}
+
+int show_modal_site() {
+    struct panel_t* p = &panels[panel];
+    if(p->loaded == FALSE) {
+        show_modal_error("No database loaded.");
+        return 1;
+    }
+    if(federation_open() != 0) return 1;
+    int width = win_props.main_width - 6;
+    WINDOW *modal = newwin(8, width, (win_props.main_height - 8) / 2, 3);
+    const char* title = "Site Database";
+    char buf[256];
+    box(modal, 0, 0);
+    wattron(modal, WA_STANDOUT);
+    mvwprintw(modal, 0, (width - strlen(title))/2, title);
+    wattroff(modal, WA_STANDOUT);
+    mvwaddstr(modal, 1, 1, "FILE: ");
+    mvwprintw(modal, 3, 1, "CURRENT SITE: %s", sites[p->site].name);
+    mvwaddstr(modal, 5, 1, "Leave empty to go back to the open database.");
+    wrefresh(modal);
+    input_string(modal, 1, 7, buf, sizeof(buf) - 1);
+    delwin(modal);
+    int site = buf[0] != 0 ? site_attach(buf) : 0;
+    if(site >= 0 && site != p->site) panel_set_site(p, site);
+    redraw();
+}
+
+// Ancestry of an item of a site, root first, as store->path() gives it
+struct path_t* site_path(int site, int id) {
+    if(site == 0) return search_build_path(id);
+    if(id == 0) return NULL;
+    struct path_t* path = NULL;
+    sqlite3_stmt* stmt;
+    char* sql = sqlite3_mprintf("with recursive up(id, name, parent) as (select id, name, parent from \"%w\".item where id=?1 " \
+                                "union select item.id, item.name, item.parent from \"%w\".item item join up on item.id=up.parent) " \
+                                "select id, name from up", sites[site].alias, sites[site].alias);
+    if(sqlite3_prepare_v2(federation, sql, -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, id);
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            path = path_push(path, sqlite3_column_int(stmt, 0), sqlite3_column_text(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_free(sql);
+    return path;
+}
+
+// Runs one statement on the federation connection, binding :ids and :parent where it has them
+int federation_write(char* sql, const char* ids, int parent) {
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(federation, sql, -1, &stmt, 0);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK) return 1;
+    int index = sqlite3_bind_parameter_index(stmt, ":ids");
+    if(index > 0) sqlite3_bind_text(stmt, index, ids, -1, SQLITE_STATIC);
+    index = sqlite3_bind_parameter_index(stmt, ":parent");
+    if(index > 0) sqlite_bind_parent(stmt, index, parent);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : 1;
+}
+
+int site_reparent(int site, const int* ids, int count, int parent) {
+    char* list = sqlite_id_array(ids, count);
+    int failed = federation_write(sqlite3_mprintf("update \"%w\".item set parent=:parent where id in (select value from json_each(:ids))",
+                                                  sites[site].alias), list, parent);
+    free(list);
+    return failed;
+}
+
+/* Moves subtrees from one site to another on the federation connection.
+   Ids are only unique within a file, so the items are numbered anew in the
+   target's block of ids, like a copy, and then deleted at the source, whose
+   triggers drop their attributes and links. Attachment content is matched
+   by hash and stored once at the target; the dictionaries their
+   descriptions were deflated with go along. A transaction over attached
+   WAL files commits each file on its own, so the copy commits first and
+   the delete after it: a crash in between leaves the items at both sites
+   rather than at neither. */
+int site_transfer(int from, int to, const int* ids, int count, int parent) {
+    const char* s = sites[from].alias;
+    const char* t = sites[to].alias;
+    if(sqlite3_exec(federation, "BEGIN", 0, 0, 0) != SQLITE_OK) return 1;
+    char* list = sqlite_id_array(ids, count);
+    int failed = federation_write(sqlite3_mprintf("delete from temp.copy_map"), list, parent);
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert into temp.copy_map(old, new) " \
+            "with recursive subtree(id) as (select item.id from \"%w\".item item join json_each(:ids) on item.id=json_each.value " \
+            "union select item.id from \"%w\".item item join subtree on item.parent=subtree.id) " \
+            "select id, (select coalesce(max(id), block.base) from \"%w\".item where id between block.base and block.base + 16777215) " \
+            "+ row_number() over (order by id) from subtree, " \
+            "(select coalesce((select replica from \"%w\".sync_state), 0) * 16777216 as base) block",
+            s, s, t, t), list, parent);
+    }
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert or ignore into \"%w\".about_dictionary(id, data) select id, data from \"%w\".about_dictionary", t, s), list, parent);
+    }
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert into \"%w\".item(id, parent, name, about, count, threshold) " \
+            "select copy.new, coalesce(up.new, :parent), item.name, item.about, item.count, item.threshold " \
+            "from temp.copy_map copy join \"%w\".item item on item.id=copy.old left join temp.copy_map up on up.old=item.parent " \
+            "order by copy.new", t, s), list, parent);
+    }
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert into \"%w\".item_attr(item, key, value) " \
+            "select copy.new, attr.key, attr.value from temp.copy_map copy join \"%w\".item_attr attr on attr.item=copy.old", t, s), list, parent);
+    }
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert or ignore into \"%w\".attachment(hash, size, data) select hash, size, data from \"%w\".attachment " \
+            "where id in (select link.blob from temp.copy_map copy join \"%w\".item_attachment link on link.item=copy.old)", t, s, s), list, parent);
+    }
+    if(!failed) {
+        failed = federation_write(sqlite3_mprintf(
+            "insert into \"%w\".item_attachment(item, name, blob) select copy.new, link.name, target.id " \
+            "from temp.copy_map copy join \"%w\".item_attachment link on link.item=copy.old " \
+            "join \"%w\".attachment content on content.id=link.blob join \"%w\".attachment target on target.hash=content.hash", t, s, s, t), list, parent);
+    }
+    if(!failed) failed = sqlite3_exec(federation, "COMMIT", 0, 0, 0) != SQLITE_OK;
+    if(failed) {
+        sqlite3_exec(federation, "ROLLBACK", 0, 0, 0);
+        free(list);
+        return 1;
+    }
+    int removed = sqlite3_exec(federation, "BEGIN", 0, 0, 0) == SQLITE_OK;
+    if(removed) {
+        removed = federation_write(sqlite3_mprintf(
+            "delete from \"%w\".item where id in (select old from temp.copy_map)", s), list, parent) == 0;
+    }
+    if(removed) removed = sqlite3_exec(federation, "COMMIT", 0, 0, 0) == SQLITE_OK;
+    if(!removed) sqlite3_exec(federation, "ROLLBACK", 0, 0, 0);
+    free(list);
+    // The federation connection has no index trigger; both sites catch up
+    trigram_catch_up(federation, s);
+    trigram_catch_up(federation, t);
+    if(!removed) show_modal_error("Items were copied but could not be removed from their site.");
+    return 0;
+}
+
+void close_database() {
+   if(db == NULL) return;
+   memory_flush();
+   query_cache_drop(0);
+   for(int i = 0; i < ARRLEN(panels); i++) {
+       reader_close(&panels[i].reader);
+       // A panel left on another site starts over at the root
+       if(panels[i].site != 0) {
+           panel_set_path(&panels[i], NULL);
+           panels[i].parent = 0;
+           panels[i].offset = 0;
+           panels[i].site = 0;
+       }
+   }
+   reader_close(&search_panel.reader);
+   if(maintenance.backup != NULL) backup_finish(SQLITE_ABORT);
+   sync_record(db, &sync_session, -1);
+   if(sync_session != NULL) sqlite3session_delete(sync_session);
+   sync_session = NULL;
+   if(federation_session != NULL) {
+       sync_record(federation, &federation_session, -1);
+       sqlite3session_delete(federation_session);
+       federation_session = NULL;
+   }
+   sync_base = 0;
+   sqlite3_close(federation);
+   federation = NULL;
+   for(int i = 0; i < site_count; i++) {
+       free(sites[i].file);
+   }
+   site_count = 0;
+   for(int i = 0; i < ARRLEN(database_statements); i++) {
+       sqlite3_finalize(*database_statements[i]);
+       *database_statements[i] = NULL;
+   }
+   for(int i = 0; i < SORT_MODES; i++) {
+       for(int j = 0; j < SEEK_KINDS; j++) sqlite3_finalize(children_stmts[i][j]);
+   }
+   sqlite3_exec(db, "PRAGMA optimize;", 0, 0, NULL);
+   sqlite3_close(db);
+   db = NULL;
+   memset(children_stmts, 0, sizeof(children_stmts));
+   about_dictionaries_free();
+}
+
+int open_database(char* filename) {
+   char *zErrMsg = 0;
+   int rc;
+   char *sql;
+   close_database();
+   for(int i = 0; i < ARRLEN(panels); i++) {
+       panels[i].mode = PANEL_TREE;
+   }
+   if(snapshot_open(filename)) {
+       store = &snapshot_store;
+       for(int i = 0; i < ARRLEN(panels); i++) {
+           panels[i].loaded = TRUE;
+       }
+       return 0;
+   }
+   snapshot_close();
+   store = &sqlite_store;
+   rc = sqlite3_open(filename, &db);
+   if( rc ) {
+      show_modal_error("Can't open database.");
+      exit(0);
+   } else {
+      //fprintf(stderr, "Opened database successfully\n");
+   }
+   // Only takes on a new file; older ones are converted by 'invc --compact'
+   sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL;", 0, 0, NULL);
+   // WAL lets the panel readers keep their snapshots while this connection writes
+   sqlite3_exec(db, "PRAGMA journal_mode=WAL;", 0, 0, NULL);
+   sqlite3_busy_timeout(db, 1000);
+   /* Create SQL statement */
+   sql = "CREATE TABLE item("  \
+         "id     INTEGER PRIMARY KEY NOT NULL," \
+         "parent INT," \
+         "name   TEXT NOT NULL," \
+         "about  TEXT," \
+         "count  INT NOT NULL );";
+
+   /* Execute SQL statement */
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      fprintf(stderr, "SQL error: %s\n", zErrMsg);
+      sqlite3_free(zErrMsg);
+   } else {
+      // fprintf(stderr, "Table created successfully\n");
+   }
+
+   /* Stock ledger: every count change is appended to item_ledger and folded
+      into one item_daily bucket per item and day, so history views never
+      have to scan the raw ledger. */
+   sql = "CREATE TABLE IF NOT EXISTS item_ledger("  \
+         "id     INTEGER PRIMARY KEY NOT NULL," \
+         "item   INT NOT NULL," \
+         "delta  INT NOT NULL," \
+         "stamp  INT NOT NULL," \
+         "user   TEXT );" \
+         "CREATE INDEX IF NOT EXISTS item_ledger_item ON item_ledger(item, stamp);" \
+         "CREATE TABLE IF NOT EXISTS item_daily("  \
+         "item    INT NOT NULL," \
+         "day     INT NOT NULL," \
+         "low     INT NOT NULL," \
+         "high    INT NOT NULL," \
+         "last    INT NOT NULL," \
+         "changes INT NOT NULL," \
+         "PRIMARY KEY(item, day) ) WITHOUT ROWID;";
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create stock ledger tables.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   /* Databases created before reorder thresholds existed get the column
+      added here; on newer files the ALTER fails and is ignored. The partial
+      index only holds rows currently below their threshold, and SQLite keeps
+      it current on every count or threshold write. */
+   sqlite3_exec(db, "ALTER TABLE item ADD COLUMN threshold INT;", 0, 0, NULL);
+   rc = sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS item_below_threshold ON item(id) WHERE count < threshold;", 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create threshold index.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   /* Saved queries act as virtual containers; the parent indexes keep their
+      subtree scopes (and plain container listings) off full table scans.
+      There is one per panel sort order, keyed by the sort column and id and
+      holding every column a listing reads, so a page never visits the
+      table. They replace the narrower indexes of earlier versions. */
+   sql = "CREATE TABLE IF NOT EXISTS saved_query("  \
+         "id         INTEGER PRIMARY KEY NOT NULL," \
+         "name       TEXT NOT NULL," \
+         "name_like  TEXT," \
+         "about_like TEXT," \
+         "min_count  INT," \
+         "max_count  INT," \
+         "scope      INT );" \
+         "DROP INDEX IF EXISTS item_parent;" \
+         "DROP INDEX IF EXISTS item_parent_name;" \
+         "DROP INDEX IF EXISTS item_parent_count;" \
+         "CREATE INDEX IF NOT EXISTS item_parent_by_id ON item(parent, id, name, count);" \
+         "CREATE INDEX IF NOT EXISTS item_parent_by_name ON item(parent, name, id, count);" \
+         "CREATE INDEX IF NOT EXISTS item_parent_by_count ON item(parent, count, id, name);";
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create saved query table.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   // Pick lists may name their items instead of giving ids
+   rc = sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS item_name ON item(name);", 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create item name index.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   // Dictionaries are named by content; trained orders them
+   rc = sqlite3_exec(db, ABOUT_DICTIONARY_TABLE, 0, 0, &zErrMsg);
+   sqlite3_exec(db, "ALTER TABLE about_dictionary ADD COLUMN trained INT;", 0, 0, NULL);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create description dictionary table.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+   about_dictionaries_load(db);
+
+   sqlite3_create_function(db, "invc_user", 0, SQLITE_UTF8, NULL, database_user, NULL, NULL);
+   sqlite3_create_function(db, "invc_fuzzy", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_fuzzy, NULL, NULL);
+   sqlite3_create_function(db, "invc_snippet", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_snippet, NULL, NULL);
+   sqlite3_create_function(db, "invc_about", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, database_about, NULL, NULL);
+
+   /* Trigram index over names and descriptions. As a contentless FTS5
+      table it holds only the trigrams; LIKE searches intersect the trigram
+      lists of the pattern and check the rows left over against item, so
+      only those rows' descriptions are ever inflated. The triggers in the
+      file call nothing of invc's own; see SQL_TRIGRAM_TABLES. Files that
+      predate the index, or hold an older form of it, are indexed once when
+      it is created. */
+   sqlite3_stmt* exists;
+   int indexed = FALSE, current = FALSE;
+   if(sqlite3_prepare_v2(db, "select sql like '%content=''''%' from sqlite_master where name='item_trigram'", -1, &exists, 0) == SQLITE_OK) {
+       indexed = sqlite3_step(exists) == SQLITE_ROW;
+       current = indexed && sqlite3_column_int(exists, 0);
+       sqlite3_finalize(exists);
+   }
+   if(indexed && !current) {
+      indexed = FALSE;
+      rc = sqlite3_exec(db, "DROP TRIGGER IF EXISTS item_trigram_insert;" \
+                            "DROP TRIGGER IF EXISTS item_trigram_delete;" \
+                            "DROP TRIGGER IF EXISTS item_trigram_update;" \
+                            "DROP TABLE item_trigram;" \
+                            "DROP VIEW IF EXISTS item_text;", 0, 0, &zErrMsg);
+      if( rc != SQLITE_OK ){
+         show_modal_error("Could not replace trigram index.");
+         sqlite3_free(zErrMsg);
+         return 1;
+      }
+   }
+   sql = SQL_TRIGRAM_TABLES SQL_TRIGRAM_TRIGGER;
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc == SQLITE_OK && !indexed ){
+      rc = sqlite3_exec(db, "BEGIN;" \
+                            "INSERT INTO item_trigram(rowid, name, about) SELECT id, name, invc_about(about) FROM item;" \
+                            "DELETE FROM item_text_pending;" \
+                            "COMMIT;", 0, 0, &zErrMsg);
+      if( rc != SQLITE_OK ) sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+   }
+   if( rc == SQLITE_OK && trigram_catch_up(db, "main") ) rc = SQLITE_ERROR;
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create trigram index.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   sql = SQL_LEDGER_TRIGGERS;
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create stock ledger triggers.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   /* Typed attributes: the value column has no declared type, so integers,
+      reals and text keep their own storage class and compare as such. The
+      (key, value) index serves attribute predicates and panel columns. */
+   sql = "CREATE TABLE IF NOT EXISTS item_attr("  \
+         "item   INT NOT NULL," \
+         "key    TEXT NOT NULL," \
+         "value  NOT NULL CHECK(typeof(value) IN ('integer', 'real', 'text'))," \
+         "PRIMARY KEY(item, key) ) WITHOUT ROWID;" \
+         "CREATE INDEX IF NOT EXISTS item_attr_value ON item_attr(key, value);" \
+         "CREATE TRIGGER IF NOT EXISTS item_attr_delete AFTER DELETE ON item BEGIN " \
+         "DELETE FROM item_attr WHERE item=old.id;" \
+         "END;";
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create attribute table.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   /* Attachment content is stored once per hash, away from the item rows,
+      with the data column last so listings never read into it. Content no
+      link refers to any more is dropped with its last link. */
+   sql = "CREATE TABLE IF NOT EXISTS attachment("  \
+         "id     INTEGER PRIMARY KEY," \
+         "hash   TEXT NOT NULL UNIQUE," \
+         "size   INT NOT NULL," \
+         "data   BLOB NOT NULL );" \
+         "CREATE TABLE IF NOT EXISTS item_attachment(" \
+         "item   INT NOT NULL," \
+         "name   TEXT NOT NULL," \
+         "blob   INT NOT NULL," \
+         "PRIMARY KEY(item, name) ) WITHOUT ROWID;" \
+         "CREATE INDEX IF NOT EXISTS item_attachment_blob ON item_attachment(blob);" \
+         "CREATE TRIGGER IF NOT EXISTS item_attachment_delete AFTER DELETE ON item BEGIN " \
+         "DELETE FROM item_attachment WHERE item=old.id;" \
+         "END;" \
+         "CREATE TRIGGER IF NOT EXISTS attachment_unused AFTER DELETE ON item_attachment " \
+         "WHEN NOT EXISTS (SELECT 1 FROM item_attachment WHERE blob=old.blob) BEGIN " \
+         "DELETE FROM attachment WHERE id=old.blob;" \
+         "END;";
+
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create attachment tables.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   /* Sync bookkeeping; a file that was never copied for sync is the
+      master, replica 0, and numbers its items from 1. */
+   rc = sqlite3_exec(db, SYNC_TABLES, 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create sync tables.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+   sync_base = sync_replica(db) * SYNC_BLOCK;
+
+   // Statistics stale enough to matter are refreshed before any plan is made
+   sqlite3_exec(db, "PRAGMA optimize=0x10002;", 0, 0, NULL);
+   maintenance.changes = sqlite3_total_changes64(db);
+
+   /* Old to new id mapping for subtree copies; it is per connection and
+      only ever holds the copy in progress. Like every schema change it
+      comes before the statements below are prepared, so that none of them
+      is prepared twice. */
+   rc = sqlite3_exec(db, "CREATE TEMP TABLE IF NOT EXISTS copy_map(old INTEGER PRIMARY KEY, new INT NOT NULL);", 0, 0, &zErrMsg);
+   if( rc != SQLITE_OK ){
+      show_modal_error("Could not create copy mapping table.");
+      sqlite3_free(zErrMsg);
+      return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into item(id, parent, name, about, count) " \
+         "values (coalesce(?1, (select coalesce(max(id), ?6) + 1 from item where id between ?6 and ?6 + 16777215)),?2,?3,?4,?5)",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &insert_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare insert statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select invc_about(about) from item where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &description_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare select description statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "update item set parent=? where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &move_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare get parent statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "update item set parent=?1 where id in (select value from json_each(?2))",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &move_many_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare move selection statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "delete from temp.copy_map",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &copy_clear_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare copy clear statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into temp.copy_map(old, new) " \
+         "with recursive subtree(id) as (select item.id from item join json_each(?1) on item.id=json_each.value " \
+         "union select item.id from item join subtree on item.parent=subtree.id) " \
+         "select id, (select coalesce(max(id), ?2) from item where id between ?2 and ?2 + 16777215) + row_number() over (order by id) from subtree",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &copy_map_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare copy mapping statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into item(id, parent, name, about, count, threshold) " \
+         "select copy.new, coalesce(up.new, ?1), item.name, item.about, item.count, item.threshold " \
+         "from temp.copy_map copy join item on item.id=copy.old left join temp.copy_map up on up.old=item.parent " \
+         "order by copy.new",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &copy_items_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare copy statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into item_attr(item, key, value) select copy.new, attr.key, attr.value from temp.copy_map copy join item_attr attr on attr.item=copy.old",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &copy_attrs_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attribute copy statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into item_attr(item, key, value) select ?2, key, value from item_attr where item=?1",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attr_copy_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare item attribute copy statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select value from item_attr where item=? and key=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attr_get_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attribute statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select key, value from item_attr where item=? order by key",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attr_list_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attribute list statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert or replace into item_attr(item, key, value) values(?, ?, ?)",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attr_set_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare set attribute statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "delete from item_attr where item=? and key=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attr_delete_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare delete attribute statement.");
+     return 1;
+   }
 
-    int ch, button = 0;
-    int width_diff = 6;
-    int height_diff = 20;
-    int width = win_props.main_width - width_diff;
-    int height = win_props.main_height - height_diff;
-    WINDOW *modal = newwin(height, width, height_diff / 2, width_diff / 2);
-    const char* title = "Search For Item";
-    box(modal, 0, 0);
-    wattron(modal, WA_STANDOUT);
-    mvwprintw(modal, 0, (width - strlen(title))/2, title);
-    wattroff(modal, WA_STANDOUT);
-    mvwaddch(modal, 1, 3, '[');
-    mvwaddch(modal, 1, width - 4, ']');
-    wrefresh(modal);
-    char buf[256];
-    draw_button_bar(modal, 3, 3, item_search_buttons, button);
-    echo();
-    mvwgetnstr(modal, 1, 4, buf, sizeof(buf));
-    noecho();
-    wmove(modal, 3, 3);
-    wrefresh(modal);
-    while ((ch = getch()) != '\n') {
-        if(ch == '\t') {
-            button = (button + 1) % (ARRLEN(item_search_buttons) - 1);
-            draw_button_bar(modal, 3, 3, item_search_buttons, button);
-        }
-    }
-    if(item_search_buttons[button].function != NULL) {
-        item_search_buttons[button].function(buf);
-    }
-    delwin(modal);
-    redraw();
-}
+   if ( sqlite3_prepare_v2(
+         db,
+         "select id from attachment where hash=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attach_find_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attachment lookup statement.");
+     return 1;
+   }
 
-int open_database(char* filename) {
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   if(db != NULL) {
-       sqlite3_close(db);
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into attachment(hash, size, data) values(?1, ?2, zeroblob(?2))",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attach_blob_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attachment insert statement.");
+     return 1;
    }
-   rc = sqlite3_open(filename, &db);
-   if( rc ) {
-      show_modal_error("Can't open database.");
-      exit(0);
-   } else {
-      //fprintf(stderr, "Opened database successfully\n");
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into item_attachment(item, name, blob) values(?, ?, ?)",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attach_link_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attachment link statement.");
+     return 1;
    }
-   /* Create SQL statement */
-   sql = "CREATE TABLE item("  \
-         "id     INTEGER PRIMARY KEY NOT NULL," \
-         "parent INT," \
-         "name   TEXT NOT NULL," \
-         "about  TEXT," \
-         "count  INT NOT NULL );";
 
-   /* Execute SQL statement */
-   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-   } else {
-      // fprintf(stderr, "Table created successfully\n");
+   if ( sqlite3_prepare_v2(
+         db,
+         "delete from item_attachment where item=? and name=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &attach_unlink_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare attachment unlink statement.");
+     return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "insert into item(parent, name, about, count) values (?,?,?,?)",  // stmt
+         "select blob from item_attachment where item=? and name=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &insert_stmt,
+         &attach_get_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare insert statement.");
+     show_modal_error("Could not prepare attachment statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select id,name,about,count from item where parent is ? limit ? offset ?",  // stmt
+         "select link.name, blob.size, blob.hash, (select count(*) from item_attachment other where other.blob=link.blob) " \
+         "from item_attachment link join attachment blob on blob.id=link.blob where link.item=? order by link.name",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &select_stmt,
+         &attach_list_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare select statement.");
+     show_modal_error("Could not prepare attachment list statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select about from item where id=?",  // stmt
+         "insert into item_attachment(item, name, blob) select ?2, name, blob from item_attachment where item=?1",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &description_stmt,
+         &attach_copy_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare select description statement.");
+     show_modal_error("Could not prepare item attachment copy statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "update item set parent=? where id=?",  // stmt
+         "insert into item_attachment(item, name, blob) select copy.new, link.name, link.blob from temp.copy_map copy join item_attachment link on link.item=copy.old",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &move_stmt,
+         &copy_attachments_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare get parent statement.");
+     show_modal_error("Could not prepare attachment copy statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select count(*) from item where parent is ?",  // stmt
+         SQL_COUNT_CHILDREN,  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
          &count_stmt,
          0  // Pointer to unused portion of stmt
@@ -1406,31 +7437,32 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select count from item where id=?",  // stmt
+         "select id,name,count,parent from item where id=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &item_count_stmt,
+         &item_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare item count statement.");
+     show_modal_error("Could not prepare item statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select parent from item where id=?",  // stmt
+         "with recursive up(id, name, parent) as (select id, name, parent from item where id=? " \
+         "union select item.id, item.name, item.parent from item join up on item.id=up.parent) select id, name from up",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
-         &item_parent_stmt,
+         &path_stmt,
          0  // Pointer to unused portion of stmt
        )
        != SQLITE_OK) {
-     show_modal_error("Could not prepare item parent statement.");
+     show_modal_error("Could not prepare path statement.");
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
          "update item set count=? where id=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
@@ -1442,7 +7474,7 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
          "update item set name=? where id=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
@@ -1454,7 +7486,7 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
          "update item set about=? where id=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
@@ -1466,7 +7498,7 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
          "delete from item where id=?",  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
@@ -1478,9 +7510,9 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select count(*) from item where name like ?",  // stmt
+         SQL_COUNT_BY_NAME,  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
          &count_by_name_stmt,
          0  // Pointer to unused portion of stmt
@@ -1490,9 +7522,9 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select count(*) from item where about like ?",  // stmt
+         SQL_COUNT_BY_ABOUT,  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
          &count_by_about_stmt,
          0  // Pointer to unused portion of stmt
@@ -1502,9 +7534,9 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select id,parent,name,about,count from item where name like ? limit ? offset ?",  // stmt
+         SQL_BY_NAME,  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
          &by_name_stmt,
          0  // Pointer to unused portion of stmt
@@ -1514,9 +7546,9 @@ int open_database(char* filename) {
      return 1;
    }
 
-   if ( sqlite3_prepare(
+   if ( sqlite3_prepare_v2(
          db,
-         "select id,parent,name,about,count from item where about like ? limit ? offset ?",  // stmt
+         SQL_BY_ABOUT,  // stmt
          -1, // If less than zero, then stmt is read up to the first nul terminator
          &by_about_stmt,
          0  // Pointer to unused portion of stmt
@@ -1526,6 +7558,230 @@ int open_database(char* filename) {
      return 1;
    }
 
+   if ( sqlite3_prepare_v2(
+         db,
+         SQL_COUNT_FUZZY,  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &count_fuzzy_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare count fuzzy statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         SQL_FUZZY,  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &fuzzy_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare fuzzy search statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select day,low,high,last,changes from item_daily where item=? and day between ? and ? order by day",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &history_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare history statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select last from item_daily where item=? and day<? order by day desc limit 1",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &history_carry_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare history carry statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select id,name,count,parent from item where count < threshold limit ? offset ?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &low_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare low stock statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select count(*) from item where count < threshold",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &count_low_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare count low stock statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "update item set threshold=? where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &threshold_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare threshold statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select threshold from item where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &item_threshold_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare item threshold statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "pragma data_version",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &data_version_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare data version statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select name_like,about_like,min_count,max_count,scope from saved_query where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &saved_query_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare saved query statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select id,name,null,0,null from saved_query order by id limit ? offset ?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &queries_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare list saved queries statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "select count(*) from saved_query",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &count_queries_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare count saved queries statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "insert into saved_query(name, name_like, about_like, min_count, max_count, scope) values (?,?,?,?,?,?)",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &insert_query_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare insert saved query statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "delete from saved_query where id=?",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &delete_query_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare delete saved query statement.");
+     return 1;
+   }
+
+   /* Every line of a pick list with the containers above it, in one go.
+      Lines that give a name find it through the item_name index. */
+   if ( sqlite3_prepare_v2(
+         db,
+         "with recursive pick(line, ref) as (select key, value from json_each(?1)), " \
+         "want(line, id) as (select line, ref from pick where typeof(ref)='integer' " \
+         "union all select pick.line, min(item.id) from pick join item on item.name=pick.ref where typeof(pick.ref)='text' group by pick.line), " \
+         "up(line, depth, id, parent, name, count) as (select want.line, 0, item.id, item.parent, item.name, item.count from want join item on item.id=want.id " \
+         "union all select up.line, up.depth + 1, item.id, item.parent, item.name, item.count from up join item on item.id=up.parent where up.depth < 256) " \
+         "select line, depth, id, name, count, (select value from item_attr where item_attr.item=up.id and key='" PICK_POSITION "') " \
+         "from up order by line, depth",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &pick_path_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare pick path statement.");
+     return 1;
+   }
+
+   if ( sqlite3_prepare_v2(
+         db,
+         "update item set count=count-json_extract(pick.value, '$[1]') from json_each(?1) as pick " \
+         "where item.id=json_extract(pick.value, '$[0]') and item.count>=json_extract(pick.value, '$[1]')",  // stmt
+         -1, // If less than zero, then stmt is read up to the first nul terminator
+         &pick_take_stmt,
+         0  // Pointer to unused portion of stmt
+       )
+       != SQLITE_OK) {
+     show_modal_error("Could not prepare pick take statement.");
+     return 1;
+   }
+
+   // Every edit from here on is logged for the other copies
+   sync_session = sync_start(db);
+
+   /* Readers need the file itself; a memory session does not read through
+      them at all. Without them everything reads on the primary connection. */
+   const char* path = sqlite3_db_filename(db, "main");
+   if(!memory_session && path != NULL && path[0] != 0) {
+       for(int i = 0; i < ARRLEN(panels); i++) {
+           reader_open(&panels[i].reader, path);
+       }
+       reader_open(&search_panel.reader, path);
+   }
+
+   /* A memory session browses and edits a copy of the items held in RAM;
+      changes reach the file through the write-behind queue. */
+   if(memory_session) {
+       if(memory_load(db) != 0) {
+           show_modal_error("Could not load items into memory.");
+           return 1;
+       }
+       store = &memory_store;
+   }
+
    for(int i = 0; i < ARRLEN(panels); i++) {
        panels[i].loaded = TRUE;
    }
@@ -1534,6 +7790,56 @@ int open_database(char* filename) {
 int main(int argc, char *argv[]) {
     int ch;
 
+    if(argc == 4 && strcmp(argv[1], "--snapshot") == 0) {
+        return snapshot_export(argv[2], argv[3]);
+    }
+    if(argc == 3 && strcmp(argv[1], "--compress") == 0) {
+        return about_recompress(argv[2]);
+    }
+    if(argc == 4 && strcmp(argv[1], "--backup") == 0) {
+        return backup_database(argv[2], argv[3]);
+    }
+    if(argc == 3 && strcmp(argv[1], "--compact") == 0) {
+        return compact_database(argv[2]);
+    }
+    if(argc == 5 && strcmp(argv[1], "--sync-copy") == 0) {
+        return sync_copy(argv[2], argv[3], atoi(argv[4]));
+    }
+    if(argc == 5 && strcmp(argv[1], "--sync-export") == 0) {
+        return sync_export(argv[2], atoi(argv[3]), argv[4]);
+    }
+    if(argc == 4 && strcmp(argv[1], "--sync-apply") == 0) {
+        return sync_apply(argv[2], argv[3]);
+    }
+    while(argc >= 2 && argv[1][0] == '-') {
+        if(strcmp(argv[1], "--memory") == 0) {
+            memory_session = TRUE;
+        } else if(argc >= 3 && strcmp(argv[1], "--record") == 0) {
+            input.record = fopen(argv[2], "w");
+            if(input.record == NULL) {
+                fprintf(stderr, "Can't write %s\n", argv[2]);
+                return 1;
+            }
+            argc--;
+            argv++;
+        } else if(argc >= 3 && strcmp(argv[1], "--trace") == 0) {
+            input.trace = atoi(argv[2]);
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+    if(argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        fprintf(stderr, "usage: invc [--memory] [--record keys] [database or snapshot]\n       invc --snapshot database snapshot\n       invc --compress database\n" \
+                        "       invc --backup database file\n       invc --compact database\n" \
+                        "       invc --sync-copy master copy replica\n       invc --sync-export database peer file\n" \
+                        "       invc --sync-apply database file\n");
+        return 1;
+    }
+
     // Activate the screen and enable the keypad
     initscr();
     noecho();
@@ -1545,26 +7851,53 @@ int main(int argc, char *argv[]) {
 
     // Left panel, right panel, and main menu bar locations and sizes
     panels[win_props.panel_left].win = newwin(win_props.main_height - 1, win_props.main_width / 2, 0, 0);
-    panels[win_props.panel_left].entries = malloc(sizeof(struct entry_t) * win_props.view_limit);
+    panel_reserve(&panels[win_props.panel_left], win_props.view_limit);
     panels[win_props.panel_right].win = newwin(win_props.main_height - 1, win_props.main_width / 2, 0, win_props.main_width / 2);
-    panels[win_props.panel_right].entries = malloc(sizeof(struct entry_t) * win_props.view_limit);
+    panel_reserve(&panels[win_props.panel_right], win_props.view_limit);
     bar = newwin(1, win_props.main_width, win_props.main_height - 1, 0);
 
     init_colors_midnight();
+    if(argc == 2) {
+        open_database(argv[1]);
+    } else if(memory_session) {
+        // Nothing to load, so start from an empty scratch inventory
+        store = &memory_store;
+        for(int i = 0; i < ARRLEN(panels); i++) {
+            panels[i].loaded = TRUE;
+        }
+    }
     redraw();
 
     select_window(panels[panel].win);
 
     struct action_source_t source = { .window = NULL };
-    while ((ch = getch()) != KEY_F(10)) {
-        if(ch != ERR) {
+    // Waiting for a key times out so queued changes get written when idle
+    timeout(WRITE_IDLE_MS);
+    while ((ch = input_key()) != KEY_F(10)) {
+        if(ch == ERR) {
+            memory_flush();
+            sync_record(db, &sync_session, -1);
+            if(federation_session != NULL) sync_record(federation, &federation_session, -1);
+            // Index what other tools have written since
+            trigram_catch_up(db, "main");
+            for(int i = 1; i < site_count; i++) trigram_catch_up(federation, sites[i].alias);
+            timeout(maintenance_idle() ? BACKUP_STEP_MS : WRITE_IDLE_MS);
+        } else if(ch == KEY_RESIZE) {
+            resize_layout();
+        } else {
+            timeout(-1);
+            source.key = ch;
             for(int i = 0; i < ARRLEN(actions); i++) {
                 if(ch == actions[i].key && actions[i].function != NULL) {
                     actions[i].function(source);
                 }
             }
+            if(write_queue.count >= WRITE_BATCH) memory_flush();
+            timeout(WRITE_IDLE_MS);
         }
     }
+    timeout(-1);
+    memory_flush();
 
     for(int i = 0; i < ARRLEN(panels); i++) {
       delwin(panels[i].win);
@@ -1572,6 +7905,10 @@ int main(int argc, char *argv[]) {
 
     delwin(bar);
     endwin();
-    sqlite3_close(db);
+    close_database();
+    snapshot_close();
+    memory_clear();
+    free(write_queue.ops);
+    if(input.record != NULL) fclose(input.record);
     return 0;
 }
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <sqlite3.h>
+#include <ncurses.h>
+#include <pty.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Replays keys recorded with 'invc --record' against invc running in a
+   pseudo-terminal of a fixed size, and reports how long each key took from
+   being written to invc waiting for the next one with the screen updated,
+   and how many bytes it wrote to the terminal meanwhile. Keys are sent as
+   soon as the one before is handled, so the recorded pauses are not kept. */
+
+#define REPLAY_ROWS 30
+#define REPLAY_COLS 100
+#define REPLAY_TIMEOUT_MS 10000
+
+struct key_name_t {
+    int code;
+    const char* bytes;
+};
+
+// What xterm sends for the keys invc uses, in keypad transmit mode
+struct key_name_t xterm_keys[] = {
+    {KEY_UP, "\033OA"}, {KEY_DOWN, "\033OB"}, {KEY_RIGHT, "\033OC"}, {KEY_LEFT, "\033OD"},
+    {KEY_HOME, "\033OH"}, {KEY_END, "\033OF"}, {KEY_IC, "\033[2~"}, {KEY_DC, "\033[3~"},
+    {KEY_PPAGE, "\033[5~"}, {KEY_NPAGE, "\033[6~"}, {KEY_BACKSPACE, "\177"}, {KEY_ENTER, "\033OM"},
+    {KEY_F(1), "\033OP"}, {KEY_F(2), "\033OQ"}, {KEY_F(3), "\033OR"}, {KEY_F(4), "\033OS"},
+    {KEY_F(5), "\033[15~"}, {KEY_F(6), "\033[17~"}, {KEY_F(7), "\033[18~"}, {KEY_F(8), "\033[19~"},
+    {KEY_F(9), "\033[20~"}, {KEY_F(10), "\033[21~"}, {KEY_F(11), "\033[23~"}, {KEY_F(12), "\033[24~"},
+};
+
+struct sample_t {
+    int code;
+    double ms;
+    long bytes;
+};
+
+double clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+int key_bytes(int code, char* out) {
+    if(code >= 0 && code < 256) {
+        out[0] = code;
+        out[1] = 0;
+        return 1;
+    }
+    for(int i = 0; i < sizeof(xterm_keys) / sizeof(xterm_keys[0]); i++) {
+        if(xterm_keys[i].code == code) {
+            strcpy(out, xterm_keys[i].bytes);
+            return strlen(out);
+        }
+    }
+    return 0;
+}
+
+/* Waits until invc reports having read keys keys, or has exited, counting
+   what it writes to the terminal. Gives the count reported, or -1. */
+int wait_ready(int master, int trace, int keys, long* bytes) {
+    char buf[4096];
+    double started = clock_ms();
+    int reported = -1;
+    while(reported < keys) {
+        struct pollfd fds[2] = { { master, POLLIN, 0 }, { trace, POLLIN, 0 } };
+        int left = REPLAY_TIMEOUT_MS - (int)(clock_ms() - started);
+        if(left <= 0 || poll(fds, 2, left) <= 0) return -1;
+        if(fds[0].revents & POLLIN) {
+            ssize_t got = read(master, buf, sizeof(buf));
+            if(got > 0) *bytes += got;
+        }
+        if(fds[1].revents & POLLIN) {
+            // Reports only grow, so the last one read is the one that counts
+            char reports[256];
+            ssize_t got = read(trace, reports, sizeof(reports) - 1);
+            if(got <= 0) return -1;
+            reports[got] = 0;
+            for(char* report = strtok(reports, "\n"); report != NULL; report = strtok(NULL, "\n")) reported = atoi(report);
+        } else if(fds[1].revents & (POLLHUP | POLLERR)) {
+            return -1;
+        }
+    }
+    // Everything written before the report is already waiting on the terminal
+    ssize_t got;
+    while((got = read(master, buf, sizeof(buf))) > 0) *bytes += got;
+    return reported;
+}
+
+int compare_ms(const void* a, const void* b) {
+    double x = ((const struct sample_t*)a)->ms, y = ((const struct sample_t*)b)->ms;
+    return x < y ? -1 : x > y;
+}
+
+int replay_run(const char* filename, char** command) {
+    FILE* in = fopen(filename, "r");
+    if(in == NULL) {
+        fprintf(stderr, "Can't open %s\n", filename);
+        return 1;
+    }
+    int count = 0, capacity = 256;
+    struct sample_t* samples = malloc(sizeof(struct sample_t) * capacity);
+    char line[256];
+    while(fgets(line, sizeof(line), in) != NULL) {
+        double pause;
+        int code;
+        if(line[0] == '#' || sscanf(line, "%lf %d", &pause, &code) != 2) continue;
+        if(count == capacity) samples = realloc(samples, sizeof(struct sample_t) * (capacity *= 2));
+        samples[count].code = code;
+        samples[count].ms = 0;
+        samples[count].bytes = 0;
+        count++;
+    }
+    fclose(in);
+
+    int pipes[2];
+    if(pipe(pipes) != 0) return 1;
+    int argc = 0;
+    while(command[argc] != NULL) argc++;
+    char** argv = malloc(sizeof(char*) * (argc + 3));
+    char fd[16];
+    snprintf(fd, sizeof(fd), "%d", pipes[1]);
+    argv[0] = command[0];
+    argv[1] = "--trace";
+    argv[2] = fd;
+    for(int i = 1; i <= argc; i++) argv[i + 2] = command[i];
+
+    int master;
+    struct winsize size = { REPLAY_ROWS, REPLAY_COLS, 0, 0 };
+    double started = clock_ms();
+    pid_t child = forkpty(&master, NULL, NULL, &size);
+    if(child < 0) {
+        fprintf(stderr, "Can't open a pseudo-terminal\n");
+        return 1;
+    }
+    if(child == 0) {
+        close(pipes[0]);
+        setenv("TERM", "xterm", 1);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    close(pipes[1]);
+    free(argv);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    int trace = pipes[0];
+
+    long startup_bytes = 0;
+    int failed = wait_ready(master, trace, 0, &startup_bytes) < 0;
+    double startup_ms = clock_ms() - started;
+    int sent = 0;
+    while(!failed && sent < count) {
+        char bytes[16];
+        struct sample_t* sample = &samples[sent];
+        int length = key_bytes(sample->code, bytes);
+        if(length == 0) {
+            fprintf(stderr, "Key %d has no xterm sequence\n", sample->code);
+            failed = TRUE;
+            break;
+        }
+        double before = clock_ms();
+        if(write(master, bytes, length) != length) break;
+        sent++;
+        int reported = wait_ready(master, trace, sent, &sample->bytes);
+        sample->ms = clock_ms() - before;
+        // The last key normally quits, and invc never waits again
+        if(reported < 0 && sent < count) failed = TRUE;
+    }
+    if(failed) fprintf(stderr, "invc stopped responding after %d of %d keys\n", sent, count);
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    close(trace);
+    close(master);
+
+    printf("# keys replayed from %s on a %dx%d xterm\n", filename, REPLAY_COLS, REPLAY_ROWS);
+    printf("# key  code  ms  bytes\n");
+    long total_bytes = 0;
+    double total_ms = 0;
+    for(int i = 0; i < sent; i++) {
+        printf("%d %d %.3f %ld\n", i + 1, samples[i].code, samples[i].ms, samples[i].bytes);
+        total_bytes += samples[i].bytes;
+        total_ms += samples[i].ms;
+    }
+    printf("startup %.3f ms %ld bytes\n", startup_ms, startup_bytes);
+    if(sent > 0) {
+        qsort(samples, sent, sizeof(struct sample_t), compare_ms);
+        printf("keys %d\n", sent);
+        printf("latency mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f ms\n", total_ms / sent,
+               samples[sent / 2].ms, samples[sent * 9 / 10].ms, samples[sent * 99 / 100].ms, samples[sent - 1].ms);
+        printf("written %ld bytes, %.0f per key\n", total_bytes, (double)total_bytes / sent);
+    }
+    free(samples);
+    return failed;
+}
+
+/* Writes a database of items in containers three deep, the same every
+   time, with a description on every fourth item. invc adds the rest of
+   its tables when it opens it. */
+int replay_fixture(const char* filename, int items) {
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+    const char* words[] = { "resistor", "capacitor", "screw", "washer", "cable", "fuse", "relay", "bracket" };
+    unlink(filename);
+    if(sqlite3_open(filename, &db) != SQLITE_OK) {
+        fprintf(stderr, "Can't create %s\n", filename);
+        return 1;
+    }
+    sqlite3_exec(db, "CREATE TABLE item(id INTEGER PRIMARY KEY NOT NULL, parent INT, name TEXT NOT NULL, about TEXT, count INT NOT NULL);" \
+                     "BEGIN;", 0, 0, 0);
+    sqlite3_prepare_v2(db, "insert into item(id, parent, name, about, count) values(?1, ?2, ?3, ?4, ?5)", -1, &stmt, 0);
+    unsigned int seed = 1;
+    for(int id = 1; id <= items; id++) {
+        char name[64], about[160];
+        seed = seed * 1103515245 + 12345;
+        // Ten rooms, ten shelves in each, items spread over the shelves
+        int parent = id <= 10 ? 0 : id <= 110 ? (id - 11) / 10 + 1 : 11 + (seed >> 8) % 100;
+        snprintf(name, sizeof(name), "%s %d", words[(seed >> 4) % 8], id);
+        snprintf(about, sizeof(about), "%s for the %s bin, see drawer %d", words[(seed >> 12) % 8], words[(seed >> 16) % 8], id % 97);
+        sqlite3_bind_int(stmt, 1, id);
+        if(parent == 0) sqlite3_bind_null(stmt, 2); else sqlite3_bind_int(stmt, 2, parent);
+        sqlite3_bind_text(stmt, 3, name, -1, SQLITE_TRANSIENT);
+        if(id % 4 == 0) sqlite3_bind_text(stmt, 4, about, -1, SQLITE_TRANSIENT); else sqlite3_bind_null(stmt, 4);
+        sqlite3_bind_int(stmt, 5, (seed >> 20) % 500);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    int failed = sqlite3_exec(db, "COMMIT;", 0, 0, 0) != SQLITE_OK;
+    sqlite3_close(db);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc == 4 && strcmp(argv[1], "fixture") == 0) {
+        return replay_fixture(argv[2], atoi(argv[3]));
+    }
+    if(argc >= 4 && strcmp(argv[1], "run") == 0) {
+        return replay_run(argv[2], argv + 3);
+    }
+    fprintf(stderr, "usage: replay fixture database items\n       replay run keys invc [invc options] database\n");
+    return 1;
+}